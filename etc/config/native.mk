@@ -30,8 +30,8 @@ ifeq ($(PO_NATIVE_PLATFORM),linux) #--------------------------------------------
 
   CC_NATIVE:=gcc -c -MMD -O2 -Isrc -Isrc/main -Werror -Wimplicit -DPO_NATIVE=1 -I/usr/include/libdrm
   LD_NATIVE:=gcc
-  LDPOST_NATIVE:=-lm -lz -lX11 -ldrm -lgbm -lGLESv2 -lEGL
-  OPT_ENABLE_NATIVE:=genioc x11 evdev drmgx
+  LDPOST_NATIVE:=-lm -lz -lX11 -ldrm -lgbm -lGLESv2 -lEGL -lpthread -lasound
+  OPT_ENABLE_NATIVE:=genioc x11 evdev drmgx alsa
   OPT_ENABLE_TOOL:=alsa ossmidi inotify
   EXE_NATIVE:=out/native/ivand
 
@@ -39,8 +39,8 @@ else ifeq ($(PO_NATIVE_PLATFORM),raspi) #---------------------------------------
 
   CC_NATIVE:=gcc -c -MMD -O2 -Isrc -Isrc/main -Werror -Wimplicit -DPO_NATIVE=1 -I/opt/vc/include
   LD_NATIVE:=gcc -L/opt/vc/lib
-  LDPOST_NATIVE:=-lm -lz -lbcm_host -lEGL -lGLESv2 -lGL
-  OPT_ENABLE_NATIVE:=genioc evdev bcm
+  LDPOST_NATIVE:=-lm -lz -lbcm_host -lEGL -lGLESv2 -lGL -lpthread -lasound
+  OPT_ENABLE_NATIVE:=genioc evdev bcm alsa
   OPT_ENABLE_TOOL:=alsa ossmidi inotify
   EXE_NATIVE:=out/native/ivand
 
@@ -49,7 +49,7 @@ else ifeq ($(PO_NATIVE_PLATFORM),linuxguiless) #--------------------------------
   CC_NATIVE:=gcc -c -MMD -O2 -Isrc -Isrc/main -Werror -Wimplicit -DPO_NATIVE=1 -I/usr/include/libdrm
   LD_NATIVE:=gcc
   LDPOST_NATIVE:=-lm -lz -ldrm -lgbm -lGLESv2 -lEGL -lpthread -lasound
-  OPT_ENABLE_NATIVE:=genioc evdev drmgx
+  OPT_ENABLE_NATIVE:=genioc evdev drmgx alsa
   OPT_ENABLE_TOOL:=alsa ossmidi inotify
   EXE_NATIVE:=out/native/ivand
 
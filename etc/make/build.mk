@@ -54,8 +54,11 @@ ifndef NATIVE_ONLY
   all:$(OUTFILES_WWW)
 endif
 
+# Tools that play our own data can link some of the embedded objects too.
+OFILES_TOOL_EXTRA_rendersong:=$(filter mid/native/data/embed/wave%,$(OFILES_NATIVE))
+
 define TOOL_RULES
-  OFILES_TOOL_$1:=$(filter mid/native/tool/$1/%,$(OFILES_NATIVE)) $(OFILES_TOOL_COMMON)
+  OFILES_TOOL_$1:=$(filter mid/native/tool/$1/%,$(OFILES_NATIVE)) $(OFILES_TOOL_COMMON) $(OFILES_TOOL_EXTRA_$1)
   TOOL_$1:=out/tool/$1
   all:$$(TOOL_$1)
   $$(TOOL_$1):$$(OFILES_TOOL_$1);$$(PRECMD) $(LD_NATIVE) -o $$@ $$^ $(LDPOST_NATIVE)
@@ -79,6 +82,7 @@ define EMBED_RULES
   mid/$1/data/embed/%.png.c:src/data/embed/%.png $(TOOL_cvtimg);$$(PRECMD) $(TOOL_cvtimg) -o$$@ $$< $2
   mid/$1/data/embed/%.wave.c:src/data/embed/%.wave $(TOOL_mkwave);$$(PRECMD) $(TOOL_mkwave) -o$$@ $$< $2
   mid/$1/data/embed/%.mid.c:src/data/embed/%.mid $(TOOL_mksong);$$(PRECMD) $(TOOL_mksong) -o$$@ $$< $2
+  mid/$1/data/embed/%.sprites.c:src/data/embed/%.sprites src/data/embed/%.png $(TOOL_mksprites);$$(PRECMD) $(TOOL_mksprites) -o$$@ $$< $2
   mid/$1/data/embed/font.png.c:src/data/embed/font.png $(TOOL_mkfont);$$(PRECMD) $(TOOL_mkfont) -o$$@ $$< $2
 endef
 $(eval $(call EMBED_RULES,native,))
@@ -88,3 +92,13 @@ $(eval $(call EMBED_RULES,wasm,))
 all:$(EXE_NATIVE)
 $(EXE_NATIVE):$(OFILES_GAME);$(PRECMD) $(LD_NATIVE) -o $@ $(OFILES_GAME) $(LDPOST_NATIVE)
 
+
+# Headless build of the game core, for measurement. Never part of OPT_ENABLE_NATIVE.
+OFILES_HEADLESS:=$(filter mid/native/main/% mid/native/data/embed/%,$(OFILES_NATIVE)) \
+  $(patsubst src/%.c,mid/native/%.o,$(filter src/opt/headless/%.c,$(CFILES)))
+ifneq ($(MAKECMDGOALS),clean)
+  -include $(patsubst %.o,%.d,$(filter mid/native/opt/headless/%,$(OFILES_HEADLESS)))
+endif
+EXE_HEADLESS:=out/native/ivand-headless
+all:$(EXE_HEADLESS)
+$(EXE_HEADLESS):$(OFILES_HEADLESS);$(PRECMD) $(LD_NATIVE) -o $@ $(OFILES_HEADLESS) -lm -lpthread
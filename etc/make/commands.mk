@@ -1,6 +1,7 @@
 # commands.mk
 
 run:$(EXE_NATIVE) $(INCLUDE_FILES_NATIVE);$(EXE_NATIVE) $(RUNARGS)
+headless:$(EXE_HEADLESS);$(EXE_HEADLESS) $(HEADLESSARGS)
 
 launch:$(TINY_BIN_SOLO); \
   stty -F /dev/$(TINY_PORT) 1200 ; \
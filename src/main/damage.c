@@ -0,0 +1,89 @@
+#include "damage.h"
+
+#if PO_NATIVE
+GAME_LOCAL struct damage *damage_recording=0;
+#endif
+
+/* Rects this close together merge.
+ * Repainting a few pixels of gap costs less than a longer list.
+ */
+#define DAMAGE_SLOP 2
+
+/* Clear.
+ */
+
+void damage_clear(struct damage *damage,const struct image *image) {
+  damage->image=image;
+  damage->c=0;
+  damage->full=0;
+}
+
+/* Add the whole image.
+ */
+
+void damage_add_all(struct damage *damage) {
+  damage->full=1;
+  damage->c=1;
+  damage->v[0].x=0;
+  damage->v[0].y=0;
+  damage->v[0].w=damage->image->w;
+  damage->v[0].h=damage->image->h;
+}
+
+/* Add rect.
+ */
+
+void damage_add(struct damage *damage,int16_t x,int16_t y,int16_t w,int16_t h) {
+  if (damage->full) return;
+  if (x<0) { w+=x; x=0; }
+  if (y<0) { h+=y; y=0; }
+  if (x>damage->image->w-w) w=damage->image->w-x;
+  if (y>damage->image->h-h) h=damage->image->h-y;
+  if ((w<1)||(h<1)) return;
+
+  // Absorb anything we overlap or nearly touch. The union might reach others, so start over after each.
+  int16_t r=x+w,b=y+h;
+  uint8_t i=damage->c;
+  while (i-->0) {
+    struct damage_rect *q=damage->v+i;
+    if ((q->x>r+DAMAGE_SLOP)||(q->y>b+DAMAGE_SLOP)||(q->x+q->w+DAMAGE_SLOP<x)||(q->y+q->h+DAMAGE_SLOP<y)) continue;
+    if (q->x<x) x=q->x;
+    if (q->y<y) y=q->y;
+    if (q->x+q->w>r) r=q->x+q->w;
+    if (q->y+q->h>b) b=q->y+q->h;
+    damage->v[i]=damage->v[--(damage->c)];
+    i=damage->c;
+  }
+
+  if (damage->c>=DAMAGE_LIMIT) {
+    damage_add_all(damage);
+    return;
+  }
+  struct damage_rect *q=damage->v+damage->c++;
+  q->x=x;
+  q->y=y;
+  q->w=r-x;
+  q->h=b-y;
+}
+
+/* Add list.
+ */
+
+void damage_add_list(struct damage *damage,const struct damage *src) {
+  if (src->full) {
+    damage_add_all(damage);
+    return;
+  }
+  const struct damage_rect *q=src->v;
+  uint8_t i=src->c;
+  for (;i-->0;q++) damage_add(damage,q->x,q->y,q->w,q->h);
+}
+
+/* Set recorder.
+ */
+
+void damage_record(struct damage *damage) {
+  #if PO_NATIVE
+    damage_recording=damage;
+  #endif
+}
@@ -0,0 +1,48 @@
+/* damage.h
+ * Track which parts of the framebuffer changed since the last frame.
+ * Native builds only. Elsewhere, the structs exist but nothing records into them, and the whole frame gets sent every time.
+ *
+ * A list holds up to DAMAGE_LIMIT rectangles. Rectangles that overlap or nearly touch merge as they're added,
+ * and if it still runs out of room, the list collapses to one rectangle covering the whole image.
+ *
+ * While a list is recording, every blit, glyph, and fill onto its image also adds to it.
+ * So nobody has to compute their own draw bounds; just draw.
+ */
+
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdint.h>
+#include "platform.h"
+
+#define DAMAGE_LIMIT 16
+
+struct damage {
+  const struct image *image; // bounds; and the recording target
+  struct damage_rect v[DAMAGE_LIMIT];
+  uint8_t c;
+  uint8_t full;
+};
+
+void damage_clear(struct damage *damage,const struct image *image);
+void damage_add(struct damage *damage,int16_t x,int16_t y,int16_t w,int16_t h);
+void damage_add_all(struct damage *damage);
+void damage_add_list(struct damage *damage,const struct damage *src);
+
+/* Add draws onto (damage->image) to (damage) until the next damage_record().
+ * Null to stop recording.
+ */
+void damage_record(struct damage *damage);
+
+#if PO_NATIVE
+  // The framebuffer's damage for the current frame, owned by main.c. Reset at the start of each loop().
+  extern GAME_LOCAL struct damage fbdamage;
+  extern GAME_LOCAL struct damage *damage_recording;
+  #define DAMAGE_NOTE(img,x,y,w,h) { \
+    if (damage_recording&&((img)==damage_recording->image)) damage_add(damage_recording,x,y,w,h); \
+  }
+#else
+  #define DAMAGE_NOTE(img,x,y,w,h)
+#endif
+
+#endif
@@ -12,6 +12,27 @@
 extern struct image bgtiles;
 extern struct image fgbits;
 
+/* Compiled sprites, generated from src/data/embed/fgbits.sprites.
+ * Each draws one frame of fgbits at (dstx,dsty) as a run of straight stores.
+ * Clipped frames fall back to image_blit_colorkey, same result either way.
+ * Out-of-range frames draw nothing.
+ */
+void spr_torso(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_legs(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_ivan_head(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_ivan_dead(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_ivan_shovel(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_ivan_dirt(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_ivan_statue(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_ivan_arm(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_guard_head(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_guard_climb(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_guard_violation(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_shovel(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_bullet(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_fairy(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+void spr_hp_pip(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+
 extern const int16_t wave0[];
 extern const int16_t wave1[];
 extern const int16_t wave2[];
@@ -23,4 +44,9 @@ extern const int16_t wave7[];
 
 extern const uint32_t font[96];
 
+/* The same glyphs as (font), unpacked to 8 row masks each, 0x80 leftmost, relative to the top of the cell.
+ * Generated alongside (font) by mkfont. text.c draws from these.
+ */
+extern const uint8_t font_rows[96*8];
+
 #endif
@@ -1,9 +1,12 @@
 #include "game.h"
 #include "platform.h"
 #include "data.h"
+#include "text.h"
+#include "postfx.h"
 #include "synth.h"
 #include "world.h"
 #include "timed_tasks.h"
+#include "damage.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,11 +16,43 @@
 /* Globals.
  */
  
-static uint8_t tattle=TATTLE_NONE;
-static int16_t tattlex,tattley;
-uint32_t gameclock;
-uint8_t hp;
-uint32_t activity_framec;
+static GAME_LOCAL uint8_t tattle=TATTLE_NONE;
+static GAME_LOCAL int16_t tattlex,tattley;
+GAME_LOCAL uint32_t gameclock;
+GAME_LOCAL uint8_t hp;
+GAME_LOCAL uint32_t activity_framec;
+static GAME_LOCAL uint32_t prng=1;
+
+#if PO_NATIVE
+/* Damage tracking, see damage.h.
+ * (overlays) is everything drawn over the background last frame.
+ * Next frame, we repaint the background only there, unless something bigger changed.
+ */
+static GAME_LOCAL struct damage overlays;
+static GAME_LOCAL struct {
+  uint8_t valid;
+  int16_t camx,camy; // pixels
+  uint32_t grid_revision;
+} pvrender;
+#endif
+
+/* PRNG, xorshift32.
+ */
+ 
+void game_srand(uint32_t seed) {
+  prng=seed?seed:1;
+}
+
+uint32_t game_rand_state() {
+  return prng;
+}
+
+uint32_t game_rand() {
+  prng^=prng<<13;
+  prng^=prng>>17;
+  prng^=prng<<5;
+  return prng;
+}
 
 /* End.
  */
@@ -29,8 +64,8 @@ void game_end() {
 /* Begin.
  */
  
-void game_begin() {
-  srand(millis());
+void game_begin(uint32_t seed) {
+  game_srand(seed);
   
   grid_default();
   thumbnail_draw();
@@ -38,13 +73,17 @@ void game_begin() {
   hp=HP_MAX;
   framec=0;
   activity_framec=0;
+  #if PO_NATIVE
+    pvrender.valid=0;
+  #endif
   
   memset(spritev,0,sizeof(spritev));
+  memset(&spritepools,0,sizeof(spritepools));
+  sprite_reindex();
   struct sprite *sprite;
   
   // Ivan.
-  if (sprite=sprite_new()) {
-    sprite->controller=SPRITE_CONTROLLER_IVAN;
+  if (sprite=sprite_new(SPRITE_CONTROLLER_IVAN)) {
     sprite->w=TILE_W_MM;
     sprite->h=11*MM_PER_PIXEL;
     int16_t herocol=WORLD_W_TILES>>1;
@@ -54,8 +93,7 @@ void game_begin() {
   }
   
   // The Shovel.
-  if (sprite=sprite_new()) {
-    sprite->controller=SPRITE_CONTROLLER_SHOVEL;
+  if (sprite=sprite_new(SPRITE_CONTROLLER_SHOVEL)) {
     sprite->w=13*MM_PER_PIXEL;
     sprite->h=5*MM_PER_PIXEL;
     sprite->x=35*TILE_W_MM;
@@ -63,8 +101,7 @@ void game_begin() {
   }
   
   // The Guard.
-  if (sprite=sprite_new()) {
-    sprite->controller=SPRITE_CONTROLLER_GUARD;
+  if (sprite=sprite_new(SPRITE_CONTROLLER_GUARD)) {
     sprite->w=5*MM_PER_PIXEL;
     sprite->h=11*MM_PER_PIXEL;
     sprite->x=40*TILE_W_MM;
@@ -78,36 +115,74 @@ void game_begin() {
  */
  
 void game_input(uint8_t input,uint8_t pvinput) {
-  struct sprite *sprite=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;sprite++) switch (sprite->controller) {
+  struct sprite *sprite;
+  for (sprite=sprite_next(0);sprite;sprite=sprite_next(sprite)) switch (sprite->controller) {
     case SPRITE_CONTROLLER_IVAN: sprite_input_ivan(sprite,input,pvinput); break;
   }
 }
 
+/* Nonzero if any of (sprite) is in the camera's view.
+ */
+ 
+static uint8_t game_sprite_in_view(const struct sprite *sprite) {
+  coord_t camright=camera.x+camera.w;
+  if (sprite->y>=camera.y+camera.h) return 0;
+  if (sprite->y+sprite->h<=camera.y) return 0;
+  if (sprite->x>=camright) return 0;
+  if (camright>WORLD_W_MM) { // could be in the natural or wrapped slice
+    if ((sprite->x>=camright-WORLD_W_MM)&&(sprite->x+sprite->w<=camera.x)) return 0;
+  } else { // single slice, easy
+    if (sprite->x+sprite->w<=camera.x) return 0;
+  }
+  return 1;
+}
+
+/* Follow the hero with the camera, and advance animations of the sprites in view.
+ * This used to happen during render, and it's still view-dependent, but now it happens every update whether we render or not.
+ */
+ 
+static void game_animate() {
+  camera_update(spritev+0);
+  struct sprite *sprite;
+  for (sprite=sprite_next(0);sprite;sprite=sprite_next(sprite)) {
+    if (!game_sprite_in_view(sprite)) continue;
+    switch (sprite->controller) {
+      case SPRITE_CONTROLLER_IVAN: sprite_animate_ivan(sprite); break;
+      case SPRITE_CONTROLLER_GUARD: sprite_animate_guard(sprite); break;
+      case SPRITE_CONTROLLER_SHOVEL: sprite_animate_shovel(sprite); break;
+      case SPRITE_CONTROLLER_FAIRY: sprite_animate_fairy(sprite); break;
+    }
+  }
+}
+
 /* Update.
  */
  
+void game_update_sprites() {
+  struct sprite *sprite;
+  sprite_batch_begin();
+  for (sprite=sprite_next_of(SPRITE_CONTROLLER_IVAN,0);sprite;sprite=sprite_next_of(SPRITE_CONTROLLER_IVAN,sprite)) sprite_update_ivan(sprite);
+  for (sprite=sprite_next_of(SPRITE_CONTROLLER_GUARD,0);sprite;sprite=sprite_next_of(SPRITE_CONTROLLER_GUARD,sprite)) sprite_update_guard(sprite);
+  for (sprite=sprite_next_of(SPRITE_CONTROLLER_BULLET,0);sprite;sprite=sprite_next_of(SPRITE_CONTROLLER_BULLET,sprite)) sprite_update_bullet(sprite);
+  for (sprite=sprite_next_of(SPRITE_CONTROLLER_FAIRY,0);sprite;sprite=sprite_next_of(SPRITE_CONTROLLER_FAIRY,sprite)) sprite_update_fairy(sprite);
+  sprite_batch_end();
+}
+ 
 void game_update() {
 
   tattle=TATTLE_NONE;
-  struct sprite *sprite=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;sprite++) switch (sprite->controller) {
-    case SPRITE_CONTROLLER_IVAN: sprite_update_ivan(sprite); break;
-    case SPRITE_CONTROLLER_GUARD: sprite_update_guard(sprite); break;
-    case SPRITE_CONTROLLER_BULLET: sprite_update_bullet(sprite); break;
-    case SPRITE_CONTROLLER_FAIRY: sprite_update_fairy(sprite); break;
-  }
+  sprite_index_rebuild();
+  game_update_sprites();
   
   if (gameclock) gameclock--;
   timed_tasks_update();
+  game_animate();
 }
 
 /* Request tattle.
  */
  
-void set_tattle(int16_t x,int16_t y,uint8_t reqtattle) {
+void set_tattle(coord_t x,coord_t y,uint8_t reqtattle) {
   
   // Tattle IDs are arranged such that higher is more significant.
   if (reqtattle<=tattle) return;
@@ -125,7 +200,7 @@ void injure_hero(struct sprite *sprite) {
   if (!sprite) sprite=game_get_hero();
   if (hp>1) {
     hp--;
-    //TODO sound effect
+    game_sfx(SFX_INJURY,0);
   } else {
     hp=0;
     if (gameclock>250) gameclock=250;
@@ -133,6 +208,22 @@ void injure_hero(struct sprite *sprite) {
   if (sprite) hero_highlight_injury(sprite);
 }
 
+/* Sound effect.
+ */
+ 
+void game_sfx(uint8_t sfxid,const struct sprite *source) {
+  if (source&&!game_sprite_in_view(source)) return;
+  switch (sfxid) {
+    case SFX_INJURY: {
+        synth_sfx(&synth,5,45,6000);
+        synth_sfx(&synth,5,46,6000);
+      } break;
+    case SFX_GUNSHOT: {
+        synth_sfx(&synth,7,30,3000);
+      } break;
+  }
+}
+
 /* Render dialogue bubble.
  */
  
@@ -172,7 +263,7 @@ static void render_tattle() {
         int16_t dsty=tattley-dsth-camera.y/MM_PER_PIXEL;
         render_dialogue_bubble(dstx,dsty,dstw,dsth,dstx+(dstw>>1));
         image_blit_colorkey(&fb,dstx+3,dsty+3,&fgbits,15,28,5,5);
-        image_blit_string(&fb,dstx+11,dsty+2,"Pick up",7,0x0000,font);
+        text_blit(&fb,dstx+11,dsty+2,"Pick up",7,0x0000);
       } break;
       
     case TATTLE_PICKUP: {
@@ -186,7 +277,7 @@ static void render_tattle() {
         ) dstx+=WORLD_W_PIXELS;
         render_dialogue_bubble(dstx,dsty,dstw,dsth,dstx+(dstw>>1));
         image_blit_colorkey(&fb,dstx+3,dsty+3,&fgbits,10,28,5,5);
-        image_blit_string(&fb,dstx+11,dsty+2,"Pick up",7,0x0000,font);
+        text_blit(&fb,dstx+11,dsty+2,"Pick up",7,0x0000);
       } break;
       
     case TATTLE_TRUCK: {//TODO spacing, verbiage
@@ -195,7 +286,7 @@ static void render_tattle() {
         int16_t dstx=tattlex-(dstw>>1)-camera.x/MM_PER_PIXEL;
         int16_t dsty=tattley-dsth-camera.y/MM_PER_PIXEL;
         render_dialogue_bubble(dstx,dsty,dstw,dsth,dstx+(dstw>>1));
-        image_blit_string(&fb,dstx+3,dsty+2,"Truck",5,0x0000,font);
+        text_blit(&fb,dstx+3,dsty+2,"Truck",5,0x0000);
       } break;
       
     //XXX I ended up not using these tattles.
@@ -209,7 +300,7 @@ static void render_tattle() {
         int16_t dsty=tattley-dsth-camera.y/MM_PER_PIXEL;
         render_dialogue_bubble(dstx,dsty,dstw,dsth,dstx+(dstw>>1));
         image_blit_colorkey(&fb,dstx+2,dsty+2,&fgbits,5,20,8,8);
-        image_blit_string(&fb,dstx+12,dsty+2,"on top",6,0x0000,font);
+        text_blit(&fb,dstx+12,dsty+2,"on top",6,0x0000);
       } break;
       
     case TATTLE_BARREL: {
@@ -219,7 +310,7 @@ static void render_tattle() {
         int16_t dsty=tattley-dsth-camera.y/MM_PER_PIXEL;
         render_dialogue_bubble(dstx,dsty,dstw,dsth,dstx+(dstw>>1));
         image_blit_colorkey(&fb,dstx+2,dsty+2,&bgtiles,TILE_W_PIXELS*1,TILE_H_PIXELS*1,TILE_W_PIXELS,TILE_H_PIXELS);
-        image_blit_string(&fb,dstx+11,dsty+2,"Bury",4,0x0000,font);
+        text_blit(&fb,dstx+11,dsty+2,"Bury",4,0x0000);
       } break;
   }
 }
@@ -259,7 +350,7 @@ static void game_render_clock() {
   char text[32];
   int32_t textc=snprintf(text,sizeof(text),"%d:%02d",min,sec);
   if (textc>0) {
-    image_blit_string(&fb,1,1,text,textc,0x0000,font);
+    text_blit(&fb,1,1,text,textc,0x0000);
   }
 }
 
@@ -270,45 +361,63 @@ static void game_render_hp() {
   int16_t x=19;
   uint8_t i=0;
   for (;i<HP_MAX;i++,x+=6) {
-    int16_t srcx=(i<hp)?7:2;
-    image_blit_colorkey(&fb,x,1,&fgbits,srcx,5,5,4);
+    spr_hp_pip(&fb,x,1,(i<hp)?1:0,0);
   }
 }
 
 /* Render scene.
  */
  
+#if PO_NATIVE
+static void game_render_background() {
+  int16_t camx=camera.x/MM_PER_PIXEL;
+  int16_t camy=camera.y/MM_PER_PIXEL;
+  uint32_t revision=grid_revision();
+  
+  // Scrolling, digging, and fading touch every pixel. Also the first frame, there's nothing to build on.
+  if (
+    !pvrender.valid||
+    (camx!=pvrender.camx)||(camy!=pvrender.camy)||
+    (revision!=pvrender.grid_revision)||
+    (gameclock<FADE_OUT_TIME)
+  ) {
+    pvrender.valid=1;
+    pvrender.camx=camx;
+    pvrender.camy=camy;
+    pvrender.grid_revision=revision;
+    grid_render_camera(&fb);
+    damage_add_all(&fbdamage);
+    return;
+  }
+  
+  // Otherwise the background only needs repair where last frame's sprites and HUD were.
+  const struct damage_rect *rect=overlays.v;
+  uint8_t i=overlays.c;
+  for (;i-->0;rect++) grid_render_camera_rect(&fb,rect->x,rect->y,rect->w,rect->h);
+  damage_add_list(&fbdamage,&overlays);
+}
+#endif
+
 void game_render() {
 
   // Background grid, overwrites entire framebuffer.
-  struct sprite *hero=spritev+0;
-  camera_update(hero);
-  int16_t camright=camera.x+camera.w;
-  int16_t cambottom=camera.y+camera.h;
-  if (camright>WORLD_W_MM) {
-    int16_t leftwmm=WORLD_W_MM-camera.x;
-    int16_t leftwpx=(leftwmm+MM_PER_PIXEL-1)/MM_PER_PIXEL;
-    grid_render(&fb,0,0,camera.x,camera.y,leftwmm,camera.h);
-    grid_render(&fb,leftwpx,0,0,camera.y,CAMERA_W_MM-leftwmm,camera.h);
-  } else {
-    grid_render(&fb,0,0,camera.x,camera.y,camera.w,camera.h);
-  }
+  // On native builds, only the parts that need it, and we track what changed for the driver.
+  // game_update() already moved the camera.
+  #if PO_NATIVE
+    game_render_background();
+    damage_clear(&overlays,&fb);
+    damage_record(&overlays);
+  #else
+    grid_render_camera(&fb);
+  #endif
   
   // Sprites.
-  struct sprite *sprite=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;sprite++) {
+  struct sprite *sprite;
+  for (sprite=sprite_next(0);sprite;sprite=sprite_next(sprite)) {
   
     // Skip fast if it won't draw anything.
     if (sprite->controller==SPRITE_CONTROLLER_NONE) continue;
-    if (sprite->y>=cambottom) continue;
-    if (sprite->y+sprite->h<=camera.y) continue;
-    if (sprite->x>=camright) continue;
-    if (camright>WORLD_W_MM) { // could be in the natural or wrapped slice
-      if ((sprite->x>=camera.x+camera.w-WORLD_W_MM)&&(sprite->x+sprite->w<=camera.x)) continue;
-    } else { // single slice, easy
-      if (sprite->x+sprite->w<=camera.x) continue;
-    }
+    if (!game_sprite_in_view(sprite)) continue;
     
     switch (sprite->controller) {
       case SPRITE_CONTROLLER_IVAN: sprite_render_ivan(sprite); break;
@@ -333,18 +442,14 @@ void game_render() {
   // Tattle.
   render_tattle();
   
+  #if PO_NATIVE
+    damage_record(0);
+    damage_add_list(&fbdamage,&overlays);
+  #endif
+  
   // Fade out near the end.
   if (gameclock<FADE_OUT_TIME) {
     int8_t fade=20-(gameclock*20)/FADE_OUT_TIME;
-    if (fade>0) {
-      uint16_t *p=fb.v;
-      uint16_t fi=fb.w*fb.h;
-      for (;fi-->0;p++) {
-        uint8_t y=((*p)>>8)&0x1f;
-        if (y>fade) y-=fade;
-        else y=0;
-        *p=(y<<8)|(y<<3)|(y>>2)|(y<<13);
-      }
-    }
+    if (fade>0) postfx_fade(&fb,fade);
   }
 }
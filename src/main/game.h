@@ -9,17 +9,19 @@
 #define GAME_H
 
 #include <stdint.h>
+#include "platform.h"
+#include "world.h"
 
 struct image;
 struct synth;
 struct sprite;
 
-extern struct image fb;
-extern struct synth synth;
-extern uint32_t framec; // resets each round
-extern uint32_t gameclock; // frames; counts down
-extern uint8_t hp;
-extern uint32_t activity_framec; // starts zero, incremented by hero
+extern GAME_LOCAL struct image fb;
+extern GAME_LOCAL struct synth synth;
+extern GAME_LOCAL uint32_t framec; // resets each round
+extern GAME_LOCAL uint32_t gameclock; // frames; counts down
+extern GAME_LOCAL uint8_t hp;
+extern GAME_LOCAL uint32_t activity_framec; // starts zero, incremented by hero
 
 #define GAME_DURATION_FRAMES (60*60*3)
 
@@ -41,16 +43,63 @@ extern uint32_t activity_framec; // starts zero, incremented by hero
 
 void game_end();
 
-void game_begin();
+/* Private PRNG, so concurrent games don't share libc's rand() state.
+ * game_begin() seeds it.
+ */
+void game_srand(uint32_t seed);
+uint32_t game_rand();
+uint32_t game_rand_state(); // game_srand(game_rand_state()) is a noop
+
+/* (seed) is the only source of randomness during play; same seed and input, same game.
+ */
+void game_begin(uint32_t seed);
 
 void game_input(uint8_t input,uint8_t pvinput);
 void game_update();
 void game_render();
 
-struct sprite *sprite_new();
+/* Sprite slots.
+ * Use sprite_new() and sprite_del() rather than touching (controller) directly, they keep a bitmask of live slots.
+ * sprite_new() zeroes the slot, header and controller state, and sets (controller), which must not change after.
+ * Anything that writes (spritev) or (spritepools) wholesale must call sprite_reindex() after.
+ * sprite_next() walks live sprites in slot order: Start with null, it returns null after the last.
+ * Sprites created during a walk, in a higher slot, will be visited.
+ */
+struct sprite *sprite_new(uint8_t controller);
+void sprite_del(struct sprite *sprite);
+void sprite_reindex();
+struct sprite *sprite_next(struct sprite *sprite);
+
+/* Batch passes.
+ * game_update() runs each controller's sprites together, one controller after another, instead of switching per slot.
+ * sprite_next_of() walks the live sprites of one controller in slot order.
+ * Between sprite_batch_begin() and sprite_batch_end(), a sprite created in a lower slot than the one updating
+ * sits out the remaining passes, just as a single slot-order walk would have skipped it.
+ * game_update_sprites() is the whole thing, every controller's pass. game_update() calls it after rebuilding the sprite index.
+ */
+void game_update_sprites();
+void sprite_batch_begin();
+void sprite_batch_end();
+struct sprite *sprite_next_of(uint8_t controller,struct sprite *sprite);
+
+/* Write one slot as a single record in the pre-split layout, SPRITE_RECORD_SIZE bytes:
+ * Header, then controller state zero-padded to SPRITE_OPAQUE_SIZE.
+ * Replay hashes are taken over this, so recordings made before the split still check out.
+ */
+void sprite_encode(uint8_t *dst,const struct sprite *sprite);
+
+/* Find live sprites overlapping a rectangle in mm.
+ * Overlap is tested in plain world coordinates, like the game's other collision checks: A rect past the right edge doesn't fold back.
+ * Up to (dsta) go into (dst), in slot order. Returns the count found, which may exceed (dsta).
+ * Backed by a grid of tile columns, so the cost depends on how many sprites are nearby, not how many exist.
+ * game_update() rebuilds the index each frame; sprite_index_rebuild() if you've moved things some other way.
+ */
+uint16_t sprite_find(struct sprite **dst,uint16_t dsta,coord_t x,coord_t y,coord_t w,coord_t h);
+void sprite_index_rebuild();
+
 uint8_t sprite_is_grounded(const struct sprite *sprite);
-int16_t sprite_move_horz(struct sprite *sprite,int16_t dx); // => actual movement
-int16_t sprite_move_vert(struct sprite *sprite,int16_t dy); // => actual movement
+coord_t sprite_move_horz(struct sprite *sprite,coord_t dx); // => actual movement
+coord_t sprite_move_vert(struct sprite *sprite,coord_t dy); // => actual movement
 void sprite_get_render_position(int16_t *x,int16_t *y,const struct sprite *sprite);
 
 struct sprite *game_get_hero();
@@ -62,6 +111,15 @@ void sprite_update_ivan(struct sprite *sprite);
 void sprite_update_guard(struct sprite *sprite);
 void sprite_update_bullet(struct sprite *sprite);
 void sprite_update_fairy(struct sprite *sprite);
+
+/* Animation clocks are game state: they're in snapshots and replay hashes.
+ * So they advance in game_update(), for sprites in view, and sprite_render_*() only reads them.
+ * That way skipping a render can't change anything.
+ */
+void sprite_animate_ivan(struct sprite *sprite);
+void sprite_animate_guard(struct sprite *sprite);
+void sprite_animate_shovel(struct sprite *sprite);
+void sprite_animate_fairy(struct sprite *sprite);
 void sprite_render_ivan(struct sprite *sprite);
 void sprite_render_dummy(struct sprite *sprite);
 void sprite_render_guard(struct sprite *sprite);
@@ -80,8 +138,15 @@ void render_dialogue_bubble(int16_t x,int16_t y,int16_t w,int16_t h,int16_t focu
 /* Request that a tattle be rendered on the top, at world position (x,y)mm.
  * You have to re-request it every frame.
  */
-void set_tattle(int16_t x,int16_t y,uint8_t tattle);
+void set_tattle(coord_t x,coord_t y,uint8_t tattle);
 
 void injure_hero(struct sprite *sprite);
 
+/* Sound effects play on the synth's reserved voices, so the song can't crowd them out.
+ * With a (source) sprite, only if it's in view; we don't want to hear every guard in the world.
+ */
+#define SFX_INJURY 1
+#define SFX_GUNSHOT 2
+void game_sfx(uint8_t sfxid,const struct sprite *source);
+
 #endif
@@ -15,8 +15,8 @@
 /* Globals.
  */
  
-static uint32_t highscore=0;
-static uint8_t highscore_loaded=0;
+static GAME_LOCAL uint32_t highscore=0;
+static GAME_LOCAL uint8_t highscore_loaded=0;
 
 /* Path for native builds.
  */
@@ -24,6 +24,9 @@ static uint8_t highscore_loaded=0;
 #if PO_NATIVE
   static char highscore_path_storage[1024];
   static const char *highscore_path() {
+    // IVAND_HIGHSCORE overrides the whole path, eg "/dev/null" for automated play.
+    const char *override=getenv("IVAND_HIGHSCORE");
+    if (override&&override[0]) return override;
     const char *home=getenv("HOME");
     int c=snprintf(highscore_path_storage,sizeof(highscore_path_storage),"%s/.config/aksomm/ivand/highscore",home);
     if ((c<1)||(c>=sizeof(highscore_path_storage))) return 0;
@@ -1,4 +1,5 @@
 #include "platform.h"
+#include "damage.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -11,7 +12,8 @@
   if (dsty<0) { srcy-=dsty; h+=dsty; dsty=0; } \
   if (dstx>dst->w-w) w=dst->w-dstx; \
   if (dsty>dst->h-h) h=dst->h-dsty; \
-  if ((w<1)||(h<1)) return;
+  if ((w<1)||(h<1)) return; \
+  DAMAGE_NOTE(dst,dstx,dsty,w,h)
 
 /* Blit opaque.
  */
@@ -31,6 +33,259 @@ void image_blit_opaque(
   }
 }
 
+/* SIMD colorkey rows, native only.
+ * Each vector: mask where source is zero, keep (dst) there and take (src) everywhere else.
+ * Rows that aren't a multiple of the vector width finish with one overlapping vector.
+ * That's safe because blending the same source twice gives the same result as once.
+ * Rows narrower than 4 pixels stay scalar.
+ *********************************************************************/
+
+#if PO_NATIVE&&defined(__SSE2__)
+  #define IMAGE_SIMD_X86 1
+  #include <immintrin.h>
+#elif PO_NATIVE&&defined(__ARM_NEON)
+  #define IMAGE_SIMD_ARM 1
+  #include <arm_neon.h>
+#endif
+
+#if IMAGE_SIMD_X86
+
+static inline __m128i image_rev8_sse2(__m128i v) {
+  v=_mm_shuffle_epi32(v,_MM_SHUFFLE(0,1,2,3));
+  v=_mm_shufflelo_epi16(v,_MM_SHUFFLE(2,3,0,1));
+  return _mm_shufflehi_epi16(v,_MM_SHUFFLE(2,3,0,1));
+}
+
+static inline void image_key8_sse2(uint16_t *dst,__m128i s) {
+  __m128i d=_mm_loadu_si128((__m128i*)dst);
+  __m128i m=_mm_cmpeq_epi16(s,_mm_setzero_si128());
+  _mm_storeu_si128((__m128i*)dst,_mm_or_si128(_mm_and_si128(m,d),_mm_andnot_si128(m,s)));
+}
+
+static inline void image_key4_sse2(uint16_t *dst,__m128i s) {
+  __m128i d=_mm_loadl_epi64((__m128i*)dst);
+  __m128i m=_mm_cmpeq_epi16(s,_mm_setzero_si128());
+  _mm_storel_epi64((__m128i*)dst,_mm_or_si128(_mm_and_si128(m,d),_mm_andnot_si128(m,s)));
+}
+
+// (src) is the row's leftmost source pixel, flopped or not.
+static inline void image_colorkey_row_sse2(uint16_t *dst,const uint16_t *src,int w,int flop) {
+  if (w>=8) {
+    int x=0; for (;;x+=8) {
+      if (x>w-8) x=w-8;
+      if (flop) image_key8_sse2(dst+x,image_rev8_sse2(_mm_loadu_si128((__m128i*)(src+w-8-x))));
+      else image_key8_sse2(dst+x,_mm_loadu_si128((__m128i*)(src+x)));
+      if (x==w-8) break;
+    }
+  } else if (flop) {
+    image_key4_sse2(dst,_mm_shufflelo_epi16(_mm_loadl_epi64((__m128i*)(src+w-4)),_MM_SHUFFLE(0,1,2,3)));
+    image_key4_sse2(dst+w-4,_mm_shufflelo_epi16(_mm_loadl_epi64((__m128i*)src),_MM_SHUFFLE(0,1,2,3)));
+  } else {
+    image_key4_sse2(dst,_mm_loadl_epi64((__m128i*)src));
+    image_key4_sse2(dst+w-4,_mm_loadl_epi64((__m128i*)(src+w-4)));
+  }
+}
+
+static void image_colorkey_sse2(
+  uint16_t *dstrow,int dststride,const uint16_t *srcrow,int srcstride,int w,int h,int flop
+) {
+  for (;h-->0;dstrow+=dststride,srcrow+=srcstride) image_colorkey_row_sse2(dstrow,srcrow,w,flop);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i image_rev16_avx2(__m256i v) {
+  const __m256i shuf=_mm256_setr_epi8(
+    14,15,12,13,10,11,8,9,6,7,4,5,2,3,0,1,
+    14,15,12,13,10,11,8,9,6,7,4,5,2,3,0,1
+  );
+  return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v,shuf),_MM_SHUFFLE(1,0,3,2));
+}
+
+__attribute__((target("avx2")))
+static inline void image_key16_avx2(uint16_t *dst,__m256i s) {
+  __m256i d=_mm256_loadu_si256((__m256i*)dst);
+  __m256i m=_mm256_cmpeq_epi16(s,_mm256_setzero_si256());
+  _mm256_storeu_si256((__m256i*)dst,_mm256_blendv_epi8(s,d,m));
+}
+
+__attribute__((target("avx2")))
+static void image_colorkey_avx2(
+  uint16_t *dstrow,int dststride,const uint16_t *srcrow,int srcstride,int w,int h,int flop
+) {
+  // Our sprites are mostly narrower than 16, so SSE2 does most of the work anyway.
+  if (w<16) {
+    image_colorkey_sse2(dstrow,dststride,srcrow,srcstride,w,h,flop);
+    return;
+  }
+  for (;h-->0;dstrow+=dststride,srcrow+=srcstride) {
+    int x=0; for (;;x+=16) {
+      if (x>w-16) x=w-16;
+      if (flop) image_key16_avx2(dstrow+x,image_rev16_avx2(_mm256_loadu_si256((__m256i*)(srcrow+w-16-x))));
+      else image_key16_avx2(dstrow+x,_mm256_loadu_si256((__m256i*)(srcrow+x)));
+      if (x==w-16) break;
+    }
+  }
+}
+
+#elif IMAGE_SIMD_ARM
+
+static inline uint16x8_t image_rev8_neon(uint16x8_t v) {
+  v=vrev64q_u16(v);
+  return vcombine_u16(vget_high_u16(v),vget_low_u16(v));
+}
+
+static inline void image_key8_neon(uint16_t *dst,uint16x8_t s) {
+  uint16x8_t m=vceqq_u16(s,vdupq_n_u16(0));
+  vst1q_u16(dst,vbslq_u16(m,vld1q_u16(dst),s));
+}
+
+static inline void image_key4_neon(uint16_t *dst,uint16x4_t s) {
+  uint16x4_t m=vceq_u16(s,vdup_n_u16(0));
+  vst1_u16(dst,vbsl_u16(m,vld1_u16(dst),s));
+}
+
+static void image_colorkey_neon(
+  uint16_t *dstrow,int dststride,const uint16_t *srcrow,int srcstride,int w,int h,int flop
+) {
+  for (;h-->0;dstrow+=dststride,srcrow+=srcstride) {
+    if (w>=8) {
+      int x=0; for (;;x+=8) {
+        if (x>w-8) x=w-8;
+        if (flop) image_key8_neon(dstrow+x,image_rev8_neon(vld1q_u16(srcrow+w-8-x)));
+        else image_key8_neon(dstrow+x,vld1q_u16(srcrow+x));
+        if (x==w-8) break;
+      }
+    } else if (flop) {
+      image_key4_neon(dstrow,vrev64_u16(vld1_u16(srcrow+w-4)));
+      image_key4_neon(dstrow+w-4,vrev64_u16(vld1_u16(srcrow)));
+    } else {
+      image_key4_neon(dstrow,vld1_u16(srcrow));
+      image_key4_neon(dstrow+w-4,vld1_u16(srcrow+w-4));
+    }
+  }
+}
+
+#endif
+
+/* SIMD level: Pick the best at the first blit, or whatever the user asked for.
+ */
+
+#if PO_NATIVE
+
+static int image_simd_level=-1;
+
+static int image_simd_supported(int level) {
+  switch (level) {
+    case IMAGE_SIMD_NONE: return 1;
+    #if IMAGE_SIMD_X86
+      case IMAGE_SIMD_SSE2: return 1;
+      case IMAGE_SIMD_AVX2: __builtin_cpu_init(); return __builtin_cpu_supports("avx2");
+    #elif IMAGE_SIMD_ARM
+      case IMAGE_SIMD_NEON: return 1;
+    #endif
+  }
+  return 0;
+}
+
+int image_simd_get() {
+  int level=__atomic_load_n(&image_simd_level,__ATOMIC_RELAXED);
+  if (level>=0) return level;
+  level=IMAGE_SIMD_NONE;
+  if (image_simd_supported(IMAGE_SIMD_AVX2)) level=IMAGE_SIMD_AVX2;
+  else if (image_simd_supported(IMAGE_SIMD_SSE2)) level=IMAGE_SIMD_SSE2;
+  else if (image_simd_supported(IMAGE_SIMD_NEON)) level=IMAGE_SIMD_NEON;
+  __atomic_store_n(&image_simd_level,level,__ATOMIC_RELAXED);
+  return level;
+}
+
+int image_simd_set(int level) {
+  if (!image_simd_supported(level)) return -1;
+  __atomic_store_n(&image_simd_level,level,__ATOMIC_RELAXED);
+  return level;
+}
+
+const char *image_simd_name(int level) {
+  switch (level) {
+    case IMAGE_SIMD_NONE: return "scalar";
+    case IMAGE_SIMD_SSE2: return "sse2";
+    case IMAGE_SIMD_AVX2: return "avx2";
+    case IMAGE_SIMD_NEON: return "neon";
+  }
+  return "?";
+}
+
+/* Run a colorkey blit with SIMD if we can.
+ * Returns zero to do it the scalar way instead.
+ */
+
+static uint8_t image_colorkey_simd(
+  uint16_t *dstrow,int dststride,const uint16_t *srcrow,int srcstride,int w,int h,int flop
+) {
+  if (w<4) return 0;
+  switch (image_simd_get()) {
+    #if IMAGE_SIMD_X86
+      case IMAGE_SIMD_SSE2: image_colorkey_sse2(dstrow,dststride,srcrow,srcstride,w,h,flop); return 1;
+      case IMAGE_SIMD_AVX2: image_colorkey_avx2(dstrow,dststride,srcrow,srcstride,w,h,flop); return 1;
+    #elif IMAGE_SIMD_ARM
+      case IMAGE_SIMD_NEON: image_colorkey_neon(dstrow,dststride,srcrow,srcstride,w,h,flop); return 1;
+    #endif
+  }
+  return 0;
+}
+
+#endif
+
+/* Colorkey blit driven by the source's opaque spans.
+ * (srcx,srcy,w,h) already clipped. (dstrow) is the output's top-left corner.
+ * Where SIMD is available, it measures a little faster than this for our tiny sprites (headless --bench=blit),
+ * so spans are the choice for the Tiny, WebAssembly, and anything else without it.
+ */
+
+#if PO_NATIVE
+static uint8_t image_spans_enable=1;
+#define IMAGE_SPANS_ENABLED image_spans_enable
+
+int image_spans_set(int enable) {
+  int pv=image_spans_enable;
+  image_spans_enable=enable?1:0;
+  return pv;
+}
+#else
+#define IMAGE_SPANS_ENABLED 1
+#endif
+
+static void image_colorkey_spans(
+  uint16_t *dstrow,int dststride,
+  const struct image *src,int16_t srcx,int16_t srcy,
+  int16_t w,int16_t h,uint8_t flop
+) {
+  const uint16_t *rowv=src->spans->rowv+srcy;
+  const uint8_t *runv=src->spans->runv;
+  const uint16_t *srcrow=src->v+srcy*src->stride;
+  int16_t srcr=srcx+w;
+  for (;h-->0;dstrow+=dststride,srcrow+=src->stride,rowv++) {
+    const uint8_t *run=runv+(rowv[0]<<1);
+    const uint8_t *end=runv+(rowv[1]<<1);
+    for (;run<end;run+=2) {
+      int16_t a=run[0];
+      if (a>=srcr) break;
+      int16_t b=a+run[1];
+      if (b<=srcx) continue;
+      if (a<srcx) a=srcx;
+      if (b>srcr) b=srcr;
+      if (flop) {
+        uint16_t *dstp=dstrow+srcr-1-a;
+        const uint16_t *srcp=srcrow+a;
+        for (;a<b;a++,dstp--,srcp++) *dstp=*srcp;
+      } else {
+        uint16_t *dstp=dstrow+a-srcx;
+        const uint16_t *srcp=srcrow+a;
+        for (;a<b;a++,dstp++,srcp++) *dstp=*srcp;
+      }
+    }
+  }
+}
+
 /* Blit with colorkey.
  */
  
@@ -42,6 +297,13 @@ void image_blit_colorkey(
   PREBLIT
   uint16_t *dstrow=dst->v+dsty*dst->stride+dstx;
   const uint16_t *srcrow=src->v+srcy*src->stride+srcx;
+  #if PO_NATIVE
+    if (image_colorkey_simd(dstrow,dst->stride,srcrow,src->stride,w,h,0)) return;
+  #endif
+  if (src->spans&&IMAGE_SPANS_ENABLED) {
+    image_colorkey_spans(dstrow,dst->stride,src,srcx,srcy,w,h,0);
+    return;
+  }
   int yi=h;
   for (;yi-->0;dstrow+=dst->stride,srcrow+=src->stride) {
     uint16_t *dstp=dstrow;
@@ -69,9 +331,17 @@ void image_blit_colorkey_flop(
   if (dstx>dst->w-w) { srcx+=dstx+w-dst->w; w=dst->w-dstx; }
   if (dsty>dst->h-h) h=dst->h-dsty;
   if ((w<1)||(h<1)) return;
+  DAMAGE_NOTE(dst,dstx,dsty,w,h)
   
   uint16_t *dstrow=dst->v+dsty*dst->stride+dstx;
   const uint16_t *srcrow=src->v+srcy*src->stride+srcx+w-1;
+  #if PO_NATIVE
+    if (image_colorkey_simd(dstrow,dst->stride,srcrow-w+1,src->stride,w,h,1)) return;
+  #endif
+  if (src->spans&&IMAGE_SPANS_ENABLED) {
+    image_colorkey_spans(dstrow,dst->stride,src,srcx,srcy,w,h,1);
+    return;
+  }
   int yi=h;
   for (;yi-->0;dstrow+=dst->stride,srcrow+=src->stride) {
     uint16_t *dstp=dstrow;
@@ -95,6 +365,7 @@ uint8_t image_blit_glyph(
   uint8_t srcw=(glyph>>27)&7;
   if (!srcw) return 0; // nonzero but zero width denotes a "nothing" glyph (which we don't use)
   dsty+=srcy;
+  DAMAGE_NOTE(dst,dstx,dsty,srcw,8)
   
   uint16_t *dstrow=dst->v+dsty*dst->stride+dstx;
   uint32_t mask=0x04000000;
@@ -147,6 +418,7 @@ void image_fill_rect(struct image *image,int16_t x,int16_t y,int16_t w,int16_t h
   if (x>image->w-w) w=image->w-x;
   if (y>image->h-h) h=image->h-y;
   if ((w<1)||(h<1)) return;
+  DAMAGE_NOTE(image,x,y,w,h)
   uint16_t *dstrow=image->v+y*image->w+x;
   for (;h-->0;dstrow+=image->stride) {
     uint16_t *dstp=dstrow;
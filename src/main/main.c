@@ -3,6 +3,8 @@
 #include "data.h"
 #include "menu.h"
 #include "game.h"
+#include "replay.h"
+#include "damage.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -10,9 +12,9 @@
 /* Globals.
  */
 
-static uint16_t fbstorage[96*64];
-struct image fb={
-  .v=fbstorage,
+// (fb.v) is set by setup(); a thread-local's address isn't a constant.
+static GAME_LOCAL uint16_t fbstorage[96*64];
+GAME_LOCAL struct image fb={
   .w=96,
   .h=64,
   .stride=96,
@@ -21,13 +23,18 @@ struct image fb={
 #define MAINSTATE_INIT 0
 #define MAINSTATE_GAME 1
 #define MAINSTATE_MENU 2
-static uint8_t mainstate=MAINSTATE_INIT;
+static GAME_LOCAL uint8_t mainstate=MAINSTATE_INIT;
+static GAME_LOCAL uint8_t renderstate=MAINSTATE_INIT; // whose update ran last; it draws the next frame
 
-static uint8_t input=0;
-static uint8_t pvinput=0;
-uint32_t framec=0;
+static GAME_LOCAL uint8_t input=0;
+static GAME_LOCAL uint8_t pvinput=0;
+GAME_LOCAL uint32_t framec=0;
 
-struct synth synth={0};
+GAME_LOCAL struct synth synth={0};
+
+#if PO_NATIVE
+GAME_LOCAL struct damage fbdamage;
+#endif
 
 /* Synthesizer.
  */
@@ -35,11 +42,20 @@ struct synth synth={0};
 int16_t audio_next() {
   return synth_update(&synth);
 }
+
+void audio_next_block(int16_t *dst,int framec) {
+  synth_render_block(&synth,dst,framec);
+}
  
-void loop() {
+/* Update, one fixed 1/60 s step.
+ * A state change takes effect for the next update, but the state that just updated still draws the next frame.
+ * So when a round ends, its last frame is still the game's, same as if update and render were one step.
+ */
+ 
+void loop_update() {
   framec++;
 
-  input=platform_update();
+  input=replay_input(platform_update());
   if (input!=pvinput) {
     switch (mainstate) {
       case MAINSTATE_GAME: game_input(input,pvinput); break;
@@ -48,11 +64,11 @@ void loop() {
     pvinput=input;
   }
   
+  renderstate=mainstate;
   switch (mainstate) {
   
     case MAINSTATE_GAME: {
         game_update();
-        game_render();
         if (!gameclock) {
           mainstate=MAINSTATE_MENU;
           game_end();
@@ -62,26 +78,56 @@ void loop() {
       
     case MAINSTATE_MENU: {
         uint8_t outcome=menu_update();
-        menu_render();
         switch (outcome) {
           case MENU_UPDATE_GAME: {
               mainstate=MAINSTATE_GAME;
               menu_end();
-              game_begin();
+              game_begin(replay_seed(millis()));
             } break;
         }
       } break;
-  
-    default: memset(fb.v,0,fb.w*fb.h*2);
+  }
+  replay_frame_end();
+}
+
+/* Render, once per video frame, however many updates happened since the last one.
+ */
+ 
+void loop_render() {
+  #if PO_NATIVE
+    damage_clear(&fbdamage,&fb);
+  #endif
+  switch (renderstate) {
+    case MAINSTATE_GAME: game_render(); break;
+    case MAINSTATE_MENU: menu_render(); break;
+    default: {
+        memset(fb.v,0,fb.w*fb.h*2);
+        #if PO_NATIVE
+          damage_add_all(&fbdamage);
+        #endif
+      }
   }
   
-  platform_send_framebuffer(fb.v);
+  #if PO_NATIVE
+    platform_send_framebuffer_damage(fb.v,fbdamage.v,fbdamage.c);
+  #else
+    platform_send_framebuffer(fb.v);
+  #endif
+}
+
+/* Both, for platforms that do one of each per video frame.
+ */
+ 
+void loop() {
+  loop_update();
+  loop_render();
 }
 
 /* Init.
  */
 
 void setup() {
+  fb.v=fbstorage;
   platform_init();
   
   synth.wavev[0]=wave0;
@@ -4,6 +4,7 @@
 #include "world.h"
 #include "game.h"
 #include "highscore.h"
+#include "damage.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -13,13 +14,14 @@
 /* Globals.
  */
  
-static uint8_t videodirty;
-static uint8_t nextstate;
-static uint8_t blackout;
-static uint8_t menu_initial;
+static GAME_LOCAL uint8_t videodirty;
+static GAME_LOCAL uint8_t nextstate;
+static GAME_LOCAL uint8_t blackout;
+static GAME_LOCAL uint8_t menu_initial;
 
-static uint8_t report[16];
-static const char *validation_message;
+static GAME_LOCAL uint8_t report[16];
+static GAME_LOCAL const char *validation_message;
+static GAME_LOCAL uint32_t last_score;
 
 /* Quit.
  */
@@ -27,6 +29,13 @@ static const char *validation_message;
 void menu_end() {
 }
 
+/* Most recent score.
+ */
+ 
+uint32_t menu_get_last_score() {
+  return last_score;
+}
+
 /* Generate report.
  */
  
@@ -46,6 +55,7 @@ static void generate_report() {
   // The constants 37 and 89 were selected to make all scores <10k, and most realistic scores >1k; i want 4 digits
   uint32_t score=validation?(((elevation*depth*37+hp*89)*activity)/100):0;
   if (score>9999) score=9999; // pretty sure that's unreachable but let's be certain
+  last_score=score;
   
   uint32_t hiscore=highscore_get();
   if (score>hiscore) {
@@ -129,6 +139,9 @@ void menu_render() {
 
   // The framebuffer is persistent. No need to redraw it if nothing changed.
   if (!videodirty) return;
+  #if PO_NATIVE
+    damage_add_all(&fbdamage);
+  #endif
   
   if (menu_initial) {
     memset(fb.v,0,fb.w*fb.h*2);
@@ -6,12 +6,13 @@
 #define MENU_H
 
 #include <stdint.h>
+#include "platform.h"
 
 struct image;
 struct synth;
 
-extern struct image fb;
-extern struct synth synth;
+extern GAME_LOCAL struct image fb;
+extern GAME_LOCAL struct synth synth;
 
 void menu_end();
 
@@ -21,6 +22,9 @@ void menu_input(uint8_t input,uint8_t pvinput);
 uint8_t menu_update();
 void menu_render();
 
+// Score from the most recent round, zero if none finished yet.
+uint32_t menu_get_last_score();
+
 // menu_update() returns one of these:
 #define MENU_UPDATE_CONTINUE 0 /* Stay in the menu. */
 #define MENU_UPDATE_GAME     1 /* Begin the game. */
@@ -10,6 +10,17 @@
 
 #include <stdint.h>
 
+/* GAME_LOCAL marks state belonging to one running game.
+ * Native builds make it thread-local, so a harness can run independent games on separate threads.
+ * Each thread gets a fresh copy of everything; call setup() on each.
+ * On the Tiny and in WebAssembly, it's a plain global.
+ */
+#if PO_NATIVE
+  #define GAME_LOCAL _Thread_local
+#else
+  #define GAME_LOCAL
+#endif
+
 #ifdef __cplusplus
   extern "C" {
 #endif
@@ -18,8 +29,11 @@
  *********************************************************************/
 
 void setup();
-void loop();
+void loop(); // loop_update() then loop_render()
+void loop_update(); // advance the game 1/60 s
+void loop_render(); // draw and send the framebuffer
 int16_t audio_next();
+void audio_next_block(int16_t *dst,int framec); // same as (framec) calls to audio_next(), but cheaper
 
 /* Provided by driver.
  *********************************************************************/
@@ -28,6 +42,15 @@ uint8_t platform_init();
 uint8_t platform_update();
 void platform_send_framebuffer(const void *fb);
 
+#if PO_NATIVE
+/* Native drivers also take a list of the rectangles that changed since the previous frame; see damage.h.
+ * Everything outside them is the same as last time. Empty list means nothing changed at all.
+ * Drivers that can't do partial updates should send the whole framebuffer when (rectc>0).
+ */
+struct damage_rect;
+void platform_send_framebuffer_damage(const void *fb,const struct damage_rect *rectv,int rectc);
+#endif
+
 void usb_send(const void *v,int c);
 int usb_read(void *dst,int dsta);
 int usb_read_byte();
@@ -43,6 +66,21 @@ struct image {
   uint16_t *v;
   int16_t w,h;
   int16_t stride; // in pixels
+  const struct image_spans *spans; // optional, for colorkey sources
+};
+
+/* Where the opaque pixels are, row by row. cvtimg generates these for images with alpha.
+ * Row (y)'s runs are (runv[rowv[y]*2..rowv[y+1]*2]), each (x,w), left to right.
+ * Colorkey blits from an image with spans copy the runs and skip the gaps, without looking at each pixel.
+ * (Unless they have SIMD available, which is faster still).
+ */
+struct image_spans {
+  const uint16_t *rowv;
+  const uint8_t *runv;
+};
+
+struct damage_rect {
+  int16_t x,y,w,h; // pixels
 };
 
 /* We check output bounds but not input -- one presumes you know the input geometry well.
@@ -81,6 +119,24 @@ uint16_t image_blit_string(
 
 void image_fill_rect(struct image *image,int16_t x,int16_t y,int16_t w,int16_t h,uint16_t color);
 
+#if PO_NATIVE
+/* Native colorkey blits use SIMD where the CPU has it, chosen at the first blit.
+ * Override for benchmarking; image_simd_set() returns <0 if this CPU can't do it.
+ */
+#define IMAGE_SIMD_NONE 0
+#define IMAGE_SIMD_SSE2 1
+#define IMAGE_SIMD_AVX2 2
+#define IMAGE_SIMD_NEON 3
+int image_simd_get();
+int image_simd_set(int level);
+const char *image_simd_name(int level);
+
+/* Nonzero (default) to use image_spans for colorkey blits where the source has them and SIMD is off.
+ * Returns the previous setting.
+ */
+int image_spans_set(int enable);
+#endif
+
 #ifdef __cplusplus
   }
 #endif
@@ -0,0 +1,99 @@
+#include "postfx.h"
+#include "damage.h"
+#include <string.h>
+
+/* Channel packing.
+ */
+ 
+#define POSTFX_R_IN(p) (((p)>>8)&0x1f)
+#define POSTFX_G_IN(p) ((((p)&7)<<3)|((p)>>13))
+#define POSTFX_B_IN(p) (((p)>>3)&0x1f)
+
+static inline uint16_t postfx_pack(uint8_t r,uint8_t g,uint8_t b) {
+  return (r<<8)|(g>>3)|((g&7)<<13)|(b<<3);
+}
+
+/* Fade.
+ */
+ 
+void postfx_init_fade(struct postfx *fx,uint8_t level) {
+  memset(fx,0,sizeof(struct postfx));
+  fx->channels=POSTFX_R;
+  uint8_t r=0;
+  for (;r<32;r++) {
+    uint8_t y=(r>level)?(r-level):0;
+    fx->rv[r]=(y<<8)|(y<<3)|(y>>2)|(y<<13);
+  }
+}
+
+/* Tint.
+ */
+ 
+void postfx_init_tint(struct postfx *fx,uint16_t color,uint8_t alpha) {
+  uint16_t tr=POSTFX_R_IN(color)*alpha;
+  uint16_t tg=POSTFX_G_IN(color)*alpha;
+  uint16_t tb=POSTFX_B_IN(color)*alpha;
+  uint8_t keep=0xff-alpha;
+  fx->channels=POSTFX_R|POSTFX_G|POSTFX_B;
+  uint8_t i=0;
+  for (;i<32;i++) {
+    fx->rv[i]=postfx_pack((i*keep+tr)/0xff,0,0);
+    fx->bv[i]=postfx_pack(0,0,(i*keep+tb)/0xff);
+  }
+  for (i=0;i<64;i++) {
+    fx->gv[i]=postfx_pack(0,(i*keep+tg)/0xff,0);
+  }
+}
+
+/* Apply.
+ */
+ 
+void postfx_apply(struct image *image,const struct postfx *fx) {
+  DAMAGE_NOTE(image,0,0,image->w,image->h)
+  uint16_t *row=image->v;
+  int16_t yi=image->h;
+  if (fx->channels==POSTFX_R) {
+    // Single-channel is common (fade), and saves two lookups per pixel.
+    for (;yi-->0;row+=image->stride) {
+      uint16_t *p=row;
+      int16_t xi=image->w;
+      for (;xi-->0;p++) *p=fx->rv[POSTFX_R_IN(*p)];
+    }
+  } else {
+    for (;yi-->0;row+=image->stride) {
+      uint16_t *p=row;
+      int16_t xi=image->w;
+      for (;xi-->0;p++) *p=fx->rv[POSTFX_R_IN(*p)]|fx->gv[POSTFX_G_IN(*p)]|fx->bv[POSTFX_B_IN(*p)];
+    }
+  }
+}
+
+/* Conveniences, with a one-entry cache.
+ */
+ 
+#define POSTFX_MODE_NONE 0
+#define POSTFX_MODE_FADE 1
+#define POSTFX_MODE_TINT 2
+ 
+static GAME_LOCAL struct postfx postfx_cache;
+static GAME_LOCAL uint8_t postfx_cache_mode=POSTFX_MODE_NONE;
+static GAME_LOCAL uint32_t postfx_cache_param=0;
+
+void postfx_fade(struct image *image,uint8_t level) {
+  if ((postfx_cache_mode!=POSTFX_MODE_FADE)||(postfx_cache_param!=level)) {
+    postfx_init_fade(&postfx_cache,level);
+    postfx_cache_mode=POSTFX_MODE_FADE;
+    postfx_cache_param=level;
+  }
+  postfx_apply(image,&postfx_cache);
+}
+
+void postfx_tint(struct image *image,uint16_t color,uint8_t alpha) {
+  uint32_t param=(color<<8)|alpha;
+  if ((postfx_cache_mode!=POSTFX_MODE_TINT)||(postfx_cache_param!=param)) {
+    postfx_init_tint(&postfx_cache,color,alpha);
+    postfx_cache_mode=POSTFX_MODE_TINT;
+    postfx_cache_param=param;
+  }
+  postfx_apply(image,&postfx_cache);
+}
@@ -0,0 +1,44 @@
+/* postfx.h
+ * Whole-image color transforms, for effects that apply after everything else is drawn.
+ *
+ * A transform is three lookup tables, one per input channel, whose entries are already packed into output position.
+ * So each pixel costs three lookups and two ORs, no matter how fancy the effect.
+ * Channels are in our framebuffer's byte-swapped RGB565:
+ *   R: 0x1f00
+ *   G: 0xe007 (high 3 bits in 0x0007, low 3 in 0xe000)
+ *   B: 0x00f8
+ */
+ 
+#ifndef POSTFX_H
+#define POSTFX_H
+
+#include <stdint.h>
+#include "platform.h"
+
+#define POSTFX_R 1
+#define POSTFX_G 2
+#define POSTFX_B 4
+
+struct postfx {
+  uint16_t rv[32];
+  uint16_t gv[64];
+  uint16_t bv[32];
+  uint8_t channels; // POSTFX_*: Inputs that matter. Unused tables must be zero.
+};
+
+/* Build a transform.
+ * fade: Grayscale, from red, darkened by (level) of 31. This is what the end of round uses.
+ * tint: Blend toward (color) by (alpha) of 255. For a flash, tint toward white and let alpha fall off.
+ */
+void postfx_init_fade(struct postfx *fx,uint8_t level);
+void postfx_init_tint(struct postfx *fx,uint16_t color,uint8_t alpha);
+
+void postfx_apply(struct image *image,const struct postfx *fx);
+
+/* Build-and-apply conveniences.
+ * They remember the last transform built, so holding the same effect across frames costs only the apply.
+ */
+void postfx_fade(struct image *image,uint8_t level);
+void postfx_tint(struct image *image,uint16_t color,uint8_t alpha);
+
+#endif
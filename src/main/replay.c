@@ -0,0 +1,328 @@
+#include "replay.h"
+#include "game.h"
+#include "world.h"
+
+#if PO_NATIVE
+#include <stdio.h>
+#include <string.h>
+
+#define REPLAY_MODE_NONE   0
+#define REPLAY_MODE_RECORD 1
+#define REPLAY_MODE_PLAY   2
+
+/* Globals.
+ * Thread-local like the game state it watches, but in practice only one thread will record or play.
+ */
+
+static GAME_LOCAL struct {
+  uint8_t mode;
+  FILE *f;
+  const char *path;
+  uint32_t framep; // current frame, counting from launch
+  uint32_t eventframe; // frame of the last event written, or of the next event to read
+  uint8_t input; // last input recorded or played
+  int hash_interval;
+  uint8_t hash_log;
+  uint8_t finished;
+  int32_t divergence;
+  // Next event, during playback:
+  uint8_t nextop;
+  uint32_t nextarg;
+  uint8_t nextvalid;
+} replay={
+  .hash_interval=60,
+  .divergence=-1,
+};
+
+/* Hash.
+ */
+
+static uint32_t replay_hash_bytes(uint32_t h,const uint8_t *src,int srcc) {
+  for (;srcc-->0;src++) {
+    h^=*src;
+    h*=0x01000193;
+  }
+  return h;
+}
+
+uint32_t replay_hash() {
+  uint32_t h=0x811c9dc5;
+  // Row-major, one run per chunk, so the hash doesn't depend on how the grid is stored.
+  int16_t row=0;
+  for (;row<WORLD_H_TILES;row++) {
+    int16_t col=0;
+    for (;col<WORLD_W_TILES;col+=GRID_CHUNK_W) {
+      int16_t c=WORLD_W_TILES-col;
+      if (c>GRID_CHUNK_W) c=GRID_CHUNK_W;
+      h=replay_hash_bytes(h,grid+GRID_INDEX(col,row),c);
+    }
+  }
+  uint8_t record[SPRITE_RECORD_SIZE];
+  const struct sprite *sprite=spritev;
+  int i=SPRITE_LIMIT;
+  for (;i-->0;sprite++) {
+    sprite_encode(record,sprite);
+    h=replay_hash_bytes(h,record,sizeof(record));
+  }
+  return h;
+}
+
+/* Write event.
+ */
+
+static void replay_write_event(uint8_t opcode,uint32_t arg) {
+  uint32_t delta=replay.framep-replay.eventframe;
+  uint8_t tmp[10];
+  int tmpc=0;
+  // Varint, big-endian.
+  int shift=28;
+  while ((shift>0)&&!(delta>>shift)) shift-=7;
+  for (;shift>0;shift-=7) tmp[tmpc++]=0x80|(delta>>shift);
+  tmp[tmpc++]=delta&0x7f;
+  tmp[tmpc++]=opcode;
+  if ((opcode==REPLAY_OP_SEED)||(opcode==REPLAY_OP_HASH)||(opcode==REPLAY_OP_WORLD)) {
+    tmp[tmpc++]=arg;
+    tmp[tmpc++]=arg>>8;
+    tmp[tmpc++]=arg>>16;
+    tmp[tmpc++]=arg>>24;
+  }
+  if (fwrite(tmp,1,tmpc,replay.f)!=tmpc) {
+    fprintf(stderr,"%s: Write failed. Recording aborted.\n",replay.path);
+    fclose(replay.f);
+    replay.f=0;
+    replay.mode=REPLAY_MODE_NONE;
+    return;
+  }
+  replay.eventframe=replay.framep;
+}
+
+/* Read the next event, during playback.
+ */
+
+static void replay_read_event() {
+  replay.nextvalid=0;
+  uint32_t delta=0;
+  int i=0; for (;;i++) {
+    int ch=fgetc(replay.f);
+    if ((ch<0)||(i>=5)) return;
+    delta=(delta<<7)|(ch&0x7f);
+    if (!(ch&0x80)) break;
+  }
+  int opcode=fgetc(replay.f);
+  if (opcode<0) return;
+  uint32_t arg=0;
+  if ((opcode==REPLAY_OP_SEED)||(opcode==REPLAY_OP_HASH)||(opcode==REPLAY_OP_WORLD)) {
+    uint8_t tmp[4];
+    if (fread(tmp,1,4,replay.f)!=4) return;
+    arg=tmp[0]|(tmp[1]<<8)|(tmp[2]<<16)|(tmp[3]<<24);
+  } else if (opcode>REPLAY_OP_WORLD) {
+    fprintf(stderr,"%s: Unknown opcode 0x%02x.\n",replay.path,opcode);
+    return;
+  }
+  replay.eventframe+=delta;
+  replay.nextop=opcode;
+  replay.nextarg=arg;
+  replay.nextvalid=1;
+}
+
+/* Note a divergence, first time only.
+ */
+
+static void replay_diverge(const char *msg) {
+  if (replay.divergence>=0) return;
+  fprintf(stderr,"%s: Frame %d: %s\n",replay.path,replay.framep,msg);
+  replay.divergence=replay.framep;
+}
+
+/* Begin recording.
+ */
+
+int replay_record(const char *path) {
+  if (replay.mode) return -1;
+  if (!(replay.f=fopen(path,"wb"))) {
+    fprintf(stderr,"%s: Failed to open for writing.\n",path);
+    return -1;
+  }
+  if (fwrite("IVRP\x02",1,5,replay.f)!=5) {
+    fprintf(stderr,"%s: Write failed.\n",path);
+    fclose(replay.f);
+    replay.f=0;
+    return -1;
+  }
+  replay.path=path;
+  replay.mode=REPLAY_MODE_RECORD;
+  fprintf(stderr,"%s: Recording.\n",path);
+  return 0;
+}
+
+/* Begin playback.
+ */
+
+int replay_play(const char *path) {
+  if (replay.mode) return -1;
+  if (!(replay.f=fopen(path,"rb"))) {
+    fprintf(stderr,"%s: Failed to open for reading.\n",path);
+    return -1;
+  }
+  char hdr[5];
+  if ((fread(hdr,1,5,replay.f)!=5)||memcmp(hdr,"IVRP\x02",5)) {
+    fprintf(stderr,"%s: Not a replay file, or unsupported version.\n",path);
+    fclose(replay.f);
+    replay.f=0;
+    return -1;
+  }
+  replay.path=path;
+  replay.mode=REPLAY_MODE_PLAY;
+  replay_read_event();
+  fprintf(stderr,"%s: Playing.\n",path);
+  return 0;
+}
+
+/* Trivial accessors.
+ */
+
+void replay_set_hash_interval(int framec) {
+  replay.hash_interval=framec;
+}
+
+void replay_set_hash_log(uint8_t enable) {
+  replay.hash_log=enable;
+}
+
+uint8_t replay_finished() {
+  return replay.finished;
+}
+
+int32_t replay_divergence() {
+  return replay.divergence;
+}
+
+/* Finish.
+ */
+
+void replay_end() {
+  if (!replay.f) return;
+  if (replay.mode==REPLAY_MODE_RECORD) {
+    replay_write_event(REPLAY_OP_END,0);
+    if (replay.f) fprintf(stderr,"%s: Recorded %d frames, %d bytes.\n",replay.path,replay.framep,(int)ftell(replay.f));
+  } else if (replay.mode==REPLAY_MODE_PLAY) {
+    if (replay.divergence>=0) {
+      fprintf(stderr,"%s: Playback diverged at frame %d.\n",replay.path,replay.divergence);
+    } else if (replay.finished) {
+      fprintf(stderr,"%s: Played %d frames, no divergence.\n",replay.path,replay.framep);
+    }
+  }
+  if (replay.f) fclose(replay.f);
+  replay.f=0;
+  replay.mode=REPLAY_MODE_NONE;
+}
+
+/* Seed.
+ */
+
+uint32_t replay_seed(uint32_t seed) {
+  switch (replay.mode) {
+    case REPLAY_MODE_RECORD: {
+        if ((WORLD_W_TILES!=WORLD_W_TILES_DEFAULT)||(WORLD_H_TILES!=WORLD_H_TILES_DEFAULT)) {
+          replay_write_event(REPLAY_OP_WORLD,(uint16_t)WORLD_W_TILES|((uint32_t)(uint16_t)WORLD_H_TILES<<16));
+        }
+        replay_write_event(REPLAY_OP_SEED,seed);
+      } break;
+    case REPLAY_MODE_PLAY: {
+        if (replay.nextvalid&&(replay.eventframe==replay.framep)&&(replay.nextop==REPLAY_OP_WORLD)) {
+          world_set_size(replay.nextarg&0xffff,replay.nextarg>>16);
+          replay_read_event();
+        } else {
+          world_set_size(WORLD_W_TILES_DEFAULT,WORLD_H_TILES_DEFAULT);
+        }
+        if (replay.nextvalid&&(replay.eventframe==replay.framep)&&(replay.nextop==REPLAY_OP_SEED)) {
+          seed=replay.nextarg;
+          replay_read_event();
+        } else {
+          replay_diverge("Round began, but the recording has no seed here.");
+        }
+      } break;
+  }
+  return seed;
+}
+
+/* Input.
+ */
+
+uint8_t replay_input(uint8_t input) {
+  switch (replay.mode) {
+    case REPLAY_MODE_RECORD: {
+        if (input!=replay.input) {
+          replay_write_event(input,0);
+          replay.input=input;
+        }
+      } break;
+    case REPLAY_MODE_PLAY: {
+        if (replay.nextvalid&&(replay.eventframe==replay.framep)&&(replay.nextop<REPLAY_OP_SEED)) {
+          replay.input=replay.nextop;
+          replay_read_event();
+        }
+        return replay.input;
+      }
+  }
+  return input;
+}
+
+/* End of frame.
+ */
+
+void replay_frame_end() {
+  uint32_t hash=0;
+  uint8_t hashed=0;
+  if (replay.hash_log) {
+    hash=replay_hash();
+    hashed=1;
+    fprintf(stderr,"HASH %d %08x\n",replay.framep,hash);
+  }
+  switch (replay.mode) {
+    case REPLAY_MODE_RECORD: {
+        if ((replay.hash_interval>0)&&!(replay.framep%replay.hash_interval)) {
+          if (!hashed) hash=replay_hash();
+          replay_write_event(REPLAY_OP_HASH,hash);
+        }
+      } break;
+    case REPLAY_MODE_PLAY: {
+        if (replay.nextvalid&&(replay.eventframe==replay.framep)&&(replay.nextop==REPLAY_OP_HASH)) {
+          if (!hashed) hash=replay_hash();
+          if (hash!=replay.nextarg) {
+            char msg[64];
+            snprintf(msg,sizeof(msg),"Hash mismatch, expected %08x, got %08x.",replay.nextarg,hash);
+            replay_diverge(msg);
+          }
+          replay_read_event();
+        }
+        // Anything else left over for this frame means the game didn't do what it did during recording.
+        while (replay.nextvalid&&(replay.eventframe<=replay.framep)&&(replay.nextop!=REPLAY_OP_END)) {
+          replay_diverge("Unconsumed event.");
+          replay_read_event();
+        }
+      } break;
+  }
+  replay.framep++;
+  if (replay.mode==REPLAY_MODE_PLAY) {
+    if (!replay.nextvalid||((replay.nextop==REPLAY_OP_END)&&(replay.eventframe<=replay.framep))) {
+      replay.finished=1;
+    }
+  }
+}
+
+#else /* !PO_NATIVE: Everything is a noop. */
+
+int replay_record(const char *path) { return -1; }
+int replay_play(const char *path) { return -1; }
+void replay_set_hash_interval(int framec) {}
+void replay_set_hash_log(uint8_t enable) {}
+void replay_end() {}
+uint8_t replay_finished() { return 0; }
+int32_t replay_divergence() { return -1; }
+uint32_t replay_seed(uint32_t seed) { return seed; }
+uint8_t replay_input(uint8_t input) { return input; }
+void replay_frame_end() {}
+uint32_t replay_hash() { return 0; }
+
+#endif
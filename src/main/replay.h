@@ -0,0 +1,75 @@
+/* replay.h
+ * Record a session's input to a small file, and play it back bit-exactly.
+ * The game's only nondeterministic inputs are the buttons and the seed chosen in game_begin(),
+ * so that's all we need to store. Plus a hash of the world now and then, to detect divergence.
+ *
+ * Native builds only. Elsewhere everything is a passthrough no-op.
+ *
+ * File format:
+ *   4 "IVRP"
+ *   1 Version (2). Version 1 predates game_rand() and no longer plays back.
+ *   ... Events:
+ *     VARINT Frames since the previous event (or since launch).
+ *     1      Opcode:
+ *              0x00..0x3f: Input state changed to this.
+ *              0x40: Seed. Followed by u32 little-endian.
+ *              0x41: End of recording.
+ *              0x42: Hash of world state at the end of this frame. Followed by u32 little-endian.
+ *              0x43: World size, if not the default. Just before the round's Seed.
+ *                    Followed by u16 width then u16 height in tiles, little-endian.
+ * VARINT are big-endian, 7 bits per byte, high bit set on all but the last byte.
+ * Frames count from the first loop() after launch, across rounds and menus.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+#define REPLAY_OP_SEED 0x40
+#define REPLAY_OP_END  0x41
+#define REPLAY_OP_HASH 0x42
+#define REPLAY_OP_WORLD 0x43
+
+/* Platform calls one of these before setup(), at most once.
+ */
+int replay_record(const char *path);
+int replay_play(const char *path);
+
+/* When recording, store a hash every so many frames. Default 60, zero for never, 1 for every frame.
+ * Playback checks whatever hashes the file contains.
+ */
+void replay_set_hash_interval(int framec);
+
+/* Nonzero to log every frame's hash to stderr, whether recording, playing, or neither.
+ * Diff two logs to find the exact frame where they went apart.
+ */
+void replay_set_hash_log(uint8_t enable);
+
+/* Platform calls at exit, to flush and close the file.
+ */
+void replay_end();
+
+/* 1 if playback has reached the end of the file.
+ * Platforms should stop when they see this.
+ */
+uint8_t replay_finished();
+
+/* Frame where playback first diverged from the recording, or <0 if all is well.
+ */
+int32_t replay_divergence();
+
+/* Hooks for main.c.
+ * replay_seed() at the start of each round, returns the seed to use.
+ * replay_input() every frame, returns the input state to use.
+ * replay_frame_end() after each frame's update.
+ */
+uint32_t replay_seed(uint32_t seed);
+uint8_t replay_input(uint8_t input);
+void replay_frame_end();
+
+/* FNV-1a of grid and spritev.
+ */
+uint32_t replay_hash();
+
+#endif
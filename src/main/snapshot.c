@@ -0,0 +1,293 @@
+#include "snapshot.h"
+#include "game.h"
+#include <string.h>
+#include <stddef.h>
+
+/* Snapshot.
+ */
+
+void game_snapshot(struct game_snapshot *dst) {
+  dst->world_w=WORLD_W_TILES;
+  dst->world_h=WORLD_H_TILES;
+  memcpy(dst->grid,grid,GRID_SIZE);
+  memcpy(dst->spritev,spritev,sizeof(spritev));
+  memcpy(&dst->spritepools,&spritepools,sizeof(spritepools));
+  dst->camera=camera;
+  dst->framec=framec;
+  dst->gameclock=gameclock;
+  dst->activity_framec=activity_framec;
+  dst->prng=game_rand_state();
+  dst->hp=hp;
+  memset(dst->tasks,0,sizeof(dst->tasks));
+  timed_tasks_get_state(dst->tasks);
+}
+
+/* Restore.
+ */
+
+void game_restore(const struct game_snapshot *src) {
+  world_set_size(src->world_w,src->world_h);
+  memcpy(grid,src->grid,GRID_SIZE);
+  memcpy(spritev,src->spritev,sizeof(spritev));
+  memcpy(&spritepools,&src->spritepools,sizeof(spritepools));
+  camera=src->camera;
+  framec=src->framec;
+  gameclock=src->gameclock;
+  activity_framec=src->activity_framec;
+  game_srand(src->prng);
+  hp=src->hp;
+  timed_tasks_set_state(src->tasks);
+
+  // Derived state.
+  grid_reindex();
+  sprite_reindex();
+  thumbnail_draw();
+}
+
+/* Size.
+ */
+ 
+int game_snapshot_size(const struct game_snapshot *snapshot) {
+  return offsetof(struct game_snapshot,grid)+GRID_CHUNKS_W(snapshot->world_w)*GRID_CHUNKS_H(snapshot->world_h)*GRID_CHUNK_SIZE;
+}
+
+/* Rewind ring, native only.
+ *********************************************************************/
+
+#if PO_NATIVE
+#include <stdlib.h>
+
+#define REWIND_DEFAULT_FRAMEC 600
+#define REWIND_DEFAULT_BYTEC (256<<10)
+
+/* Each delta is the XOR of two consecutive snapshots, with zero runs squeezed out:
+ *   VARINT Zeroes to skip.
+ *   VARINT Literal length.
+ *   ...    Literal bytes.
+ * Repeat until the end of the snapshot.
+ * VARINT are little-endian, 7 bits per byte, high bit set on all but the last.
+ */
+
+struct rewind_entry {
+  int p,c; // position in (buf)
+};
+
+static GAME_LOCAL struct rewind {
+  struct game_snapshot head; // most recent state pushed
+  int count; // states available, including (head)
+  uint8_t *buf;
+  int bufa;
+  int tail; // where the next delta goes
+  struct rewind_entry *entryv; // ring, deltas to walk back from (head)
+  int entrya,entryp,entryc; // (entryp) is the oldest
+  uint8_t enc[sizeof(struct game_snapshot)*2];
+} *ring=0;
+
+/* Init, quit, clear.
+ */
+
+int rewind_init(int framec,int bytec) {
+  if (ring) rewind_quit();
+  if (framec<1) framec=REWIND_DEFAULT_FRAMEC;
+  if (bytec<1) bytec=REWIND_DEFAULT_BYTEC;
+  if (!(ring=calloc(1,sizeof(struct rewind)))) return -1;
+  ring->entrya=framec;
+  ring->bufa=bytec;
+  if (
+    !(ring->entryv=malloc(sizeof(struct rewind_entry)*ring->entrya))||
+    !(ring->buf=malloc(ring->bufa))
+  ) {
+    rewind_quit();
+    return -1;
+  }
+  return 0;
+}
+
+void rewind_quit() {
+  if (!ring) return;
+  if (ring->entryv) free(ring->entryv);
+  if (ring->buf) free(ring->buf);
+  free(ring);
+  ring=0;
+}
+
+void rewind_clear() {
+  if (!ring) return;
+  ring->count=0;
+  ring->tail=0;
+  ring->entryp=0;
+  ring->entryc=0;
+}
+
+/* Trivial accessors.
+ */
+
+int rewind_count() {
+  if (!ring) return 0;
+  return ring->count;
+}
+
+int rewind_bytes() {
+  if (!ring) return 0;
+  int bytec=0,i=ring->entryc,p=ring->entryp;
+  for (;i-->0;p++) {
+    if (p>=ring->entrya) p=0;
+    bytec+=ring->entryv[p].c;
+  }
+  return bytec;
+}
+
+/* Encode delta (a^b) into ring->enc, return length.
+ */
+
+static int rewind_varint(uint8_t *dst,uint32_t v) {
+  int dstc=0;
+  while (v>=0x80) {
+    dst[dstc++]=0x80|(v&0x7f);
+    v>>=7;
+  }
+  dst[dstc++]=v;
+  return dstc;
+}
+
+static int rewind_encode(const uint8_t *a,const uint8_t *b,int c) {
+  uint8_t *dst=ring->enc;
+  int dstc=0,p=0;
+  while (p<c) {
+    // Zero run. Skip equal words quickly first, the usual case.
+    int zp=p;
+    while ((p<=c-8)&&!memcmp(a+p,b+p,8)) p+=8;
+    while ((p<c)&&(a[p]==b[p])) p++;
+    if (p>=c) break; // trailing zeroes are implicit
+    // Literal run, ends at the first pair of matching bytes.
+    int lp=p;
+    while ((p<c)&&((a[p]!=b[p])||((p<c-1)&&(a[p+1]!=b[p+1])))) p++;
+    dstc+=rewind_varint(dst+dstc,lp-zp);
+    dstc+=rewind_varint(dst+dstc,p-lp);
+    for (;lp<p;lp++) dst[dstc++]=a[lp]^b[lp];
+  }
+  return dstc;
+}
+
+/* Apply delta to (dst).
+ */
+
+static uint32_t rewind_read_varint(const uint8_t *src,int *srcp) {
+  uint32_t v=0;
+  int shift=0;
+  for (;;shift+=7) {
+    uint8_t b=src[(*srcp)++];
+    v|=(b&0x7f)<<shift;
+    if (!(b&0x80)) return v;
+  }
+}
+
+static void rewind_decode(uint8_t *dst,int dstc,const uint8_t *src,int srcc) {
+  int srcp=0,dstp=0;
+  while (srcp<srcc) {
+    dstp+=rewind_read_varint(src,&srcp);
+    int litc=rewind_read_varint(src,&srcp);
+    if ((dstp>dstc-litc)||(srcp>srcc-litc)) return;
+    for (;litc-->0;dstp++,srcp++) dst[dstp]^=src[srcp];
+  }
+}
+
+/* Drop the oldest delta.
+ */
+
+static void rewind_drop_oldest() {
+  if (!ring->entryc) return;
+  ring->entryp++;
+  if (ring->entryp>=ring->entrya) ring->entryp=0;
+  ring->entryc--;
+  ring->count--;
+}
+
+/* Push.
+ */
+
+int rewind_push() {
+  if (!ring) return -1;
+  struct game_snapshot snapshot;
+  int size=offsetof(struct game_snapshot,grid)+GRID_SIZE;
+  memset(&snapshot,0,size); // padding too, so it doesn't show up in deltas
+  game_snapshot(&snapshot);
+
+  // First one is easy, there's nothing to compare against.
+  // Same if the world changed size; deltas only make sense between equal sizes.
+  if (!ring->count||(game_snapshot_size(&ring->head)!=size)) {
+    rewind_clear();
+    memcpy(&ring->head,&snapshot,size);
+    ring->count=1;
+    return 0;
+  }
+
+  int c=rewind_encode((uint8_t*)&snapshot,(uint8_t*)&ring->head,size);
+
+  // Pathological: Delta is larger than our buffer. Start over from here.
+  if (c>ring->bufa) {
+    rewind_clear();
+    memcpy(&ring->head,&snapshot,size);
+    ring->count=1;
+    return 0;
+  }
+
+  // Find space in the buffer, dropping old entries as needed.
+  if (ring->entryc>=ring->entrya-1) rewind_drop_oldest();
+  while (ring->entryc) {
+    int oldp=ring->entryv[ring->entryp].p;
+    if (oldp>=ring->tail) { // wrapped: free space is (tail..oldp)
+      if (ring->tail+c<=oldp) break;
+    } else { // contiguous: free space is (tail..bufa) and (0..oldp)
+      if (ring->tail+c<=ring->bufa) break;
+      if (c<=oldp) {
+        ring->tail=0;
+        break;
+      }
+    }
+    rewind_drop_oldest();
+  }
+  if (!ring->entryc) ring->tail=0;
+
+  int entryi=ring->entryp+ring->entryc;
+  if (entryi>=ring->entrya) entryi-=ring->entrya;
+  struct rewind_entry *entry=ring->entryv+entryi;
+  entry->p=ring->tail;
+  entry->c=c;
+  memcpy(ring->buf+entry->p,ring->enc,c);
+  ring->tail+=c;
+  ring->entryc++;
+  ring->count++;
+  memcpy(&ring->head,&snapshot,size);
+  return 0;
+}
+
+/* Pop.
+ */
+
+int rewind_pop() {
+  if (!ring||!ring->count) return -1;
+  game_restore(&ring->head);
+  if (ring->entryc) {
+    int entryi=ring->entryp+ring->entryc-1;
+    if (entryi>=ring->entrya) entryi-=ring->entrya;
+    const struct rewind_entry *entry=ring->entryv+entryi;
+    rewind_decode((uint8_t*)&ring->head,game_snapshot_size(&ring->head),ring->buf+entry->p,entry->c);
+    ring->tail=entry->p;
+    ring->entryc--;
+  }
+  ring->count--;
+  return 0;
+}
+
+#else /* !PO_NATIVE */
+
+int rewind_init(int framec,int bytec) { return -1; }
+void rewind_quit() {}
+void rewind_clear() {}
+int rewind_push() { return -1; }
+int rewind_pop() { return -1; }
+int rewind_count() { return 0; }
+int rewind_bytes() { return 0; }
+
+#endif
@@ -0,0 +1,51 @@
+/* snapshot.h
+ * Copy the whole game state out and back in.
+ * Everything that affects the future of a round is here; derived things (thumbnail, framebuffer) are rebuilt on restore.
+ * Menu and synth are not included: Only take and restore snapshots during play.
+ *
+ * The rewind ring keeps a history of snapshots, delta-encoded against each other.
+ * It is only available on native builds.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "world.h"
+#include "timed_tasks.h"
+
+/* (grid) goes last, and only its first GRID_SIZE bytes, at the snapshot's size, are meaningful.
+ * game_snapshot_size() is the length worth copying or comparing.
+ */
+struct game_snapshot {
+  int16_t world_w,world_h;
+  struct sprite spritev[SPRITE_LIMIT];
+  struct sprite_pools spritepools;
+  struct camera camera;
+  uint32_t framec;
+  uint32_t gameclock;
+  uint32_t activity_framec;
+  uint32_t prng;
+  uint8_t hp;
+  uint8_t tasks[TIMED_TASKS_STATE_SIZE];
+  uint8_t grid[GRID_SIZE_LIMIT]; // chunks, as in the live grid
+};
+
+void game_snapshot(struct game_snapshot *dst);
+int game_snapshot_size(const struct game_snapshot *snapshot);
+void game_restore(const struct game_snapshot *src);
+
+/* Rewind ring.
+ * Each push records the current state. Each pop restores the most recent state pushed and discards it.
+ * When full, the oldest entries are quietly dropped.
+ * (framec) is how many entries to keep, (bytec) the size of the delta buffer. Zero for defaults (600 frames, 256 kB).
+ */
+int rewind_init(int framec,int bytec);
+void rewind_quit();
+void rewind_clear();
+int rewind_push();
+int rewind_pop(); // <0 if empty
+int rewind_count();
+int rewind_bytes(); // total delta bytes currently stored
+
+#endif
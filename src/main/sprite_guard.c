@@ -16,24 +16,7 @@
 #define RULES_CLOCK_TIME 60
 #define RELOAD_TIME_FRAMES 60
 
-/* Object definition.
- */
- 
-struct sprite_guard {
-  SPRITE_HEADER
-  int8_t facedir;
-  uint8_t grounded; // 0|1, updated from scratch early in the cycle
-  int8_t motion; // (-1,0,1) which way are we moving (NB not related to facedir)
-  uint8_t jump_power; // counts down; nonzero midjump
-  uint8_t climbing;
-  uint8_t animclock;
-  uint8_t animframe;
-  uint8_t rulesclock;
-  uint8_t violation; // TATTLE_{NONE,STATUE,TRUCK,BARREL}
-  uint8_t reload; // counts down after firing gun
-};
-
-#define SPRITE ((struct sprite_guard*)sprite)
+#define SPRITE SPRITE_STATE(guard,sprite)
 
 /* Check the grid in case some asshole dropped a load of dirt on me.
  */
@@ -86,7 +69,7 @@ static void guard_update_oversight(struct sprite *sprite) {
   if (!hero) return;
   
   // If more than half the world width, or less than negative half, we need to wrap it.
-  int16_t dist=hero->x-sprite->x;
+  coord_t dist=hero->x-sprite->x;
   if (dist>WORLD_W_MM>>1) dist-=WORLD_W_MM;
   else if (dist<-(WORLD_W_MM>>1)) dist+=WORLD_W_MM;
   
@@ -113,7 +96,7 @@ static void guard_update_motion(struct sprite *sprite) {
   if (!SPRITE->motion) return;
   
   // If we're able to move, abort climbing and get on with our lives.
-  int16_t dx=sprite_move_horz(sprite,WALK_SPEED*SPRITE->motion);
+  coord_t dx=sprite_move_horz(sprite,WALK_SPEED*SPRITE->motion);
   if (dx) {
     SPRITE->climbing=0;
     return;
@@ -132,8 +115,8 @@ static void guard_update_motion(struct sprite *sprite) {
   if ((col<0)||(col>=WORLD_W_TILES)) return;
   int16_t row=(sprite->y+sprite->h)/TILE_W_MM-1;
   if ((row<0)||(row>=WORLD_H_TILES)) return;
-  uint8_t lotile=grid[WORLD_W_TILES*row+col];
-  uint8_t hitile=row?grid[WORLD_W_TILES*(row-1)+col]:0;
+  uint8_t lotile=GRID_TILE(col,row);
+  uint8_t hitile=row?GRID_TILE(col,row-1):0;
   
   // If the upper tile is vacant, we can jump.
   if (hitile<0x10) {
@@ -149,51 +132,6 @@ static void guard_update_motion(struct sprite *sprite) {
   SPRITE->animframe=0;
 }
 
-/* Check world for specific violations.
- */
- 
-// Truck must be unloaded if anything is there. 0x33,0x34,0x35.
-// This is in a fixed position. The bed is cells (12,14),(13,14),(14,14)
-uint8_t violation_truck() {
-  const uint8_t *p=grid+WORLD_W_TILES*14+12;
-  uint8_t i=3;
-  for (;i-->0;p++) {
-    if (*p>=0x10) return 1;
-  }
-  return 0;
-}
-
-// The statue (0x12) must be the tallest non-vacant thing, even a tie is a violation.
-// If no statue found, the player must be carrying it. That's a violation too.
-uint8_t violation_statue() {
-  const uint8_t *p=grid;
-  uint8_t y=WORLD_H_TILES;
-  for (;y-->0;) {
-    uint8_t x=WORLD_W_TILES,statue=0;
-    for (;x-->0;p++) {
-      if (*p==0x12) statue=1;
-      else if (*p>=0x10) return 1;
-    }
-    if (statue) return 0;
-  }
-  return 1; // no statue and also nothing else...
-}
-
-// If a barrel (0x11) exists, it must have dirt (0x20..0x2f) on all 8 sides.
-uint8_t violation_barrel() {
-  const uint8_t *p=grid;
-  uint8_t y=0;
-  for (;y<WORLD_H_TILES;y++) {
-    uint8_t x=0;
-    for (;x<WORLD_W_TILES;x++,p++) {
-      if (*p==0x11) {
-        if (!grid_cell_buried(x,y)) return 1;
-      }
-    }
-  }
-  return 0;
-}
-
 /* Update rules.
  * If there is a violation in progress, just confirm that it is still in violation.
  * Otherwise tick the rules clock and each reset, look for new violations.
@@ -244,32 +182,31 @@ static void guard_update_gun(struct sprite *sprite) {
   if (!hero) return;
   
   // We'll call "line of sight" as "my middle within his vertical bounds"
-  int16_t midy=sprite->y+(sprite->h>>1);
+  coord_t midy=sprite->y+(sprite->h>>1);
   if (midy<hero->y) return;
   if (midy>=hero->y+hero->h) return;
   
   // Sanity check on the total distance. No sense firing if we're on the other side of the world.
-  int16_t dx=sprite->x-hero->x;
+  coord_t dx=sprite->x-hero->x;
   if (dx<0) dx=-dx;
   if (dx>WORLD_W_MM>>1) dx=WORLD_W_MM-dx;
   if (dx>SHOOT_RANGE_MM) return;
   
-  struct sprite *bullet=sprite_new();
+  struct sprite *bullet=sprite_new(SPRITE_CONTROLLER_BULLET);
   if (!bullet) return;
-  bullet->controller=SPRITE_CONTROLLER_BULLET;
   bullet->w=2*MM_PER_PIXEL;
   bullet->h=2*MM_PER_PIXEL;
   bullet->y=sprite->y+5*MM_PER_PIXEL;
   if (SPRITE->facedir<0) {
     bullet->x=sprite->x-bullet->w;
-    bullet->opaque[0]=0xff;
+    SPRITE_STATE(bullet,bullet)->dx=-1;
   } else {
     bullet->x=sprite->x+sprite->w;
-    bullet->opaque[0]=0x01;
+    SPRITE_STATE(bullet,bullet)->dx=1;
   }
   
   SPRITE->reload=RELOAD_TIME_FRAMES;
-  //TODO sound effect
+  game_sfx(SFX_GUNSHOT,sprite);
 }
 
 /* Update.
@@ -286,18 +223,12 @@ void sprite_update_guard(struct sprite *sprite) {
 /* Render.
  */
 
-void sprite_render_guard(struct sprite *sprite) {
-  int16_t x,y;
-  sprite_get_render_position(&x,&y,sprite);
-  
-  // Head: Doesn't change much.
-  if (SPRITE->facedir<0) {
-    image_blit_colorkey_flop(&fb,x-2,y,&fgbits,10,0,7,5);
-  } else {
-    image_blit_colorkey(&fb,x,y,&fgbits,10,0,7,5);
-  }
-  
-  // If climbing, the whole body is one image and it animates.
+/* Animate.
+ */
+ 
+void sprite_animate_guard(struct sprite *sprite) {
+
+  // Climbing, 3 frames.
   if (SPRITE->climbing) {
     if (SPRITE->animclock>0) {
       SPRITE->animclock--;
@@ -306,16 +237,10 @@ void sprite_render_guard(struct sprite *sprite) {
       SPRITE->animframe++;
       if (SPRITE->animframe>=3) SPRITE->animframe=0;
     }
-    if (SPRITE->facedir<0) {
-      image_blit_colorkey_flop(&fb,x,y+4,&fgbits,28+SPRITE->animframe*5,5,5,8);
-    } else {
-      image_blit_colorkey(&fb,x,y+4,&fgbits,28+SPRITE->animframe*5,5,5,8);
-    }
     return;
   }
   
-  // Legs work about the same whether Idle, Walk, or Violation.
-  uint8_t legframe=0;
+  // Walking, 4 frames.
   if (SPRITE->motion) {
     if (SPRITE->animclock>0) {
       SPRITE->animclock--;
@@ -324,29 +249,37 @@ void sprite_render_guard(struct sprite *sprite) {
       SPRITE->animframe++;
       if (SPRITE->animframe>=4) SPRITE->animframe=0;
     }
-    legframe=SPRITE->animframe;
   } else {
     SPRITE->animclock=0;
     SPRITE->animframe=0;
   }
-  if (SPRITE->facedir<0) {
-    image_blit_colorkey_flop(&fb,x-1,y+8,&fgbits,legframe*7,9,7,3);
-  } else {
-    image_blit_colorkey(&fb,x-1,y+8,&fgbits,legframe*7,9,7,3);
+}
+
+/* Render.
+ */
+
+void sprite_render_guard(struct sprite *sprite) {
+  int16_t x,y;
+  sprite_get_render_position(&x,&y,sprite);
+  
+  // Head: Doesn't change much.
+  spr_guard_head(&fb,(SPRITE->facedir<0)?(x-2):x,y,0,SPRITE->facedir<0);
+  
+  // If climbing, the whole body is one image and it animates.
+  if (SPRITE->climbing) {
+    spr_guard_climb(&fb,x,y+4,SPRITE->animframe,SPRITE->facedir<0);
+    return;
   }
   
+  // Legs work about the same whether Idle, Walk, or Violation.
+  uint8_t legframe=0;
+  if (SPRITE->motion) legframe=SPRITE->animframe;
+  spr_legs(&fb,x-1,y+8,legframe,SPRITE->facedir<0);
+  
   // Violation torso is a single frame. Otherwise it animates with the legs.
   if (SPRITE->violation) {
-    if (SPRITE->facedir<0) {
-      image_blit_colorkey_flop(&fb,x-3,y+4,&fgbits,43,5,8,5);
-    } else {
-      image_blit_colorkey(&fb,x,y+4,&fgbits,43,5,8,5);
-    }
+    spr_guard_violation(&fb,(SPRITE->facedir<0)?(x-3):x,y+4,0,SPRITE->facedir<0);
   } else {
-    if (SPRITE->facedir<0) {
-      image_blit_colorkey_flop(&fb,x-2,y+4,&fgbits,22+legframe*9,0,9,5);
-    } else {
-      image_blit_colorkey(&fb,x-2,y+4,&fgbits,22+legframe*9,0,9,5);
-    }
+    spr_torso(&fb,x-2,y+4,legframe,SPRITE->facedir<0);
   }
 }
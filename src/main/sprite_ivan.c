@@ -16,35 +16,16 @@
 #define CARRYING_STATUE 4
 #define CARRYING_BARREL 5
 
-/* Object definition.
- */
- 
-struct sprite_ivan {
-  SPRITE_HEADER
-  int8_t facedir; // -1,1 = left,right
-  int8_t dx; // (-1,0,1) while button held
-  int8_t dy; // ''
-  int8_t dyimpulse; // (-1,0,1), nonzero for one frame at a time
-  uint8_t injump; // 1 while held
-  uint8_t inaux; // 1 momentarily at press
-  uint8_t animclock;
-  uint8_t animframe;
-  uint8_t jumppower;
-  uint8_t carrying; // either the shovel or a block over my head, or nothing
-  uint8_t injury_highlight;
-  uint16_t idleframec;
-  uint8_t fairy_triggered;
-};
-
-#define SPRITE ((struct sprite_ivan*)sprite)
+#define SPRITE SPRITE_STATE(ivan,sprite)
 
 /* Get the hero sprite.
  */
 
 struct sprite *game_get_hero() {
-  struct sprite *sprite=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;sprite++) if (sprite->controller==SPRITE_CONTROLLER_IVAN) return sprite;
+  struct sprite *sprite;
+  for (sprite=sprite_next(0);sprite;sprite=sprite_next(sprite)) {
+    if (sprite->controller==SPRITE_CONTROLLER_IVAN) return sprite;
+  }
   return 0;
 }
 
@@ -89,8 +70,8 @@ static void ivan_update_walk(struct sprite *sprite) {
     activity_framec++;
     sprite_move_horz(sprite,SPRITE->dx*WALK_SPEED);
   } else { // Cheat to the nearest tile (aligning horizontal centers)
-    int16_t refx=sprite->x+(sprite->w>>1)-(TILE_W_MM>>1);
-    int16_t slop=refx%TILE_W_MM;
+    coord_t refx=sprite->x+(sprite->w>>1)-(TILE_W_MM>>1);
+    coord_t slop=refx%TILE_W_MM;
     if (slop) {
       activity_framec++;
       // We could check like if (slop) is very high or very low, cheat that way regardless of motion.
@@ -141,17 +122,15 @@ static void ivan_check_tattle(struct sprite *sprite) {
   // No tattles from us if we're carrying something.
   if (SPRITE->carrying) return;
   
-  int16_t midx=sprite->x+(sprite->w>>1);
-  int16_t midy=sprite->y+(sprite->h>>1);
-  
-  struct sprite *other=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;other++) {
-    if (!other->controller) continue;
-    if (midx<other->x) continue;
-    if (midy<other->y) continue;
-    if (midx>=other->x+other->w) continue;
-    if (midy>=other->y+other->h) continue;
+  coord_t midx=sprite->x+(sprite->w>>1);
+  coord_t midy=sprite->y+(sprite->h>>1);
+  
+  struct sprite *otherv[8];
+  uint16_t otherc=sprite_find(otherv,8,midx,midy,1,1);
+  if (otherc>8) otherc=8;
+  uint16_t i=0;
+  for (;i<otherc;i++) {
+    struct sprite *other=otherv[i];
     switch (other->controller) {
       case SPRITE_CONTROLLER_SHOVEL: {
           set_tattle(other->x+(other->w>>1),other->y,TATTLE_SHOVEL);
@@ -165,7 +144,7 @@ static void ivan_check_tattle(struct sprite *sprite) {
     if ((col>=0)&&(col<WORLD_W_TILES)) {
       int16_t row=(sprite->y+sprite->h+(TILE_H_MM>>1))/TILE_H_MM;
       if ((row>=0)&&(row<WORLD_H_TILES)) {
-        uint8_t tile=grid[row*WORLD_W_TILES+col];
+        uint8_t tile=GRID_TILE(col,row);
         switch (tile) {
           case 0x10: 
           case 0x11: 
@@ -183,17 +162,16 @@ static void ivan_check_tattle(struct sprite *sprite) {
  
 static uint8_t ivan_pickup_shovel(struct sprite *sprite) {
   if (SPRITE->carrying!=CARRYING_NONE) return 0;
-  int16_t x=sprite->x+(sprite->w>>1);
-  int16_t y=sprite->y+(sprite->h>>1);
-  struct sprite *shovel=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;shovel++) {
+  coord_t x=sprite->x+(sprite->w>>1);
+  coord_t y=sprite->y+(sprite->h>>1);
+  struct sprite *shovelv[8];
+  uint16_t shovelc=sprite_find(shovelv,8,x,y,1,1);
+  if (shovelc>8) shovelc=8;
+  uint16_t i=0;
+  for (;i<shovelc;i++) {
+    struct sprite *shovel=shovelv[i];
     if (shovel->controller!=SPRITE_CONTROLLER_SHOVEL) continue;
-    if (x<shovel->x) continue;
-    if (y<shovel->y) continue;
-    if (x>=shovel->x+shovel->w) continue;
-    if (y>=shovel->y+shovel->h) continue;
-    shovel->controller=SPRITE_CONTROLLER_NONE;
+    sprite_del(shovel);
     SPRITE->carrying=CARRYING_SHOVEL;
     return 1;
   }
@@ -207,9 +185,8 @@ static void ivan_drop_shovel(struct sprite *sprite) {
   
   SPRITE->carrying=CARRYING_NONE;
   
-  struct sprite *shovel=sprite_new();
+  struct sprite *shovel=sprite_new(SPRITE_CONTROLLER_SHOVEL);
   if (shovel) {
-    shovel->controller=SPRITE_CONTROLLER_SHOVEL;
     shovel->w=13*MM_PER_PIXEL;
     shovel->h=5*MM_PER_PIXEL;
     shovel->x=sprite->x+(sprite->w>>1)-(shovel->w>>1);
@@ -249,21 +226,21 @@ static void ivan_deposit(struct sprite *sprite) {
 static void ivan_pickup(struct sprite *sprite) {
   if (SPRITE->carrying!=CARRYING_NONE) return;
   if (!sprite_is_grounded(sprite)) return;
-  int16_t midx=sprite->x+(sprite->w>>1);
+  coord_t midx=sprite->x+(sprite->w>>1);
   int16_t col=midx/TILE_W_MM;
   if (col>=WORLD_W_TILES) col-=WORLD_W_TILES;
   if ((col<0)||(col>=WORLD_W_TILES)) return;
   int16_t row=(sprite->y+sprite->h+(TILE_H_MM>>1))/TILE_H_MM;
   if ((row<0)||(row>=WORLD_H_TILES)) return;
   
-  uint8_t tile=grid[row*WORLD_W_TILES+col];
+  uint8_t tile=GRID_TILE(col,row);
   switch (tile) {
     case 0x10: SPRITE->carrying=CARRYING_BRICK; break;
     case 0x11: SPRITE->carrying=CARRYING_BARREL; break;
     case 0x12: SPRITE->carrying=CARRYING_STATUE; break;
     default: return;
   }
-  grid[row*WORLD_W_TILES+col]=0x00;
+  grid_set(col,row,0x00);
   thumbnail_draw();//TODO consider incremental redraw; only one pixel could have changed
 }
  
@@ -280,17 +257,17 @@ static void ivan_drop(struct sprite *sprite) {
   if (!sprite_is_grounded(sprite)) return;
   
   // Find the cell where our crotch is and verify it's fully empty, and the one below is solid.
-  int16_t midx=sprite->x+(sprite->w>>1);
+  coord_t midx=sprite->x+(sprite->w>>1);
   int16_t col=midx/TILE_W_MM;
   if (col>=WORLD_W_TILES) col-=WORLD_W_TILES;
   if ((col<0)||(col>=WORLD_W_TILES)) return;
   int16_t row=(sprite->y+sprite->h-(TILE_H_MM>>1))/TILE_H_MM;
   if ((row<0)||(row>=WORLD_H_TILES)) return;
-  if (grid[row*WORLD_W_TILES+col]!=0x00) return;
-  if ((row<WORLD_H_TILES-1)&&(grid[(row+1)*WORLD_W_TILES+col]<0x10)) return;
+  if (GRID_TILE(col,row)!=0x00) return;
+  if ((row<WORLD_H_TILES-1)&&(GRID_TILE(col,row+1)<0x10)) return;
   
   // In any other game, we'd have to check for headroom, but in this one there are no ceilings.
-  grid[row*WORLD_W_TILES+col]=tileid;
+  grid_set(col,row,tileid);
   SPRITE->carrying=CARRYING_NONE;
   sprite->y-=TILE_H_MM;
   thumbnail_draw();//TODO consider incremental redraw; only one pixel could have changed
@@ -328,18 +305,23 @@ static void ivan_check_actions(struct sprite *sprite) {
 
 }
 
-/* If we are at (x,y), and trapped in a hole with walls at (lx) and (rx), is the shovel reachable?
+/* How high can Ivan climb, in tiles? One jump's worth.
  */
  
-static uint8_t shovel_is_reachable(struct sprite *sprite,int16_t x,int16_t y,int16_t lx,int16_t rx) {
+#define IVAN_CLIMB_TILES 2
+
+/* Can Ivan get to the shovel, given the cells he can reach?
+ * (reach,x0) from grid_reachable().
+ */
+ 
+static uint8_t shovel_is_reachable(struct sprite *sprite,const uint64_t *reach,int16_t x0) {
 
   // First, best case scenario: If we're holding the shovel, it is reachable.
   if (SPRITE->carrying==CARRYING_SHOVEL) return 1;
   if (SPRITE->carrying==CARRYING_SHOVEL_FULL) return 1;
   
-  struct sprite *shovel=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;shovel++) {
+  struct sprite *shovel;
+  for (shovel=sprite_next(0);shovel;shovel=sprite_next(shovel)) {
   
     if (shovel->controller!=SPRITE_CONTROLLER_SHOVEL) continue;
   
@@ -349,19 +331,16 @@ static uint8_t shovel_is_reachable(struct sprite *sprite,int16_t x,int16_t y,int
     int16_t sy=(shovel->y+(shovel->h>>1))/TILE_H_MM;
     if ((sy<0)||(sy>=WORLD_H_TILES)) continue;
     
-    if (lx<rx) {
-      if (sx<=lx) continue;
-      if (sx>=rx) continue;
-    } else {
-      if (sx>=lx) continue;
-      if (sx<=rx) continue;
-    }
+    int16_t bit=sx-x0;
+    if (bit<0) bit+=WORLD_W_TILES;
+    if (bit>=GRID_REACH_COLC) continue;
+    if (!(reach[sy]&(1ull<<bit))) continue;
     
-    if (grid[sy*WORLD_W_TILES+sx]>=0x10) {
+    if (GRID_TILE(sx,sy)>=0x10) {
       // Shovel is buried. Oh Ivan what have you done?
       continue;
     }
-    if ((sy<WORLD_H_TILES-1)&&(grid[(sy+1)*WORLD_W_TILES+sx]<0x10)) {
+    if ((sy<WORLD_H_TILES-1)&&(GRID_TILE(sx,sy+1)<0x10)) {
       // There is air under the shovel. It might still be reachable by jumping, but let's stop there.
       continue;
     }
@@ -370,50 +349,11 @@ static uint8_t shovel_is_reachable(struct sprite *sprite,int16_t x,int16_t y,int
   return 0;
 }
 
-/* How many solid cells present in column (x) beginning at row (y) and proceeding upward?
- */
- 
-static int16_t get_elevation(int16_t x,int16_t y) {
-  if (x<0) return 0;
-  if (y<0) return 0;
-  if (x>=WORLD_W_TILES) return 0;
-  if (y>=WORLD_H_TILES) y=WORLD_H_TILES-1;
-  const uint8_t *v=grid+y*WORLD_W_TILES+x;
-  int16_t elevation=0;
-  while (y>=0) {
-    if (*v<0x10) break; // not solid
-    elevation++;
-    y--;
-    v-=WORLD_W_TILES;
-  }
-  return elevation;
-}
-
-/* How many dirts between (lx) and (rx) exclusive?
- */
- 
-static int16_t count_dirt_tiles(int16_t lx,int16_t rx) {
-  if (lx>rx) {
-    return count_dirt_tiles(-1,rx)+count_dirt_tiles(lx+1,WORLD_W_TILES);
-  }
-  lx+=1;
-  rx-=1;
-  if (lx<0) lx=0;
-  if (rx>=WORLD_W_TILES) rx=WORLD_W_TILES-1;
-  int16_t dirtc=0;
-  while (lx<=rx) {
-    const uint8_t *v=grid+lx;
-    uint8_t yi=WORLD_H_TILES;
-    for (;yi-->0;v+=WORLD_W_TILES) if ((*v>=0x20)&&(*v<=0x2f)) dirtc++;
-    lx++;
-  }
-  return dirtc;
-}
-
 /* Check whether I am trapped, ie should we summon a fairy?
- * "Trapped" means one of:
- *   - There is a wall on each side of me more than 2 tiles high, and the shovel is unreachable.
+ * "Trapped" means I can't climb out to every column of the world, and one of:
+ *   - The shovel is unreachable.
  *   - Shovel is reachable, and the walls on each side of me are taller than the available dirt can pile.
+ * In a world too wide for one reach window, getting to either edge of the window counts as climbing out.
  */
  
 static uint8_t ivan_is_trapped(struct sprite *sprite) {
@@ -425,40 +365,53 @@ static uint8_t ivan_is_trapped(struct sprite *sprite) {
   int16_t y=(sprite->y+(sprite->h>>1))/TILE_H_MM;
   if ((y<0)||(y>=WORLD_H_TILES)) return 0;
   
-  // Walk each direction and find the ground level at each column.
-  // If any single-pair slope exceeds 2, it's blocked.
-  // If both directions are blocked at different places, we're trapped.
-  int16_t lx=x-1;
-  int16_t fatal_elevation=2,prev_elevation=0;;
-  while (1) {
-    if (lx<0) lx+=WORLD_W_TILES;
+  // Find every cell I could walk, fall, or jump to, and which columns that touches.
+  // If it's all of them, I can get around the world; not trapped.
+  // Columns from here on are positions in the reach window, not the world.
+  uint64_t reach[WORLD_H_TILES_LIMIT];
+  int16_t x0=grid_reachable(reach,x,y,IVAN_CLIMB_TILES);
+  int16_t colc=GRID_REACH_COLC;
+  uint64_t cols=0;
+  int16_t row=0;
+  for (;row<WORLD_H_TILES;row++) cols|=reach[row];
+  x-=x0;
+  if (x<0) x+=WORLD_W_TILES;
+  
+  // Walls are the first unreachable column each direction.
+  int16_t lx=x;
+  do {
+    if (--lx<0) {
+      if (!GRID_REACH_WRAPS) return 0; // reached the window's edge
+      lx+=colc;
+    }
     if (lx==x) return 0; // circled the world; he's not trapped.
-    int16_t ly=get_elevation(lx,y);
-    if (ly>prev_elevation+2) break;
-    lx--;
-    prev_elevation=ly;
-  }
-  // And the same thing rightward...
-  int16_t rx=x+1;
-  fatal_elevation=2;
-  prev_elevation=0;
-  while (1) {
-    if (rx>=WORLD_W_TILES) rx-=WORLD_W_TILES;
-    if (rx==x) return 0;
-    if (rx==lx) return 0; // a single pole somewhere is not fairy-worthy
-    int16_t ry=get_elevation(rx,y);
-    if (ry>prev_elevation+2) break;
-    rx++;
-    prev_elevation=ry;
-  }
+  } while (cols&(1ull<<lx));
+  int16_t rx=x;
+  do {
+    if (++rx>=colc) {
+      if (!GRID_REACH_WRAPS) return 0;
+      rx-=colc;
+    }
+  } while (cols&(1ull<<rx));
+  if (rx==lx) return 0; // a single pole somewhere is not fairy-worthy
   
   // If the shovel is reachable, measure the shovelable dirt between lx and rx exclusive.
-  if (shovel_is_reachable(sprite,x,y,lx,rx)) {
-    int16_t dirtc=count_dirt_tiles(lx,rx);
-    int16_t lelev=get_elevation(lx,y);//WORLD_H_TILES-1);
-    int16_t relev=get_elevation(rx,y);//WORLD_H_TILES-1);
+  if (shovel_is_reachable(sprite,reach,x0)) {
+    int16_t wlx=(x0+lx)%WORLD_W_TILES;
+    int16_t wrx=(x0+rx)%WORLD_W_TILES;
+    int16_t dirtc=0;
+    int16_t col=wlx;
+    for (;;) {
+      if (++col>=WORLD_W_TILES) col=0;
+      if (col==wrx) break;
+      dirtc+=grid_column_dirt(col);
+    }
+    // Wall height is how far above my row its top is, that's what I'd have to climb.
+    int16_t lelev=y+1-grid_column_top(wlx);
+    int16_t relev=y+1-grid_column_top(wrx);
     int16_t elevation=(lelev>relev)?lelev:relev;
-    int16_t w=(lx<rx)?(rx-lx-1):(rx+WORLD_W_TILES-lx-1);
+    if (elevation<0) elevation=0;
+    int16_t w=(wlx<wrx)?(wrx-wlx-1):(wrx+WORLD_W_TILES-wlx-1);
     if ((dirtc*4>=w*elevation)&&(elevation<=w<<1)) {
       // This formula is not exact, it's a little forgiving.
       // But basically, if we have 1/4 of the enclosed area as dirt, and elevation is less than double width, you can dig out.
@@ -473,9 +426,8 @@ static uint8_t ivan_is_trapped(struct sprite *sprite) {
  */
  
 static uint8_t fairy_exists() {
-  const struct sprite *sprite=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;sprite++) {
+  struct sprite *sprite;
+  for (sprite=sprite_next(0);sprite;sprite=sprite_next(sprite)) {
     if (sprite->controller==SPRITE_CONTROLLER_FAIRY) return 1;
   }
   return 0;
@@ -507,9 +459,8 @@ static void ivan_check_fairy(struct sprite *sprite) {
     SPRITE->fairy_triggered=1;
     if (fairy_exists()) return;
     if (ivan_is_trapped(sprite)) {
-      struct sprite *fairy=sprite_new();
+      struct sprite *fairy=sprite_new(SPRITE_CONTROLLER_FAIRY);
       if (fairy) {
-        fairy->controller=SPRITE_CONTROLLER_FAIRY;
         fairy->w=12*MM_PER_PIXEL;
         fairy->h=11*MM_PER_PIXEL;
         fairy->x=sprite->x-(CAMERA_W_MM>>1)-fairy->w;
@@ -543,28 +494,22 @@ void sprite_update_ivan(struct sprite *sprite) {
 /* Render.
  */
  
-void sprite_render_ivan(struct sprite *sprite) {
-  int16_t x,y;
-  sprite_get_render_position(&x,&y,sprite);
-  x+=1;
-  
-  // Draw the death sequence if appropriate, it's completely different.
+/* Animate.
+ */
+ 
+void sprite_animate_ivan(struct sprite *sprite) {
+
+  // Death sequence: 11 frames, then hold the last.
   if (!hp) {
     SPRITE->animclock++;
     if (SPRITE->animclock>=4) {
       SPRITE->animclock=0;
-      if (SPRITE->animframe<10) SPRITE->animframe++; // 11 frames
+      if (SPRITE->animframe<10) SPRITE->animframe++;
     }
-    image_blit_colorkey(&fb,x-4,y,&fgbits,SPRITE->animframe*11,61,11,11);
     return;
   }
   
-  uint8_t headframe=0,torsoframe=0,legframe=0;
-  
-  int16_t addy=0;
-  if (SPRITE->injury_highlight&4) addy=33;
-  
-  // Animate legs if walking: 0..3
+  // Legs if walking: 0..3
   if (SPRITE->dx) {
     if (SPRITE->animclock>0) {
       SPRITE->animclock--;
@@ -573,11 +518,33 @@ void sprite_render_ivan(struct sprite *sprite) {
       SPRITE->animframe++;
       if (SPRITE->animframe>=4) SPRITE->animframe=0;
     }
-    legframe=SPRITE->animframe;
   } else {
     SPRITE->animclock=0;
     SPRITE->animframe=0;
   }
+}
+
+/* Render.
+ */
+
+void sprite_render_ivan(struct sprite *sprite) {
+  int16_t x,y;
+  sprite_get_render_position(&x,&y,sprite);
+  x+=1;
+  
+  // Draw the death sequence if appropriate, it's completely different.
+  if (!hp) {
+    spr_ivan_dead(&fb,x-4,y,SPRITE->animframe,0);
+    return;
+  }
+  
+  uint8_t headframe=0,torsoframe=0,legframe=0;
+  
+  // Injury highlight frames follow the plain ones in each compiled sprite.
+  uint8_t hurt=(SPRITE->injury_highlight&4)?1:0;
+  
+  // Legs animate if walking: 0..3
+  if (SPRITE->dx) legframe=SPRITE->animframe;
   
   // Torso animates like legs if not carrying anything, otherwise it has one fixed frame per carry type.
   switch (SPRITE->carrying) {
@@ -590,15 +557,10 @@ void sprite_render_ivan(struct sprite *sprite) {
   }
   
   // Draw head, torso, and legs.
-  if (SPRITE->facedir<0) {
-    image_blit_colorkey_flop(&fb,x-2,y+4,&fgbits,22+torsoframe*9,addy,9,5);
-    image_blit_colorkey_flop(&fb,x-1,y+8,&fgbits,legframe*7,9+addy,7,3);
-    image_blit_colorkey_flop(&fb,x,y,&fgbits,headframe*5,addy,5,5);
-  } else {
-    image_blit_colorkey(&fb,x-2,y+4,&fgbits,22+torsoframe*9,addy,9,5);
-    image_blit_colorkey(&fb,x-1,y+8,&fgbits,legframe*7,9+addy,7,3);
-    image_blit_colorkey(&fb,x,y,&fgbits,headframe*5,addy,5,5);
-  }
+  uint8_t flop=(SPRITE->facedir<0)?1:0;
+  spr_torso(&fb,x-2,y+4,torsoframe+hurt*5,flop);
+  spr_legs(&fb,x-1,y+8,legframe+hurt*4,flop);
+  spr_ivan_head(&fb,x,y,headframe+hurt*2,flop);
   
   // Draw the carry item, and forward arm if needed.
   uint8_t tileid;
@@ -607,15 +569,15 @@ void sprite_render_ivan(struct sprite *sprite) {
     case CARRYING_SHOVEL:
     case CARRYING_SHOVEL_FULL: {
         int16_t dirtx;
-        if (SPRITE->facedir<0) {
-          image_blit_colorkey_flop(&fb,x-7,y+6,&fgbits,0,17+addy,14,3);
+        if (flop) {
+          spr_ivan_shovel(&fb,x-7,y+6,hurt,1);
           dirtx=x-7;
         } else {
-          image_blit_colorkey(&fb,x-1,y+6,&fgbits,0,17+addy,14,3);
+          spr_ivan_shovel(&fb,x-1,y+6,hurt,0);
           dirtx=x+8;
         }
         if (SPRITE->carrying==CARRYING_SHOVEL_FULL) {
-          image_blit_colorkey(&fb,dirtx,y+3,&fgbits,17,addy,5,5);
+          spr_ivan_dirt(&fb,dirtx,y+3,hurt,0);
         }
       } break;
     
@@ -625,15 +587,13 @@ void sprite_render_ivan(struct sprite *sprite) {
     _overhead_: {
         int16_t dstx=(SPRITE->facedir<0)?(x-2):(x-1);
         if (tileid==0x12) { // special colorkey version of statue
-          image_blit_colorkey(&fb,dstx,y-8,&fgbits,5,20,8,8);
+          spr_ivan_statue(&fb,dstx,y-8,0,0);
         } else { // everything else is square
           image_blit_opaque(&fb,dstx,y-8,&bgtiles,(tileid&0x0f)*TILE_W_PIXELS,(tileid>>4)*TILE_H_PIXELS,8,8);
         }
-        if (SPRITE->facedir<0) { // forward arm
-          image_blit_colorkey_flop(&fb,x+2,y-1,&fgbits,30,28+addy,3,5);
-        } else {
-          image_blit_colorkey(&fb,x,y-1,&fgbits,30+(addy?3:0),28,3,5);
-        }
+        // Forward arm. The flopped one highlights differently, it's a separate frame.
+        if (flop) spr_ivan_arm(&fb,x+2,y-1,hurt?2:0,1);
+        else spr_ivan_arm(&fb,x,y-1,hurt,0);
       } break;
   }
 }
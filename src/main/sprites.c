@@ -5,26 +5,266 @@
 #include <stdio.h>
 #include <string.h>
 
-/* Find any unused sprite.
+/* Slot bookkeeping.
+ * (sprite_livev) has a bit set for every slot in use, so allocation and iteration skip empty slots without looking at them.
+ * (sprite_kindv) splits the same bits by controller, for the batch passes.
+ * Both are derived from (spritev): sprite_reindex() rebuilds them after anyone writes spritev directly.
+ */
+
+#define SPRITE_WORDC ((SPRITE_LIMIT+31)>>5)
+
+static GAME_LOCAL uint32_t sprite_livev[SPRITE_WORDC];
+static GAME_LOCAL uint32_t sprite_kindv[SPRITE_CONTROLLER_COUNT][SPRITE_WORDC];
+static GAME_LOCAL uint16_t sprite_freehint=0; // no free slots in words below this
+
+/* During a batch, slots created behind the sprite updating.
+ * They sit out the rest of the batch, as they would have in one slot-order walk.
+ */
+static GAME_LOCAL uint32_t sprite_bornv[SPRITE_WORDC];
+static GAME_LOCAL uint16_t sprite_cursor=0;
+static GAME_LOCAL uint8_t sprite_batching=0;
+
+// Index of the lowest set bit, (v) must be nonzero.
+static inline uint8_t sprite_lowbit(uint32_t v) {
+  return __builtin_ctz(v);
+}
+
+/* Spatial index.
+ * Live sprites bucketed by the tile column of their left edge, in a doubly-linked list per column.
+ * Rebuilt at the start of each update. Sprites move at most one tile per frame, so queries look one column further each way.
+ * New sprites don't have a position yet when sprite_new() returns, so they wait on a pending list and get linked at the next query.
+ */
+ 
+#define SPRITE_INDEX_REACH 2 /* Widest sprite, in tiles, rounded up. */
+#define SPRITE_INDEX_SLACK 1 /* Columns a sprite can move between rebuilds. */
+#define SPRITE_INDEX_NONE 0xffff
+
+static GAME_LOCAL struct sprite_index {
+  uint16_t headv[WORLD_W_TILES_LIMIT];
+  uint16_t nextv[SPRITE_LIMIT];
+  uint16_t prevv[SPRITE_LIMIT];
+  int16_t colv[SPRITE_LIMIT]; // column each slot is linked in, or -1
+  uint16_t pendingv[SPRITE_LIMIT];
+  uint16_t pendingc;
+  uint8_t valid;
+} sprindex;
+
+static inline int16_t sprite_index_column(coord_t x) {
+  int16_t col=(x>=0)?(x/TILE_W_MM):((x+1)/TILE_W_MM-1);
+  col%=WORLD_W_TILES;
+  if (col<0) col+=WORLD_W_TILES;
+  return col;
+}
+
+static void sprite_index_link(uint16_t p) {
+  struct sprite_index *ix=&sprindex;
+  if (ix->colv[p]>=0) {
+    uint16_t next=ix->nextv[p],prev=ix->prevv[p];
+    if (prev==SPRITE_INDEX_NONE) ix->headv[ix->colv[p]]=next;
+    else ix->nextv[prev]=next;
+    if (next!=SPRITE_INDEX_NONE) ix->prevv[next]=prev;
+  }
+  int16_t col=sprite_index_column(spritev[p].x);
+  ix->colv[p]=col;
+  ix->prevv[p]=SPRITE_INDEX_NONE;
+  ix->nextv[p]=ix->headv[col];
+  if (ix->headv[col]!=SPRITE_INDEX_NONE) ix->prevv[ix->headv[col]]=p;
+  ix->headv[col]=p;
+}
+
+void sprite_index_rebuild() {
+  memset(sprindex.headv,0xff,sizeof(uint16_t)*WORLD_W_TILES);
+  memset(sprindex.colv,0xff,sizeof(sprindex.colv));
+  struct sprite *sprite;
+  for (sprite=sprite_next(0);sprite;sprite=sprite_next(sprite)) {
+    sprite_index_link(sprite-spritev);
+  }
+  sprindex.pendingc=0;
+  sprindex.valid=1;
+}
+
+static void sprite_index_flush() {
+  const uint16_t *p=sprindex.pendingv;
+  uint16_t i=sprindex.pendingc;
+  for (;i-->0;p++) if (spritev[*p].controller) sprite_index_link(*p);
+  sprindex.pendingc=0;
+}
+
+/* Allocate, free, reindex.
+ */
+ 
+struct sprite *sprite_new(uint8_t controller) {
+  if (!controller||(controller>=SPRITE_CONTROLLER_COUNT)) return 0;
+  uint16_t i=sprite_freehint;
+  for (;i<SPRITE_WORDC;i++,sprite_freehint++) {
+    uint32_t avail=~sprite_livev[i];
+    if (!avail) continue;
+    uint16_t p=(i<<5)+sprite_lowbit(avail);
+    if (p>=SPRITE_LIMIT) return 0;
+    uint32_t bit=1u<<(p&31);
+    sprite_livev[i]|=bit;
+    sprite_kindv[controller][i]|=bit;
+    if (sprite_batching&&(p<sprite_cursor)) sprite_bornv[i]|=bit;
+    struct sprite *sprite=spritev+p;
+    memset(sprite,0,sizeof(struct sprite));
+    sprite->controller=controller;
+    memset(spritepools.ivan+p,0,sizeof(struct sprite_ivan));
+    memset(spritepools.guard+p,0,sizeof(struct sprite_guard));
+    memset(spritepools.shovel+p,0,sizeof(struct sprite_shovel));
+    memset(spritepools.bullet+p,0,sizeof(struct sprite_bullet));
+    memset(spritepools.fairy+p,0,sizeof(struct sprite_fairy));
+    if (sprindex.valid) {
+      if (sprindex.pendingc<SPRITE_LIMIT) sprindex.pendingv[sprindex.pendingc++]=p;
+      else sprindex.valid=0; // lots of churn and no queries; rebuild at the next one
+    }
+    return sprite;
+  }
+  return 0;
+}
+
+void sprite_del(struct sprite *sprite) {
+  uint16_t p=sprite-spritev;
+  uint32_t mask=~(1u<<(p&31));
+  if (sprite->controller<SPRITE_CONTROLLER_COUNT) sprite_kindv[sprite->controller][p>>5]&=mask;
+  sprite->controller=SPRITE_CONTROLLER_NONE;
+  sprite_livev[p>>5]&=mask;
+  if ((p>>5)<sprite_freehint) sprite_freehint=p>>5;
+}
+
+void sprite_reindex() {
+  memset(sprite_livev,0,sizeof(sprite_livev));
+  memset(sprite_kindv,0,sizeof(sprite_kindv));
+  const struct sprite *sprite=spritev;
+  uint16_t p=0;
+  for (;p<SPRITE_LIMIT;p++,sprite++) {
+    if (!sprite->controller) continue;
+    uint32_t bit=1u<<(p&31);
+    sprite_livev[p>>5]|=bit;
+    if (sprite->controller<SPRITE_CONTROLLER_COUNT) sprite_kindv[sprite->controller][p>>5]|=bit;
+  }
+  sprite_freehint=0;
+  sprindex.valid=0;
+}
+
+/* Iterate.
+ */
+ 
+struct sprite *sprite_next(struct sprite *sprite) {
+  uint16_t p=sprite?(sprite-spritev+1):0;
+  while (p<SPRITE_LIMIT) {
+    uint32_t word=sprite_livev[p>>5]>>(p&31);
+    if (word) return spritev+p+sprite_lowbit(word);
+    p=(p&~31)+32;
+  }
+  return 0;
+}
+
+/* Batch passes.
  */
  
-struct sprite *sprite_new() {
-  struct sprite *sprite=spritev;
-  uint8_t i=SPRITE_LIMIT;
-  for (;i-->0;sprite++) {
-    if (sprite->controller==SPRITE_CONTROLLER_NONE) {
-      memset(sprite,0,sizeof(struct sprite));
-      return sprite;
+void sprite_batch_begin() {
+  memset(sprite_bornv,0,sizeof(sprite_bornv));
+  sprite_cursor=0;
+  sprite_batching=1;
+}
+
+void sprite_batch_end() {
+  sprite_batching=0;
+  sprite_cursor=0;
+}
+ 
+struct sprite *sprite_next_of(uint8_t controller,struct sprite *sprite) {
+  if (controller>=SPRITE_CONTROLLER_COUNT) return 0;
+  const uint32_t *kind=sprite_kindv[controller];
+  uint16_t p=sprite?(sprite-spritev+1):0;
+  while (p<SPRITE_LIMIT) {
+    uint32_t word=(kind[p>>5]&~sprite_bornv[p>>5])>>(p&31);
+    if (word) {
+      p+=sprite_lowbit(word);
+      if (sprite_batching) sprite_cursor=p;
+      return spritev+p;
     }
+    p=(p&~31)+32;
   }
   return 0;
 }
 
+/* Encode one slot in the interleaved layout replay hashes use.
+ * Pools other than the slot's own controller are zero there, so OR-ing them all together leaves just the one.
+ */
+ 
+static void sprite_encode_pool(uint8_t *dst,const void *src,int c) {
+  const uint8_t *v=src;
+  for (;c-->0;dst++,v++) (*dst)|=*v;
+}
+ 
+void sprite_encode(uint8_t *dst,const struct sprite *sprite) {
+  uint16_t p=sprite-spritev;
+  // Header is always the 16-bit layout, so hashes don't depend on WORLD_COORD32.
+  int16_t hdr[4]={sprite->x,sprite->y,sprite->w,sprite->h};
+  dst[0]=sprite->controller;
+  dst[1]=0;
+  memcpy(dst+2,hdr,sizeof(hdr));
+  dst+=2+sizeof(hdr);
+  memset(dst,0,SPRITE_OPAQUE_SIZE);
+  sprite_encode_pool(dst,spritepools.ivan+p,sizeof(struct sprite_ivan));
+  sprite_encode_pool(dst,spritepools.guard+p,sizeof(struct sprite_guard));
+  sprite_encode_pool(dst,spritepools.shovel+p,sizeof(struct sprite_shovel));
+  sprite_encode_pool(dst,spritepools.bullet+p,sizeof(struct sprite_bullet));
+  sprite_encode_pool(dst,spritepools.fairy+p,sizeof(struct sprite_fairy));
+}
+
+/* Overlap query.
+ */
+ 
+/* Overlap is plain coordinates, not wrapped, same as the collision checks this replaced.
+ * Wrapping here would change outcomes near the seam, and recorded replays would no longer play back.
+ */
+static uint8_t sprite_overlaps(const struct sprite *sprite,coord_t x,coord_t y,coord_t w,coord_t h) {
+  if (sprite->y>=y+h) return 0;
+  if (sprite->y+sprite->h<=y) return 0;
+  if (sprite->x>=x+w) return 0;
+  if (sprite->x+sprite->w<=x) return 0;
+  return 1;
+}
+
+static uint16_t sprite_find_add(struct sprite **dst,uint16_t dsta,uint16_t dstc,struct sprite *sprite) {
+  if (dstc>=dsta) return dstc+1;
+  // Keep it in slot order, so callers see the same thing a plain walk over (spritev) would.
+  uint16_t i=dstc;
+  while (i&&(dst[i-1]>sprite)) { dst[i]=dst[i-1]; i--; }
+  dst[i]=sprite;
+  return dstc+1;
+}
+
+uint16_t sprite_find(struct sprite **dst,uint16_t dsta,coord_t x,coord_t y,coord_t w,coord_t h) {
+  if (!sprindex.valid) sprite_index_rebuild();
+  else if (sprindex.pendingc) sprite_index_flush();
+  uint16_t dstc=0;
+  
+  // Columns whose sprites might reach (x..x+w). The window wraps around the world, like the columns do.
+  int16_t cola=sprite_index_column(x)-SPRITE_INDEX_REACH-SPRITE_INDEX_SLACK;
+  int32_t colc=(w+TILE_W_MM-1)/TILE_W_MM+SPRITE_INDEX_REACH+SPRITE_INDEX_SLACK*2+1;
+  if (colc>WORLD_W_TILES) colc=WORLD_W_TILES;
+  if (cola<0) cola+=WORLD_W_TILES;
+  for (;colc-->0;cola++) {
+    if (cola>=WORLD_W_TILES) cola=0;
+    uint16_t p=sprindex.headv[cola];
+    for (;p!=SPRITE_INDEX_NONE;p=sprindex.nextv[p]) {
+      struct sprite *sprite=spritev+p;
+      if (!sprite->controller) continue;
+      if (!sprite_overlaps(sprite,x,y,w,h)) continue;
+      dstc=sprite_find_add(dst,dsta,dstc,sprite);
+    }
+  }
+  return dstc;
+}
+
 /* Test feet on solid ground.
  */
  
 uint8_t sprite_is_grounded(const struct sprite *sprite) {
-  int16_t bottom=sprite->y+sprite->h;
+  coord_t bottom=sprite->y+sprite->h;
 
   // The absolute floor is solid, and don't let a sprite pass through it either.
   if (bottom>=WORLD_H_MM) return 1;
@@ -42,7 +282,7 @@ uint8_t sprite_is_grounded(const struct sprite *sprite) {
 /* Move horizontally.
  */
  
-int16_t sprite_move_horz(struct sprite *sprite,int16_t dx) {
+coord_t sprite_move_horz(struct sprite *sprite,coord_t dx) {
 
   // Restrict horizontal movement to 1 tile/frame.
   // This means we can be certain that no more than 1 new column of the grid is in play per movement.
@@ -50,7 +290,7 @@ int16_t sprite_move_horz(struct sprite *sprite,int16_t dx) {
   else if (dx>TILE_W_MM) dx=TILE_W_MM;
   
   // Measure the space newly covered.
-  int16_t ckx,ckw;
+  coord_t ckx,ckw;
   if (dx<0) {
     ckx=sprite->x+dx;
     ckw=-dx;
@@ -65,8 +305,8 @@ int16_t sprite_move_horz(struct sprite *sprite,int16_t dx) {
       dx=-sprite->x%TILE_W_MM;
       if (dx==TILE_W_MM) return 0;
     } else {
-      int16_t rightx=sprite->x+sprite->w+dx;
-      int16_t wallx=rightx-rightx%TILE_W_MM;
+      coord_t rightx=sprite->x+sprite->w+dx;
+      coord_t wallx=rightx-rightx%TILE_W_MM;
       if (!(dx=wallx-sprite->w-sprite->x)) return 0;
     }
   }
@@ -85,7 +325,7 @@ int16_t sprite_move_horz(struct sprite *sprite,int16_t dx) {
 /* Move vertically.
  */
 
-int16_t sprite_move_vert(struct sprite *sprite,int16_t dy) {
+coord_t sprite_move_vert(struct sprite *sprite,coord_t dy) {
 
   // Upward motion is free (and null motion obviously)
   if (dy<=0) return dy;
@@ -94,12 +334,12 @@ int16_t sprite_move_vert(struct sprite *sprite,int16_t dy) {
   if (dy>TILE_H_MM) dy=TILE_H_MM;
   
   // Measure the space newly covered.
-  int16_t cky=sprite->y+sprite->h;
+  coord_t cky=sprite->y+sprite->h;
   
   // If there's a grid collision, clamp to the next row boundary.
   if (grid_contains_any_solid(sprite->x,cky,sprite->w,dy)) {
-    int16_t bottomy=cky+dy;
-    int16_t wally=bottomy-bottomy%TILE_H_MM;
+    coord_t bottomy=cky+dy;
+    coord_t wally=bottomy-bottomy%TILE_H_MM;
     if (!(dy=wally-sprite->h-sprite->y)) return 0;
   }
   
@@ -131,20 +371,21 @@ void sprite_render_dummy(struct sprite *sprite) {
 /* Shovel.
  */
  
-#define SHOVEL_ANIMCLOCK (sprite->opaque[0])
+#define SHOVEL_ANIMCLOCK (SPRITE_STATE(shovel,sprite)->animclock)
  
-void sprite_render_shovel(struct sprite *sprite) {
-
+void sprite_animate_shovel(struct sprite *sprite) {
   if (SHOVEL_ANIMCLOCK) SHOVEL_ANIMCLOCK--;
   else SHOVEL_ANIMCLOCK=40;
-  
+}
+ 
+void sprite_render_shovel(struct sprite *sprite) {
   uint8_t frame=0;
   if (SHOVEL_ANIMCLOCK>=20) frame=1;
   else frame=0;
   
   int16_t x,y;
   sprite_get_render_position(&x,&y,sprite);
-  image_blit_colorkey(&fb,x,y,&fgbits,0+frame*13,12,13,5);
+  spr_shovel(&fb,x,y,frame,0);
 }
 
 #undef SHOVEL_ANIMCLOCK
@@ -158,35 +399,34 @@ void sprite_render_shovel(struct sprite *sprite) {
  
 void sprite_update_bullet(struct sprite *sprite) {
 
-  int8_t dx=sprite->opaque[0];
+  int8_t dx=SPRITE_STATE(bullet,sprite)->dx;
   if (!sprite_move_horz(sprite,dx*BULLET_SPEED)) {
-    sprite->controller=SPRITE_CONTROLLER_NONE;
+    sprite_del(sprite);
     return;
   }
   
   if (sprite_move_vert(sprite,BULLET_GRAVITY)!=BULLET_GRAVITY) {
-    sprite->controller=SPRITE_CONTROLLER_NONE;
+    sprite_del(sprite);
     return;
   }
   
-  struct sprite *hero=game_get_hero();
-  if (hero) {
-    int16_t x=sprite->x+(sprite->w>>1);
-    if ((x>=hero->x)&&(x<hero->x+hero->w)) {
-      int16_t y=sprite->y+(sprite->h>>1);
-      if ((y>=hero->y)&&(y<hero->y+hero->h)) {
-        sprite->controller=SPRITE_CONTROLLER_NONE;
-        injure_hero(hero);
-        return;
-      }
-    }
+  // Hit anybody? Only Ivan takes damage.
+  struct sprite *hitv[8];
+  uint16_t hitc=sprite_find(hitv,8,sprite->x+(sprite->w>>1),sprite->y+(sprite->h>>1),1,1);
+  if (hitc>8) hitc=8;
+  uint16_t i=0;
+  for (;i<hitc;i++) {
+    if (hitv[i]->controller!=SPRITE_CONTROLLER_IVAN) continue;
+    sprite_del(sprite);
+    injure_hero(hitv[i]);
+    return;
   }
 }
 
 void sprite_render_bullet(struct sprite *sprite) {
   int16_t x,y;
   sprite_get_render_position(&x,&y,sprite);
-  image_blit_colorkey(&fb,x,y,&fgbits,0,5,2,2);
+  spr_bullet(&fb,x,y,0,0);
 }
 
 /* Fairy Guardmother.
@@ -197,28 +437,29 @@ void sprite_render_bullet(struct sprite *sprite) {
 #define FAIRY_SPEED_VERT (MM_PER_PIXEL>>3)
  
 void sprite_update_fairy(struct sprite *sprite) {
+  struct sprite_fairy *fairy=SPRITE_STATE(fairy,sprite);
 
-  if (sprite->opaque[4]) {
+  if (fairy->escapeclock) {
     sprite->x-=FAIRY_ESCAPE_SPEED_HORZ;
     sprite->y-=FAIRY_SPEED_VERT;
-    sprite->opaque[4]++;
-    if (sprite->opaque[4]>=100) sprite->controller=SPRITE_CONTROLLER_NONE;
+    fairy->escapeclock++;
+    if (fairy->escapeclock>=100) sprite_del(sprite);
     return;
   }
 
-  if (!sprite->opaque[2]) sprite->x+=FAIRY_SPEED_HORZ;
+  if (!fairy->landed) sprite->x+=FAIRY_SPEED_HORZ;
   sprite->y+=FAIRY_SPEED_VERT;
   
   struct sprite *hero=game_get_hero();
   if (!hero) {
-    sprite->controller=SPRITE_CONTROLLER_NONE;
+    sprite_del(sprite);
     return;
   }
   if (sprite->y>=hero->y) {
-    sprite->opaque[2]=1;
+    fairy->landed=1;
     sprite->y=hero->y;
-    sprite->opaque[3]++;
-    if (sprite->opaque[3]>=30) { // pause a bit then make then dirt
+    fairy->pauseclock++;
+    if (fairy->pauseclock>=30) { // pause a bit then make then dirt
       int16_t x=(hero->x+(hero->w>>1))/TILE_W_MM;
       if (x>=WORLD_W_TILES) x-=WORLD_W_TILES;
       if ((x>=0)&&(x<WORLD_W_TILES)) {
@@ -229,27 +470,31 @@ void sprite_update_fairy(struct sprite *sprite) {
           //TODO fireworks
         }
       }
-      sprite->opaque[4]=1;
+      fairy->escapeclock=1;
     }
   }
 }
 
+void sprite_animate_fairy(struct sprite *sprite) {
+  struct sprite_fairy *fairy=SPRITE_STATE(fairy,sprite);
+  if (fairy->animclock) fairy->animclock--;
+  else {
+    fairy->animclock=6;
+    fairy->animframe++;
+    if (fairy->animframe>=4) fairy->animframe=0;
+  }
+}
+
 void sprite_render_fairy(struct sprite *sprite) {
+  const struct sprite_fairy *fairy=SPRITE_STATE(fairy,sprite);
   int16_t x,y;
   sprite_get_render_position(&x,&y,sprite);
   
-  if (sprite->opaque[0]) sprite->opaque[0]--;
-  else {
-    sprite->opaque[0]=6;
-    sprite->opaque[1]++;
-    if (sprite->opaque[1]>=4) sprite->opaque[1]=0;
-  }
-  
-  int16_t srcx=0;
-  switch (sprite->opaque[1]) {
-    case 1: srcx+=12; break;
-    case 2: srcx+=24; break;
-    case 3: srcx+=12; break;
+  uint8_t frame=0;
+  switch (fairy->animframe) {
+    case 1: frame=1; break;
+    case 2: frame=2; break;
+    case 3: frame=1; break;
   }
-  image_blit_colorkey(&fb,x,y,&fgbits,srcx,72,12,11);
+  spr_fairy(&fb,x,y,frame,0);
 }
@@ -1,8 +1,17 @@
 #include "synth.h"
 #include <stdio.h>
+#include <string.h>
 
 #define SYNTH_RELEASE_TIME 2000
 
+#define SYNTH_POOL_MUSIC 0
+#define SYNTH_POOL_SFX 1
+
+static const uint8_t synth_pool_base[2]={0,SYNTH_MUSIC_VOICE_LIMIT};
+static const uint8_t synth_pool_limit[2]={SYNTH_MUSIC_VOICE_LIMIT,SYNTH_VOICE_LIMIT};
+
+static void synth_start_queued_sfx(struct synth *synth);
+
 /* Read and process events from song at the current pointer, advancing state.
  * Stops after we set a delay or loop.
  */
@@ -80,6 +89,7 @@ static void synth_consume_song(struct synth *synth) {
  */
  
 int16_t synth_update(struct synth *synth) {
+  synth_start_queued_sfx(synth);
 
   // Update song.
   if (synth->songhold>0) {
@@ -94,10 +104,12 @@ int16_t synth_update(struct synth *synth) {
 
   // Generate PCM.
   int32_t sample=0;
-  struct synth_voice *voice=synth->voicev;
-  uint8_t i=synth->voicec;
-  for (;i-->0;voice++) {
-    if (voice->ttl>0) {
+  uint8_t poolid=0;
+  for (;poolid<2;poolid++) {
+    struct synth_voice *voice=synth->voicev+synth_pool_base[poolid];
+    uint8_t i=synth->heapc[poolid];
+    for (;i-->0;voice++) {
+      if (!voice->ttl) continue;
       voice->ttl--;
       int32_t sample1=voice->v[voice->p>>SYNTH_P_SHIFT];
       if (voice->ttl<SYNTH_RELEASE_TIME) {
@@ -116,6 +128,99 @@ int16_t synth_update(struct synth *synth) {
   return sample;
 }
 
+/* Render block.
+ * Same output as (framec) calls to synth_update(), sample for sample.
+ * We split the block into runs between song events, and mix each run voice by voice.
+ */
+ 
+#define SYNTH_BLOCK_LIMIT 256 /* accumulator size; longer blocks go in pieces */
+
+// Add one voice's next (c) samples into (acc), at 10 bits above the output's scale.
+static void synth_mix_voice(int32_t *acc,int c,struct synth_voice *voice) {
+  const int16_t *v=voice->v;
+  uint32_t p=voice->p,pd=voice->pd;
+  
+  // Sustain: full level until (ttl) drops below the release time. No branches, so it's a tight loop.
+  if (voice->ttl>SYNTH_RELEASE_TIME) {
+    uint32_t susc=voice->ttl-SYNTH_RELEASE_TIME;
+    int n=(susc<c)?susc:c;
+    int i=0;
+    for (;i<n;i++,p+=pd) acc[i]+=v[p>>SYNTH_P_SHIFT]<<10;
+    voice->ttl-=n;
+    acc+=n;
+    c-=n;
+  }
+  
+  // Release: level is (ttl*0x400)/SYNTH_RELEASE_TIME, with (ttl) after the decrement.
+  // Track the quotient and remainder as (ttl) steps down, instead of dividing every sample.
+  if (c>0) {
+    if (c>voice->ttl) c=voice->ttl;
+    if (c>0) {
+      uint32_t ttl=voice->ttl-1;
+      int32_t level=(ttl*0x400)/SYNTH_RELEASE_TIME;
+      int32_t rem=ttl*0x400-level*SYNTH_RELEASE_TIME;
+      int i=0;
+      for (;i<c;i++,p+=pd) {
+        acc[i]+=v[p>>SYNTH_P_SHIFT]*level;
+        if ((rem-=0x400)<0) { rem+=SYNTH_RELEASE_TIME; level--; }
+      }
+      voice->ttl-=c;
+      if (!voice->ttl) voice->waveid=voice->noteid=0xff;
+    }
+  }
+  voice->p=p;
+}
+
+// Advance the song by at most (c) frames, stopping at the next event. Returns how many.
+static int synth_song_run(struct synth *synth,int c) {
+  if (synth->songhold>0) {
+    if (c>synth->songhold) c=synth->songhold;
+    synth->songhold-=c;
+    return c;
+  }
+  if (synth->songdelay>0) {
+    if (c>synth->songdelay) c=synth->songdelay;
+    synth->songdelay-=c;
+    synth->songtime+=c;
+    return c;
+  }
+  if (synth->song) {
+    synth->songtime++;
+    synth_consume_song(synth);
+    return 1;
+  }
+  return c;
+}
+ 
+void synth_render_block(struct synth *synth,int16_t *dst,int framec) {
+  int32_t acc[SYNTH_BLOCK_LIMIT];
+  while (framec>0) {
+    int c=(framec<SYNTH_BLOCK_LIMIT)?framec:SYNTH_BLOCK_LIMIT;
+    synth_start_queued_sfx(synth);
+    memset(acc,0,sizeof(int32_t)*c);
+    int accp=0;
+    while (accp<c) {
+      int runc=synth_song_run(synth,c-accp);
+      uint8_t poolid=0;
+      for (;poolid<2;poolid++) {
+        struct synth_voice *voice=synth->voicev+synth_pool_base[poolid];
+        uint8_t i=synth->heapc[poolid];
+        for (;i-->0;voice++) {
+          if (voice->ttl>0) synth_mix_voice(acc+accp,runc,voice);
+        }
+      }
+      accp+=runc;
+    }
+    int i=0;
+    for (;i<c;i++) {
+      int32_t sample=acc[i]>>10;
+      dst[i]=(sample>32767)?32767:(sample<-32768)?-32768:sample;
+    }
+    dst+=c;
+    framec-=c;
+  }
+}
+
 /* MIDI noteid to 22050-based frequency, normalized to 32 bits.
  */
  
@@ -134,55 +239,135 @@ static uint32_t noterates22050[128]={
   3078403812u,3261455229u,
 };
 
-/* Get available voice or pick one to overwrite.
+/* Voice heaps.
+ * Positions are absolute in (heapv), and each pool's root is at its base.
  */
  
-static struct synth_voice *synth_get_available_voice(struct synth *synth) {
-  while (synth->voicec&&!synth->voicev[synth->voicec-1].ttl) synth->voicec--;
-  if (synth->voicec<SYNTH_VOICE_LIMIT) return synth->voicev+synth->voicec++;
-  struct synth_voice *best=0;
-  struct synth_voice *voice=synth->voicev;
-  uint8_t i=synth->voicec;
-  for (;i-->0;voice++) {
-    if (!voice->ttl) return voice;
-    if (!best) best=voice;
-    else if (voice->ttl<best->ttl) best=voice;
+static void synth_heap_swap(struct synth *synth,uint8_t a,uint8_t b) {
+  uint8_t va=synth->heapv[a],vb=synth->heapv[b];
+  synth->heapv[a]=vb;
+  synth->voicev[vb].heapp=a;
+  synth->heapv[b]=va;
+  synth->voicev[va].heapp=b;
+}
+
+static void synth_heap_up(struct synth *synth,uint8_t base,uint8_t p) {
+  while (p>base) {
+    uint8_t parent=base+((p-base-1)>>1);
+    if (synth->voicev[synth->heapv[parent]].ttl<=synth->voicev[synth->heapv[p]].ttl) return;
+    synth_heap_swap(synth,parent,p);
+    p=parent;
   }
-  return best;
 }
 
-/* Play notes, user supplies the wave.
+static void synth_heap_down(struct synth *synth,uint8_t base,uint8_t c,uint8_t p) {
+  for (;;) {
+    uint8_t childi=((p-base)<<1)+1;
+    if (childi>=c) return;
+    uint8_t child=base+childi;
+    if ((childi+1<c)&&(synth->voicev[synth->heapv[child+1]].ttl<synth->voicev[synth->heapv[child]].ttl)) child++;
+    if (synth->voicev[synth->heapv[p]].ttl<=synth->voicev[synth->heapv[child]].ttl) return;
+    synth_heap_swap(synth,p,child);
+    p=child;
+  }
+}
+
+/* Drop (voice) from the note index, if it's there.
  */
  
-struct synth_voice *synth_begin_note(struct synth *synth,const int16_t *wave,uint8_t noteid) {
-  if (!wave) return 0;
-  struct synth_voice *voice=synth_get_available_voice(synth);
-  voice->v=wave;
-  voice->p=0;
-  voice->pd=noterates22050[noteid&0x7f];
-  voice->ttl=UINT32_MAX;
+static void synth_forget_note(struct synth *synth,struct synth_voice *voice) {
+  #if SYNTH_NOTE_INDEX
+    if (voice->waveid<SYNTH_WAVE_COUNT) {
+      uint8_t *entry=&synth->notevoice[voice->waveid][voice->noteid&0x7f];
+      if (*entry==voice-synth->voicev+1) *entry=0;
+    }
+  #endif
   voice->waveid=voice->noteid=0xff;
+}
+
+/* Get available voice or pick one to overwrite, and set its (ttl).
+ * A never-used slot if there is one, otherwise the heap's top: Free, or the nearest to done.
+ */
+ 
+static struct synth_voice *synth_get_available_voice(struct synth *synth,uint8_t poolid,uint32_t ttl) {
+  uint8_t base=synth_pool_base[poolid];
+  uint8_t c=synth->heapc[poolid];
+  struct synth_voice *voice;
+  if (base+c<synth_pool_limit[poolid]) {
+    uint8_t p=base+c;
+    synth->heapc[poolid]++;
+    voice=synth->voicev+p;
+    synth->heapv[p]=p;
+    voice->heapp=p;
+    voice->ttl=ttl;
+    synth_heap_up(synth,base,p);
+  } else {
+    voice=synth->voicev+synth->heapv[base];
+    synth_forget_note(synth,voice);
+    voice->ttl=ttl;
+    synth_heap_down(synth,base,c,base);
+  }
   return voice;
 }
 
-struct synth_voice *synth_fireforget_note(struct synth *synth,const int16_t *wave,uint8_t noteid,uint32_t durframes) {
-  if (!wave) return 0;
-  struct synth_voice *voice=synth_get_available_voice(synth);
+static struct synth_voice *synth_start_voice(struct synth *synth,uint8_t poolid,const int16_t *wave,uint8_t noteid,uint32_t ttl) {
+  struct synth_voice *voice=synth_get_available_voice(synth,poolid,ttl);
   voice->v=wave;
   voice->p=0;
   voice->pd=noterates22050[noteid&0x7f];
-  voice->ttl=durframes;
   voice->waveid=voice->noteid=0xff;
   return voice;
 }
+
+/* Play notes, user supplies the wave.
+ */
+ 
+struct synth_voice *synth_begin_note(struct synth *synth,const int16_t *wave,uint8_t noteid) {
+  if (!wave) return 0;
+  return synth_start_voice(synth,SYNTH_POOL_MUSIC,wave,noteid,UINT32_MAX);
+}
+
+struct synth_voice *synth_fireforget_note(struct synth *synth,const int16_t *wave,uint8_t noteid,uint32_t durframes) {
+  if (!wave) return 0;
+  return synth_start_voice(synth,SYNTH_POOL_MUSIC,wave,noteid,durframes);
+}
  
 void synth_end_note(struct synth *synth,struct synth_voice *voice) {
   if (voice<synth->voicev) return;
   if (voice>=synth->voicev+SYNTH_VOICE_LIMIT) return;
+  synth_forget_note(synth,voice);
   if (voice->ttl>SYNTH_RELEASE_TIME) {
     voice->ttl=SYNTH_RELEASE_TIME;
+    uint8_t poolid=(voice>=synth->voicev+SYNTH_MUSIC_VOICE_LIMIT)?SYNTH_POOL_SFX:SYNTH_POOL_MUSIC;
+    synth_heap_up(synth,synth_pool_base[poolid],voice->heapp);
   }
-  voice->waveid=voice->noteid=0xff;
+}
+
+/* Sound effect.
+ */
+ 
+void synth_sfx(struct synth *synth,uint8_t waveid,uint8_t noteid,uint32_t durframes) {
+  if (waveid>=SYNTH_WAVE_COUNT) return;
+  if (!synth->wavev[waveid]) return;
+  uint8_t head=synth->sfxhead;
+  if ((uint8_t)(head-__atomic_load_n(&synth->sfxtail,__ATOMIC_ACQUIRE))>=SYNTH_SFX_QUEUE_SIZE) return;
+  struct synth_sfx_request *request=synth->sfxq+(head&(SYNTH_SFX_QUEUE_SIZE-1));
+  request->waveid=waveid;
+  request->noteid=noteid;
+  request->durframes=durframes;
+  __atomic_store_n(&synth->sfxhead,head+1,__ATOMIC_RELEASE);
+}
+
+// On the audio side, start whatever synth_sfx() has queued.
+static void synth_start_queued_sfx(struct synth *synth) {
+  uint8_t head=__atomic_load_n(&synth->sfxhead,__ATOMIC_ACQUIRE);
+  uint8_t tail=synth->sfxtail;
+  if (tail==head) return;
+  for (;tail!=head;tail++) {
+    const struct synth_sfx_request *request=synth->sfxq+(tail&(SYNTH_SFX_QUEUE_SIZE-1));
+    synth_start_voice(synth,SYNTH_POOL_SFX,synth->wavev[request->waveid],request->noteid,request->durframes);
+  }
+  __atomic_store_n(&synth->sfxtail,tail,__ATOMIC_RELEASE);
 }
 
 /* Play notes, close to encoded format.
@@ -190,42 +375,211 @@ void synth_end_note(struct synth *synth,struct synth_voice *voice) {
  
 void synth_note_fireforget(struct synth *synth,uint8_t waveid,uint8_t noteid,uint8_t durticks) {
   if (waveid>=SYNTH_WAVE_COUNT) return;
-  struct synth_voice *voice=synth_fireforget_note(synth,synth->wavev[waveid],noteid,durticks*SYNTH_FRAMES_PER_TICK);
+  synth_fireforget_note(synth,synth->wavev[waveid],noteid,durticks*SYNTH_FRAMES_PER_TICK);
+}
+
+/* Find the voice holding a NOTE_ON, or null.
+ * The index can point at a voice that's moved on to something else; it only counts if the voice agrees.
+ */
+ 
+static struct synth_voice *synth_find_note(struct synth *synth,uint8_t waveid,uint8_t noteid) {
+  #if SYNTH_NOTE_INDEX
+    uint8_t p=synth->notevoice[waveid&(SYNTH_WAVE_COUNT-1)][noteid&0x7f];
+    if (!p) return 0;
+    struct synth_voice *voice=synth->voicev+p-1;
+    if ((voice->waveid!=waveid)||(voice->noteid!=noteid)) return 0;
+    return voice;
+  #else
+    struct synth_voice *voice=synth->voicev;
+    uint8_t i=synth->heapc[SYNTH_POOL_MUSIC];
+    for (;i-->0;voice++) {
+      if (voice->waveid!=waveid) continue;
+      if (voice->noteid!=noteid) continue;
+      return voice;
+    }
+    return 0;
+  #endif
 }
 
 void synth_note_on(struct synth *synth,uint8_t waveid,uint8_t noteid) {
   if (waveid>=SYNTH_WAVE_COUNT) return;
-  struct synth_voice *voice=synth_begin_note(synth,synth->wavev[waveid],noteid);
-  if (!voice) return;
+  struct synth_voice *voice=synth_find_note(synth,waveid,noteid);
+  if (voice) synth_end_note(synth,voice); // restrike; don't leave the old one hanging
+  if (!(voice=synth_begin_note(synth,synth->wavev[waveid],noteid))) return;
   voice->waveid=waveid;
   voice->noteid=noteid;
+  #if SYNTH_NOTE_INDEX
+    synth->notevoice[waveid][noteid&0x7f]=voice-synth->voicev+1;
+  #endif
 }
 
 void synth_note_off(struct synth *synth,uint8_t waveid,uint8_t noteid) {
-  struct synth_voice *voice=synth->voicev;
-  uint8_t i=synth->voicec;
-  for (;i-->0;voice++) {
-    if (voice->waveid!=waveid) continue;
-    if (voice->noteid!=noteid) continue;
-    synth_end_note(synth,voice);
-    return;
-  }
+  struct synth_voice *voice=synth_find_note(synth,waveid,noteid);
+  if (voice) synth_end_note(synth,voice);
 }
 
 /* Two flavors of "shut up".
  */
  
 void synth_release_all(struct synth *synth) {
+  // Clamping every (ttl) the same way keeps the heap in order.
   struct synth_voice *voice=synth->voicev;
-  uint8_t i=synth->voicec;
+  uint8_t i=synth->heapc[SYNTH_POOL_MUSIC];
   for (;i-->0;voice++) {
     if (voice->ttl>SYNTH_RELEASE_TIME) {
       voice->ttl=SYNTH_RELEASE_TIME;
     }
-    voice->waveid=voice->noteid=0xff;
+    synth_forget_note(synth,voice);
   }
 }
 
 void synth_silence_all(struct synth *synth) {
-  synth->voicec=0;
+  synth->heapc[SYNTH_POOL_MUSIC]=0;
+  synth->heapc[SYNTH_POOL_SFX]=0;
+  #if SYNTH_NOTE_INDEX
+    memset(synth->notevoice,0,sizeof(synth->notevoice));
+  #endif
+}
+
+/* Song with header.
+ */
+ 
+#define SYNTH_RD16(p) ((p)[0]|((p)[1]<<8))
+#define SYNTH_RD32(p) ((p)[0]|((p)[1]<<8)|((p)[2]<<16)|((uint32_t)(p)[3]<<24))
+ 
+int synth_play_song(struct synth *synth,const void *src,int srcc) {
+  const uint8_t *SRC=src;
+  if (!SRC||(srcc<8)) return -1;
+  int addlc=SYNTH_RD16(SRC+2);
+  int eventc=SYNTH_RD16(SRC+4);
+  if (8+addlc>srcc-eventc) return -1;
+  synth->seekv=0;
+  synth->seekc=0;
+  synth->seekinterval=0;
+  synth->songticks=0;
+  if (addlc>=8) {
+    const uint8_t *table=SRC+8;
+    int seekc=SYNTH_RD16(table+2);
+    if (8+seekc*SYNTH_SEEK_ENTRY_SIZE<=addlc) {
+      synth->seekinterval=SYNTH_RD16(table);
+      synth->songticks=SYNTH_RD32(table+4);
+      if (synth->seekinterval&&seekc) {
+        synth->seekv=table+8;
+        synth->seekc=seekc;
+      }
+    }
+  }
+  synth->song=SRC+8+addlc;
+  synth->songc=eventc;
+  synth->songp=0;
+  synth->songdelay=0;
+  synth->songtime=0;
+  return 0;
+}
+
+/* Seek.
+ */
+ 
+void synth_seek(struct synth *synth,uint32_t tick) {
+  if (!synth->song) return;
+  if (synth->songticks) tick%=synth->songticks;
+  
+  // Drop the music voices.
+  synth->heapc[SYNTH_POOL_MUSIC]=0;
+  #if SYNTH_NOTE_INDEX
+    memset(synth->notevoice,0,sizeof(synth->notevoice));
+  #endif
+  
+  // Start from the nearest checkpoint, or the top.
+  // We track what should be playing without sounding anything, until we arrive.
+  struct synth_seek_note {
+    uint8_t waveid,noteid;
+    uint32_t endtick; // UINT32_MAX if held
+  } notev[SYNTH_MUSIC_VOICE_LIMIT];
+  uint8_t notec=0;
+  uint32_t now=0;
+  uint16_t p=0;
+  if (synth->seekv) {
+    uint32_t i=tick/synth->seekinterval;
+    if (i>=synth->seekc) i=synth->seekc-1;
+    const uint8_t *entry=synth->seekv+i*SYNTH_SEEK_ENTRY_SIZE;
+    now=SYNTH_RD32(entry);
+    p=SYNTH_RD16(entry+4);
+    uint8_t holdc=entry[6];
+    if (holdc>SYNTH_SEEK_HOLD_LIMIT) holdc=SYNTH_SEEK_HOLD_LIMIT;
+    const uint8_t *hold=entry+8;
+    for (;holdc-->0;hold+=2) {
+      if (notec>=SYNTH_MUSIC_VOICE_LIMIT) break;
+      notev[notec].waveid=hold[0];
+      notev[notec].noteid=hold[1];
+      notev[notec].endtick=UINT32_MAX;
+      notec++;
+    }
+    if ((now>tick)||(p>synth->songc)) { // shouldn't happen; trust nothing
+      now=0;
+      p=0;
+      notec=0;
+    }
+  }
+  
+  synth->songdelay=0;
+  while (p<synth->songc) {
+    uint8_t lead=synth->song[p];
+    if (!(lead&0x80)) {
+      p++;
+      if (now+lead>tick) {
+        synth->songdelay=(now+lead-tick)*SYNTH_FRAMES_PER_TICK;
+        break;
+      }
+      now+=lead;
+      continue;
+    }
+    if (p>synth->songc-2) break;
+    uint8_t waveid=lead&0x07,noteid=synth->song[p+1]&0x7f;
+    switch (lead&0xf8) {
+      case 0x80: {
+          if (p>synth->songc-3) { p=synth->songc; break; }
+          uint32_t endtick=now+synth->song[p+2];
+          if ((endtick>tick)&&(notec<SYNTH_MUSIC_VOICE_LIMIT)) {
+            notev[notec].waveid=waveid;
+            notev[notec].noteid=noteid;
+            notev[notec].endtick=endtick;
+            notec++;
+          }
+          p+=3;
+        } break;
+      case 0xe0: {
+          if (notec<SYNTH_MUSIC_VOICE_LIMIT) {
+            notev[notec].waveid=waveid;
+            notev[notec].noteid=noteid;
+            notev[notec].endtick=UINT32_MAX;
+            notec++;
+          }
+          p+=2;
+        } break;
+      case 0xc0: {
+          uint8_t i=notec;
+          while (i-->0) {
+            if ((notev[i].waveid!=waveid)||(notev[i].noteid!=noteid)||(notev[i].endtick!=UINT32_MAX)) continue;
+            notev[i]=notev[--notec];
+            break;
+          }
+          p+=2;
+        } break;
+      default: p=synth->songc; break; // let synth_consume_song() complain about it
+    }
+  }
+  synth->songp=p;
+  synth->songtime=tick*SYNTH_FRAMES_PER_TICK;
+  
+  // Sound what's left.
+  const struct synth_seek_note *note=notev;
+  for (;notec-->0;note++) {
+    if (note->endtick==UINT32_MAX) {
+      synth_note_on(synth,note->waveid,note->noteid);
+    } else {
+      uint32_t ticks=note->endtick-tick;
+      synth_note_fireforget(synth,note->waveid,note->noteid,(ticks>0xff)?0xff:ticks);
+    }
+  }
 }
@@ -6,7 +6,31 @@
 
 #include <stdint.h>
 
-#define SYNTH_VOICE_LIMIT 8
+/* Override per build with -D. Up to 63: Mixing sums every voice at 10 bits above full scale in an int32_t.
+ * Sound effects get their own voices at the end, so music can't starve them, and the song gets the rest.
+ * 8 music voices is the floor, that's what mksong lets a song hold.
+ */
+#ifndef SYNTH_VOICE_LIMIT
+  #if PO_NATIVE
+    #define SYNTH_VOICE_LIMIT 32
+  #else
+    #define SYNTH_VOICE_LIMIT 10
+  #endif
+#endif
+#if SYNTH_VOICE_LIMIT>63
+  #error "SYNTH_VOICE_LIMIT over 63 could overflow the mix."
+#endif
+#ifndef SYNTH_SFX_VOICE_LIMIT
+  #define SYNTH_SFX_VOICE_LIMIT (SYNTH_VOICE_LIMIT/4)
+#endif
+#define SYNTH_MUSIC_VOICE_LIMIT (SYNTH_VOICE_LIMIT-SYNTH_SFX_VOICE_LIMIT)
+#define SYNTH_SFX_QUEUE_SIZE 8 /* must be a power of two */
+
+// Index held notes by (waveid,noteid), so NOTE_OFF doesn't scan. 1 kB, so not on the Tiny.
+#ifndef SYNTH_NOTE_INDEX
+  #define SYNTH_NOTE_INDEX PO_NATIVE
+#endif
+
 #define SYNTH_WAVE_COUNT 8
 #define SYNTH_TICKS_PER_SECOND 96 /* approximately */
 #define SYNTH_FRAMES_PER_TICK 230 /* yields 95.87 hz with main rate 22050 */
@@ -20,8 +44,30 @@ struct synth {
     uint32_t pd;
     uint32_t ttl;
     uint8_t waveid,noteid; // for identification
-  } voicev[SYNTH_VOICE_LIMIT];
-  uint8_t voicec;
+    uint8_t heapp; // my position in (heapv)
+  } voicev[SYNTH_VOICE_LIMIT]; // music, then sound effects
+  
+  /* Each pool keeps a min-heap on (ttl) of the voices it has used, in (heapv) at the same offset as its voices.
+   * Slots get used in order, so the next never-used one is right at (base+heapc).
+   * Once they're all used, the top of the heap is the one to take: Either finished, or the nearest to finishing.
+   * Mixing decrements every (ttl) alike, and zero stays lowest, so that never disturbs the order.
+   */
+  uint8_t heapv[SYNTH_VOICE_LIMIT];
+  uint8_t heapc[2]; // music,sfx
+  #if SYNTH_NOTE_INDEX
+    uint8_t notevoice[SYNTH_WAVE_COUNT][128]; // voicev index+1 of NOTE_ON, or zero
+  #endif
+  
+  /* Sound effects wait here until the next synth_update() or synth_render_block() starts them.
+   * The game asks from its main loop, but on the Tiny the synth runs in an interrupt, which must be the only one touching the voices.
+   * Each side owns one index and only reads the other's.
+   */
+  struct synth_sfx_request {
+    uint8_t waveid,noteid;
+    uint32_t durframes;
+  } sfxq[SYNTH_SFX_QUEUE_SIZE];
+  uint8_t sfxhead; // requests made; synth_sfx() writes
+  uint8_t sfxtail; // requests started; the audio side writes
   
   // Owner should populate directly.
   const int16_t *wavev[SYNTH_WAVE_COUNT];
@@ -32,23 +78,71 @@ struct synth {
   uint16_t songp;
   uint32_t songdelay;
   uint32_t songtime; // frames since start
+  
+  // From the song's seek table, see synth_play_song(). Null (seekv) if it doesn't have one.
+  const uint8_t *seekv;
+  uint16_t seekc;
+  uint16_t seekinterval; // ticks
+  uint32_t songticks; // length of one pass, or zero if unknown
 };
 
+/* Begin playing a song as mksong writes it:
+ *   u16 Ticks per beat.
+ *   u16 Additional header length. If at least 8, it's a seek table:
+ *         u16 Interval, ticks.
+ *         u16 Checkpoint count.
+ *         u32 Length of one pass, ticks.
+ *         ... Checkpoints, SYNTH_SEEK_ENTRY_SIZE each. Checkpoint (n) is the last point in the song at or before tick (n*interval):
+ *               u32 Tick.
+ *               u16 Offset in events.
+ *               u8  Count of held notes.
+ *               u8  Reserved.
+ *               ... SYNTH_SEEK_HOLD_LIMIT of (u8 waveid,u8 noteid), notes held at this point.
+ *   u16 Events length.
+ *   u16 Fakesheet length.
+ *   ... Additional header.
+ *   ... Events, the format synth_consume_song() reads.
+ *   ... Fakesheet, which we don't use.
+ * All little-endian.
+ * Does not touch the voices. Fails if malformed.
+ */
+#define SYNTH_SEEK_HOLD_LIMIT 8
+#define SYNTH_SEEK_ENTRY_SIZE (8+SYNTH_SEEK_HOLD_LIMIT*2)
+int synth_play_song(struct synth *synth,const void *src,int srcc);
+
+/* Jump to (tick) in the current song, wrapping if we know its length.
+ * Stops the music voices, starts whatever should be held at (tick), and resumes from there.
+ * With a seek table, we only walk events from the nearest checkpoint, at most one interval.
+ * Without, we walk from the start.
+ * Sound effects are not disturbed.
+ */
+void synth_seek(struct synth *synth,uint32_t tick);
+
 int16_t synth_update(struct synth *synth);
 
+/* Same as (framec) calls to synth_update(), but much cheaper per sample.
+ * Song events are processed only where they fall, and each voice mixes a whole run at once.
+ */
+void synth_render_block(struct synth *synth,int16_t *dst,int framec);
+
 /* Loose note commands, caller supplies a 512-sample wave.
  */
 struct synth_voice *synth_begin_note(struct synth *synth,const int16_t *wave,uint8_t noteid);
 void synth_end_note(struct synth *synth,struct synth_voice *voice);
 struct synth_voice *synth_fireforget_note(struct synth *synth,const int16_t *wave,uint8_t noteid,uint32_t durframes);
 
+/* Sound effect, on the voices reserved for them. Doesn't stop when the song loops.
+ * Safe to call while another context is running synth_update(): It only queues the request, and drops it if the queue is full.
+ */
+void synth_sfx(struct synth *synth,uint8_t waveid,uint8_t noteid,uint32_t durframes);
+
 /* Note commands matching our serial song format.
  */
 void synth_note_fireforget(struct synth *synth,uint8_t waveid,uint8_t noteid,uint8_t durticks);
 void synth_note_on(struct synth *synth,uint8_t waveid,uint8_t noteid);
 void synth_note_off(struct synth *synth,uint8_t waveid,uint8_t noteid);
 
-void synth_release_all(struct synth *synth);
+void synth_release_all(struct synth *synth); // music only
 void synth_silence_all(struct synth *synth);
 
 #endif
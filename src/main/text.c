@@ -0,0 +1,153 @@
+#include "text.h"
+#include "data.h"
+#include "damage.h"
+#include <string.h>
+
+#define TEXT_CACHE_SIZE 8
+#define TEXT_LIMIT 24 /* bytes of source text */
+#define TEXT_RUN_LIMIT 48
+
+struct text_run {
+  uint8_t x,y,w;
+};
+
+/* Globals.
+ * Each game instance keeps its own cache; headless runs several at once.
+ */
+
+static GAME_LOCAL struct text_entry {
+  char src[TEXT_LIMIT];
+  uint8_t srcc; // zero if unused
+  uint8_t advance;
+  uint8_t runc;
+  uint8_t x,y,w,h; // bounds of the ON pixels, for damage
+  uint32_t lastuse;
+  struct text_run runv[TEXT_RUN_LIMIT];
+} text_entryv[TEXT_CACHE_SIZE];
+
+static GAME_LOCAL uint32_t text_clock=0;
+
+/* Rasterize into an entry.
+ * Fails if it produces too many runs or doesn't fit in 8 bits horizontally; entry is garbage in that case.
+ */
+ 
+static int text_rasterize(struct text_entry *entry,const char *src,uint8_t srcc) {
+  entry->runc=0;
+  uint8_t left=0xff,right=0,top=0xff,bottom=0;
+  uint16_t x=0;
+  uint8_t row=0;
+  for (;row<8;row++) {
+    const char *p=src;
+    uint8_t i=srcc;
+    x=0;
+    for (;i-->0;p++) {
+      if ((*p<0x20)||(*p>0x7e)) continue;
+      uint32_t glyph=font[(*p)-0x20];
+      if (!glyph) { x+=4; continue; }
+      uint8_t w=(glyph>>27)&7;
+      if (!w) continue;
+      uint8_t bits=font_rows[(((*p)-0x20)<<3)+row];
+      uint8_t col=0;
+      for (;bits;bits<<=1,col++) {
+        if (!(bits&0x80)) continue;
+        uint16_t px=x+col;
+        if (px>0xff) return -1;
+        struct text_run *run=entry->runv+entry->runc-1;
+        if (entry->runc&&(run->y==row)&&(run->x+run->w==px)) {
+          run->w++;
+        } else {
+          if (entry->runc>=TEXT_RUN_LIMIT) return -1;
+          run=entry->runv+entry->runc++;
+          run->x=px;
+          run->y=row;
+          run->w=1;
+        }
+        if (px<left) left=px;
+        if (px>=right) right=px+1;
+        if (row<top) top=row;
+        if (row>=bottom) bottom=row+1;
+      }
+      x+=w+1;
+    }
+  }
+  if (x>0xff) return -1;
+  entry->advance=x;
+  if (entry->runc) {
+    entry->x=left;
+    entry->y=top;
+    entry->w=right-left;
+    entry->h=bottom-top;
+  } else {
+    entry->x=entry->y=entry->w=entry->h=0;
+  }
+  return 0;
+}
+
+/* Find or create an entry. Null if it can't be cached.
+ */
+ 
+static struct text_entry *text_entry_get(const char *src,uint8_t srcc) {
+  struct text_entry *entry=text_entryv,*oldest=text_entryv;
+  uint8_t i=TEXT_CACHE_SIZE;
+  for (;i-->0;entry++) {
+    if (entry->srcc==srcc) {
+      if (!memcmp(entry->src,src,srcc)) {
+        entry->lastuse=++text_clock;
+        return entry;
+      }
+    }
+    if (!entry->srcc) oldest=entry;
+    else if (oldest->srcc&&(entry->lastuse<oldest->lastuse)) oldest=entry;
+  }
+  if (srcc>TEXT_LIMIT) return 0;
+  entry=oldest;
+  if (text_rasterize(entry,src,srcc)<0) {
+    entry->srcc=0;
+    return 0;
+  }
+  memcpy(entry->src,src,srcc);
+  entry->srcc=srcc;
+  entry->lastuse=++text_clock;
+  return entry;
+}
+
+/* Blit.
+ */
+ 
+uint16_t text_blit(struct image *dst,int16_t dstx,int16_t dsty,const char *src,int8_t srcc,uint16_t color) {
+  if (!src) return 0;
+  if (srcc<0) { srcc=0; while (src[srcc]) srcc++; }
+  if (!srcc) return 0;
+  const struct text_entry *entry=text_entry_get(src,srcc);
+  if (!entry) return image_blit_string(dst,dstx,dsty,src,srcc,color,font);
+  if (!entry->runc) return entry->advance;
+  DAMAGE_NOTE(dst,dstx+entry->x,dsty+entry->y,entry->w,entry->h)
+  
+  // Whole thing in bounds is the usual case, and then runs don't need clipping.
+  const struct text_run *run=entry->runv;
+  uint8_t i=entry->runc;
+  if (
+    (dstx+entry->x>=0)&&(dsty+entry->y>=0)&&
+    (dstx+entry->x+entry->w<=dst->w)&&(dsty+entry->y+entry->h<=dst->h)
+  ) {
+    uint16_t *origin=dst->v+dsty*dst->stride+dstx;
+    for (;i-->0;run++) {
+      uint16_t *p=origin+run->y*dst->stride+run->x;
+      uint8_t xi=run->w;
+      for (;xi-->0;p++) *p=color;
+    }
+  } else {
+    for (;i-->0;run++) {
+      int16_t y=dsty+run->y;
+      if ((y<0)||(y>=dst->h)) continue;
+      int16_t x=dstx+run->x;
+      int16_t w=run->w;
+      if (x<0) { w+=x; x=0; }
+      if (x>dst->w-w) w=dst->w-x;
+      if (w<1) continue;
+      uint16_t *p=dst->v+y*dst->stride+x;
+      for (;w-->0;p++) *p=color;
+    }
+  }
+  return entry->advance;
+}
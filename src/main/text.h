@@ -0,0 +1,20 @@
+/* text.h
+ * Cached string rendering with the embedded font.
+ * The first draw of a string rasterizes it from font_rows into horizontal runs of ON pixels,
+ * and later draws of the same string only fill those runs.
+ * Runs don't carry a color, so one entry serves the same text in any color.
+ * Output is identical to image_blit_string() with (font).
+ */
+ 
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdint.h>
+#include "platform.h"
+
+/* Same contract as image_blit_string(): (srcc<0) for NUL-terminated, returns horizontal advance.
+ * Strings too long or too busy for the cache draw straight from the atlas instead.
+ */
+uint16_t text_blit(struct image *dst,int16_t dstx,int16_t dsty,const char *src,int8_t srcc,uint16_t color);
+
+#endif
@@ -16,12 +16,12 @@
  */
 
 // There won't be many tasks so I won't bother sorting them.
-static struct task {
+static GAME_LOCAL struct task {
   uint8_t id;
   uint32_t time; // trigger when game clock goes below this (video frames)
 } taskv[TASK_LIMIT];
-uint8_t taskc=0;
-static uint8_t tasktimer;
+GAME_LOCAL uint8_t taskc=0;
+static GAME_LOCAL uint8_t tasktimer;
   
 
 /* Init.
@@ -35,12 +35,12 @@ void timed_tasks_init() {
   // Don't make a task in the last quarter of time, because it might be impossible to complete before expiration.
   uint32_t quarterlen=GAME_DURATION_FRAMES/4;
   taskc=3;
-  taskv[0].time=quarterlen*3+rand()%quarterlen;
-  taskv[1].time=quarterlen*2+rand()%quarterlen;
-  taskv[2].time=quarterlen*1+rand()%quarterlen;
+  taskv[0].time=quarterlen*3+game_rand()%quarterlen;
+  taskv[1].time=quarterlen*2+game_rand()%quarterlen;
+  taskv[2].time=quarterlen*1+game_rand()%quarterlen;
   
   // Since there's only 6 possible orders, don't bother generalizing.
-  switch (rand()%6) {
+  switch (game_rand()%6) {
     case 0: taskv[0].id=TASK_ID_BRICK2; taskv[1].id=TASK_ID_BRICK3; taskv[2].id=TASK_ID_BARREL; break;
     case 1: taskv[0].id=TASK_ID_BRICK2; taskv[1].id=TASK_ID_BARREL; taskv[2].id=TASK_ID_BRICK3; break;
     case 2: taskv[0].id=TASK_ID_BRICK3; taskv[1].id=TASK_ID_BRICK2; taskv[2].id=TASK_ID_BARREL; break;
@@ -56,11 +56,12 @@ void timed_tasks_init() {
  
 static uint8_t truck_available() {
   
-  const uint8_t *v=grid+WORLD_W_TILES*14+12;
-  if (v[0]||v[1]||v[2]) return 0;
+  if (GRID_TILE(TRUCK_BED_COL,TRUCK_BED_ROW)) return 0;
+  if (GRID_TILE(TRUCK_BED_COL+1,TRUCK_BED_ROW)) return 0;
+  if (GRID_TILE(TRUCK_BED_COL+2,TRUCK_BED_ROW)) return 0;
   
-  int16_t left=TILE_W_MM*10;
-  int16_t right=TILE_W_MM*15;
+  coord_t left=TILE_W_MM*10;
+  coord_t right=TILE_W_MM*15;
   if (camera.x>=right) return 1;
   if (camera.x+camera.w<=left) return 1;
   return 0;
@@ -75,20 +76,20 @@ static uint8_t execute_task(uint8_t taskid) {
     
     case TASK_ID_BRICK2: {
         if (!truck_available()) return 0;
-        grid[WORLD_W_TILES*14+12]=0x10;
-        grid[WORLD_W_TILES*14+13]=0x10;
+        grid_set(TRUCK_BED_COL,TRUCK_BED_ROW,0x10);
+        grid_set(TRUCK_BED_COL+1,TRUCK_BED_ROW,0x10);
       } return 1;
     
     case TASK_ID_BRICK3: {
         if (!truck_available()) return 0;
-        grid[WORLD_W_TILES*14+12]=0x10;
-        grid[WORLD_W_TILES*14+13]=0x10;
-        grid[WORLD_W_TILES*14+14]=0x10;
+        grid_set(TRUCK_BED_COL,TRUCK_BED_ROW,0x10);
+        grid_set(TRUCK_BED_COL+1,TRUCK_BED_ROW,0x10);
+        grid_set(TRUCK_BED_COL+2,TRUCK_BED_ROW,0x10);
       } return 1;
     
     case TASK_ID_BARREL: {
         if (!truck_available()) return 0;
-        grid[WORLD_W_TILES*14+13]=0x11;
+        grid_set(TRUCK_BED_COL+1,TRUCK_BED_ROW,0x11);
       } return 1;
     
   }
@@ -116,3 +117,21 @@ void timed_tasks_update() {
     }
   }
 }
+
+/* Snapshot state.
+ */
+ 
+int timed_tasks_get_state(void *dst) {
+  uint8_t *DST=dst;
+  DST[0]=taskc;
+  DST[1]=tasktimer;
+  memcpy(DST+2,taskv,sizeof(taskv));
+  return 2+sizeof(taskv);
+}
+
+void timed_tasks_set_state(const void *src) {
+  const uint8_t *SRC=src;
+  taskc=SRC[0];
+  tasktimer=SRC[1];
+  memcpy(taskv,SRC+2,sizeof(taskv));
+}
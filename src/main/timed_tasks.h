@@ -7,10 +7,18 @@
 #define TIMED_TASKS_H
 
 #include <stdint.h>
+#include "platform.h"
 
-extern uint8_t taskc;
+extern GAME_LOCAL uint8_t taskc;
 
 void timed_tasks_init();
 void timed_tasks_update();
 
+/* Opaque copy of our state, for snapshots.
+ * Get returns the length written, always <=TIMED_TASKS_STATE_SIZE.
+ */
+#define TIMED_TASKS_STATE_SIZE 64
+int timed_tasks_get_state(void *dst);
+void timed_tasks_set_state(const void *src);
+
 #endif
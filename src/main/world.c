@@ -8,53 +8,396 @@
 /* Globals.
  */
  
-uint8_t grid[WORLD_W_TILES*WORLD_H_TILES]={0};
-struct sprite spritev[SPRITE_LIMIT]={0};
-struct camera camera={0};
+GAME_LOCAL int16_t world_w_tiles=WORLD_W_TILES_DEFAULT;
+GAME_LOCAL int16_t world_h_tiles=WORLD_H_TILES_DEFAULT;
+GAME_LOCAL int16_t grid_chunkw=GRID_CHUNKS_W(WORLD_W_TILES_DEFAULT);
+GAME_LOCAL int16_t grid_chunkh=GRID_CHUNKS_H(WORLD_H_TILES_DEFAULT);
 
-static uint16_t thumbnail_storage[THUMBNAIL_W*THUMBNAIL_H];
-struct image thumbnail={
-  .v=thumbnail_storage,
+GAME_LOCAL uint8_t grid[GRID_SIZE_LIMIT];
+GAME_LOCAL struct sprite spritev[SPRITE_LIMIT]={0};
+GAME_LOCAL struct sprite_pools spritepools={0};
+GAME_LOCAL struct camera camera={0};
+
+// (thumbnail.v) is set at draw time; a thread-local's address isn't a constant.
+static GAME_LOCAL uint16_t thumbnail_storage[THUMBNAIL_W*THUMBNAIL_H];
+GAME_LOCAL struct image thumbnail={
   .w=THUMBNAIL_W,
   .h=THUMBNAIL_H,
   .stride=THUMBNAIL_W,
 };
 
+#if WORLD_PIXEL_CACHE
+#define WORLD_PIXEL_BLOCK_W_PX (WORLD_PIXEL_BLOCK_W*TILE_W_PIXELS)
+#define WORLD_PIXEL_BLOCK_H_PX (WORLD_PIXEL_BLOCK_H*TILE_H_PIXELS)
+#define WORLD_PIXEL_BLOCKS_W(w) (((w)+WORLD_PIXEL_BLOCK_W-1)/WORLD_PIXEL_BLOCK_W)
+#define WORLD_PIXEL_BLOCKS_H(h) (((h)+WORLD_PIXEL_BLOCK_H-1)/WORLD_PIXEL_BLOCK_H)
+#define WORLD_PIXEL_BLOCK_LIMIT (WORLD_PIXEL_BLOCKS_W(WORLD_W_TILES_LIMIT)*WORLD_PIXEL_BLOCKS_H(WORLD_H_TILES_LIMIT))
+
+// Each slot's (v) is set when it's filled; a thread-local's address isn't a constant.
+static GAME_LOCAL uint16_t grid_pixels_storage[WORLD_PIXEL_CACHE_SLOTS][WORLD_PIXEL_BLOCK_W_PX*WORLD_PIXEL_BLOCK_H_PX];
+static GAME_LOCAL struct grid_pixels {
+  struct image slotv[WORLD_PIXEL_CACHE_SLOTS];
+  int16_t blockv[WORLD_PIXEL_CACHE_SLOTS]; // block each slot last held
+  uint32_t usev[WORLD_PIXEL_CACHE_SLOTS]; // (clock) at last use
+  uint8_t slotp[WORLD_PIXEL_BLOCK_LIMIT]; // 1+slot holding each block, or zero
+  int16_t blockw; // blocks per row, as of the last reset
+  uint32_t clock;
+} grid_pixels={0};
+#endif
+
+/* World size.
+ */
+ 
+void world_set_size(int16_t w,int16_t h) {
+  if (w<WORLD_W_TILES_DEFAULT) w=WORLD_W_TILES_DEFAULT;
+  else if (w>WORLD_W_TILES_LIMIT) w=WORLD_W_TILES_LIMIT;
+  if (h<WORLD_H_TILES_DEFAULT) h=WORLD_H_TILES_DEFAULT;
+  else if (h>WORLD_H_TILES_LIMIT) h=WORLD_H_TILES_LIMIT;
+  world_w_tiles=w;
+  world_h_tiles=h&~1;
+  grid_chunkw=GRID_CHUNKS_W(world_w_tiles);
+  grid_chunkh=GRID_CHUNKS_H(world_h_tiles);
+}
+
+/* Indexes over (grid), so rules and scoring don't have to scan it.
+ * grid_set() keeps them current; grid_reindex() rebuilds from scratch.
+ */
+
+#define BARREL_LIMIT 8
+
+// Row masks: Bit (1<<(x&63)) of word (x>>6) for column (x), one run of words per row.
+#define GRID_WORDC ((WORLD_W_TILES_LIMIT+63)>>6)
+
+static GAME_LOCAL struct grid_index {
+  uint64_t solidmask[WORLD_H_TILES_LIMIT][GRID_WORDC]; // tiles >=0x10
+  uint64_t dirtmask[WORLD_H_TILES_LIMIT][GRID_WORDC]; // tiles 0x20..0x2f
+  uint16_t rowocc[WORLD_H_TILES_LIMIT]; // nonzero tiles per row
+  uint16_t rowsolid[WORLD_H_TILES_LIMIT]; // tiles >=0x10 per row
+  uint16_t rowstatue[WORLD_H_TILES_LIMIT]; // statues (0x12) per row
+  int16_t coltop[WORLD_W_TILES_LIMIT]; // first solid row per column, or WORLD_H_TILES
+  uint16_t coldirt[WORLD_W_TILES_LIMIT]; // dirt tiles per column
+  int16_t topocc; // first row with any nonzero tile, or WORLD_H_TILES
+  int16_t topsolid; // first row with any solid tile, or WORLD_H_TILES
+  int16_t lowpartial; // last row not entirely solid, or -1
+  uint8_t truckc; // solid tiles on the truck bed
+  uint32_t barrelv[BARREL_LIMIT]; // grid index of each barrel (0x11)
+  uint8_t barrelc;
+  uint8_t barrel_overflow; // more barrels than we can track; violation_barrel() scans instead
+  uint32_t revision; // counts every change
+} gridx;
+
+static inline uint8_t grid_bit(const uint64_t *row,int16_t x) {
+  return (row[x>>6]>>(x&63))&1;
+}
+
+// Any bit set in columns (x..x+c-1), which must not cross the world's right edge.
+static uint8_t grid_row_any(const uint64_t *row,int16_t x,int16_t c) {
+  while (c>0) {
+    int16_t shift=x&63;
+    int16_t n=64-shift;
+    if (n>c) n=c;
+    uint64_t mask=((n==64)?~0ull:((1ull<<n)-1))<<shift;
+    if (row[x>>6]&mask) return 1;
+    x+=n;
+    c-=n;
+  }
+  return 0;
+}
+
+// (n) bits of a row starting at column (x), wrapping at the world's edge. (n) up to 64.
+static uint64_t grid_row_bits(const uint64_t *row,int16_t x,int16_t n) {
+  uint64_t bits=0;
+  int16_t got=0;
+  while (got<n) {
+    if (x>=WORLD_W_TILES) x-=WORLD_W_TILES;
+    int16_t shift=x&63;
+    int16_t take=64-shift;
+    if (take>n-got) take=n-got;
+    if (take>WORLD_W_TILES-x) take=WORLD_W_TILES-x;
+    bits|=((row[x>>6]>>shift)&((take==64)?~0ull:((1ull<<take)-1)))<<got;
+    got+=take;
+    x+=take;
+  }
+  return bits;
+}
+
+// Rotate a mask of (w) bits left by (n), 0..w-1.
+static inline uint64_t grid_rotl(uint64_t mask,int16_t n,int16_t w) {
+  if (!n) return mask;
+  uint64_t all=(w==64)?~0ull:((1ull<<w)-1);
+  return ((mask<<n)|(mask>>(w-n)))&all;
+}
+
+static inline uint8_t grid_tile_is_dirt(uint8_t tileid) {
+  return ((tileid&0xf0)==0x20);
+}
+
+static void grid_index_tile(int16_t x,int16_t y,uint8_t tile,int8_t d) {
+  if (!tile) return;
+  gridx.rowocc[y]+=d;
+  if (tile<0x10) return;
+  uint64_t bit=1ull<<(x&63);
+  if (d>0) gridx.solidmask[y][x>>6]|=bit;
+  else gridx.solidmask[y][x>>6]&=~bit;
+  if (grid_tile_is_dirt(tile)) {
+    if (d>0) gridx.dirtmask[y][x>>6]|=bit;
+    else gridx.dirtmask[y][x>>6]&=~bit;
+    gridx.coldirt[x]+=d;
+  }
+  if ((d>0)&&(y<gridx.coltop[x])) gridx.coltop[x]=y;
+  gridx.rowsolid[y]+=d;
+  if ((y==TRUCK_BED_ROW)&&(x>=TRUCK_BED_COL)&&(x<TRUCK_BED_COL+3)) gridx.truckc+=d;
+  if (tile==0x12) {
+    gridx.rowstatue[y]+=d;
+  } else if (tile==0x11) {
+    uint32_t p=y*WORLD_W_TILES+x;
+    if (d>0) {
+      if (gridx.barrelc<BARREL_LIMIT) gridx.barrelv[gridx.barrelc++]=p;
+      else gridx.barrel_overflow=1;
+    } else {
+      uint8_t i=gridx.barrelc;
+      while (i-->0) {
+        if (gridx.barrelv[i]==p) {
+          gridx.barrelv[i]=gridx.barrelv[--(gridx.barrelc)];
+          break;
+        }
+      }
+    }
+  }
+}
+
+// After changing counts for row (y), move the edges if needed.
+static void grid_index_row_changed(int16_t y) {
+  if (gridx.rowocc[y]) {
+    if (y<gridx.topocc) gridx.topocc=y;
+  } else if (y==gridx.topocc) {
+    while ((gridx.topocc<WORLD_H_TILES)&&!gridx.rowocc[gridx.topocc]) gridx.topocc++;
+  }
+  if (gridx.rowsolid[y]) {
+    if (y<gridx.topsolid) gridx.topsolid=y;
+  } else if (y==gridx.topsolid) {
+    while ((gridx.topsolid<WORLD_H_TILES)&&!gridx.rowsolid[gridx.topsolid]) gridx.topsolid++;
+  }
+  if (gridx.rowsolid[y]<WORLD_W_TILES) {
+    if (y>gridx.lowpartial) gridx.lowpartial=y;
+  } else if (y==gridx.lowpartial) {
+    while ((gridx.lowpartial>=0)&&(gridx.rowsolid[gridx.lowpartial]==WORLD_W_TILES)) gridx.lowpartial--;
+  }
+}
+
+// After removing a solid tile at (x,y), find the column's new top if that was it.
+static void grid_index_column_changed(int16_t x,int16_t y) {
+  if (y!=gridx.coltop[x]) return;
+  while ((y<WORLD_H_TILES)&&!grid_bit(gridx.solidmask[y],x)) y++;
+  gridx.coltop[x]=y;
+}
+
+// Redraw one tile of the pixel cache, if its block is cached.
+static inline void grid_pixels_draw_tile(int16_t x,int16_t y,uint8_t tile) {
+  #if WORLD_PIXEL_CACHE
+    uint8_t slotp=grid_pixels.slotp[((uint16_t)y/WORLD_PIXEL_BLOCK_H)*grid_pixels.blockw+(uint16_t)x/WORLD_PIXEL_BLOCK_W];
+    if (!slotp) return;
+    image_blit_opaque(
+      grid_pixels.slotv+slotp-1,((uint16_t)x%WORLD_PIXEL_BLOCK_W)*TILE_W_PIXELS,((uint16_t)y%WORLD_PIXEL_BLOCK_H)*TILE_H_PIXELS,
+      &bgtiles,(tile&0x0f)*TILE_W_PIXELS,(tile>>4)*TILE_H_PIXELS,
+      TILE_W_PIXELS,TILE_H_PIXELS
+    );
+  #endif
+}
+
+#if WORLD_PIXEL_CACHE
+
+// Forget every block, they'll draw again as the camera wants them.
+static void grid_pixels_reset() {
+  memset(grid_pixels.slotp,0,sizeof(grid_pixels.slotp));
+  grid_pixels.blockw=WORLD_PIXEL_BLOCKS_W(WORLD_W_TILES);
+}
+
+// The cached block containing tile (col,row), drawing it into the least recently used slot if needed.
+static const struct image *grid_pixels_block(uint16_t col,uint16_t row) {
+  int16_t block=(row/WORLD_PIXEL_BLOCK_H)*grid_pixels.blockw+col/WORLD_PIXEL_BLOCK_W;
+  uint32_t clock=++(grid_pixels.clock);
+  uint8_t p=grid_pixels.slotp[block];
+  if (p) {
+    grid_pixels.usev[p-1]=clock;
+    return grid_pixels.slotv+p-1;
+  }
+  uint8_t i=1;
+  for (;i<WORLD_PIXEL_CACHE_SLOTS;i++) {
+    if (clock-grid_pixels.usev[i]>clock-grid_pixels.usev[p]) p=i;
+  }
+  if (grid_pixels.slotp[grid_pixels.blockv[p]]==p+1) grid_pixels.slotp[grid_pixels.blockv[p]]=0;
+  struct image *image=grid_pixels.slotv+p;
+  image->v=grid_pixels_storage[p];
+  image->w=WORLD_PIXEL_BLOCK_W_PX;
+  image->h=WORLD_PIXEL_BLOCK_H_PX;
+  image->stride=WORLD_PIXEL_BLOCK_W_PX;
+  grid_render(
+    image,0,0,
+    (coord_t)(col-col%WORLD_PIXEL_BLOCK_W)*TILE_W_MM,(coord_t)(row-row%WORLD_PIXEL_BLOCK_H)*TILE_H_MM,
+    WORLD_PIXEL_BLOCK_W*TILE_W_MM,WORLD_PIXEL_BLOCK_H*TILE_H_MM
+  );
+  grid_pixels.blockv[p]=block;
+  grid_pixels.usev[p]=clock;
+  grid_pixels.slotp[block]=p+1;
+  return image;
+}
+
+#endif
+
+void grid_reindex() {
+  uint32_t revision=gridx.revision;
+  #if WORLD_PIXEL_CACHE
+    grid_pixels_reset();
+  #endif
+  memset(&gridx,0,sizeof(gridx));
+  int16_t x,y;
+  for (x=0;x<WORLD_W_TILES;x++) gridx.coltop[x]=WORLD_H_TILES;
+  for (y=0;y<WORLD_H_TILES;y++) {
+    for (x=0;x<WORLD_W_TILES;) {
+      const uint8_t *p=grid+GRID_INDEX(x,y);
+      int16_t runz=(x|(GRID_CHUNK_W-1))+1;
+      if (runz>WORLD_W_TILES) runz=WORLD_W_TILES;
+      for (;x<runz;x++,p++) grid_index_tile(x,y,*p,1);
+    }
+  }
+  gridx.topocc=0;
+  while ((gridx.topocc<WORLD_H_TILES)&&!gridx.rowocc[gridx.topocc]) gridx.topocc++;
+  gridx.topsolid=0;
+  while ((gridx.topsolid<WORLD_H_TILES)&&!gridx.rowsolid[gridx.topsolid]) gridx.topsolid++;
+  gridx.lowpartial=WORLD_H_TILES-1;
+  while ((gridx.lowpartial>=0)&&(gridx.rowsolid[gridx.lowpartial]==WORLD_W_TILES)) gridx.lowpartial--;
+  gridx.revision=revision+1;
+}
+
+uint32_t grid_revision() {
+  return gridx.revision;
+}
+
+/* Column summaries.
+ */
+
+int16_t grid_column_top(int16_t x) {
+  return gridx.coltop[x];
+}
+
+uint16_t grid_column_dirt(int16_t x) {
+  return gridx.coldirt[x];
+}
+
+/* Reachable cells, by flood fill over the row masks.
+ * Rows only gain bits, so it settles; each pass that rises from a ledge needs another pass above it.
+ * Works on a copy of the window's solid masks, so the same loop serves a wrapping world and a window with hard edges.
+ */
+
+int16_t grid_reachable(uint64_t *dst,int16_t x,int16_t y,uint8_t jump) {
+  int16_t colc=GRID_REACH_COLC,x0=0;
+  memset(dst,0,sizeof(uint64_t)*WORLD_H_TILES);
+  if ((x<0)||(y<0)||(x>=WORLD_W_TILES)||(y>=WORLD_H_TILES)) return 0;
+  if (!GRID_REACH_WRAPS) {
+    x0=x-(colc>>1);
+    if (x0<0) x0+=WORLD_W_TILES;
+  }
+  uint64_t solid[WORLD_H_TILES_LIMIT];
+  int16_t row=0;
+  for (;row<WORLD_H_TILES;row++) solid[row]=grid_row_bits(gridx.solidmask[row],x0,colc);
+  uint64_t all=(colc==64)?~0ull:((1ull<<colc)-1);
+  x-=x0;
+  if (x<0) x+=WORLD_W_TILES;
+  dst[y]=1ull<<x;
+  
+  uint8_t dirty=1;
+  while (dirty) {
+    dirty=0;
+    for (row=0;row<WORLD_H_TILES;row++) {
+      uint64_t r=dst[row];
+      if (!r) continue;
+      uint64_t air=~solid[row]&all;
+      
+      // Sideways through air, wrapping around the world if the window is all of it.
+      for (;;) {
+        uint64_t side;
+        if (GRID_REACH_WRAPS) side=grid_rotl(r,1,colc)|grid_rotl(r,colc-1,colc);
+        else side=((r<<1)|(r>>1))&all;
+        uint64_t next=r|(side&air);
+        if (next==r) break;
+        r=next;
+      }
+      dst[row]=r;
+      
+      // Fall through air below. That row hasn't been visited yet this pass, it will be next.
+      if (row<WORLD_H_TILES-1) {
+        dst[row+1]|=r&~solid[row+1];
+      }
+      
+      // Jump from anything standing on solid ground (or the bottom of the world).
+      uint64_t rise=(row<WORLD_H_TILES-1)?(r&solid[row+1]):r;
+      uint8_t k=1;
+      for (;rise&&(k<=jump)&&(row>=k);k++) {
+        rise&=~solid[row-k];
+        if (rise&~dst[row-k]) {
+          dst[row-k]|=rise;
+          dirty=1;
+        }
+      }
+    }
+  }
+  return x0;
+}
+
+/* Set one tile, the only way to modify (grid) during play.
+ */
+
+void grid_set(int16_t x,int16_t y,uint8_t tile) {
+  int32_t index=GRID_INDEX(x,y);
+  uint8_t *p=grid+index;
+  if (*p==tile) return;
+  grid_index_tile(x,y,*p,-1);
+  *p=tile;
+  grid_index_tile(x,y,tile,1);
+  grid_index_row_changed(y);
+  grid_index_column_changed(x,y);
+  grid_pixels_draw_tile(x,y,tile);
+  gridx.revision++;
+}
+
 /* Make initial grid.
  */
  
 void grid_default() {
 
-  int16_t horizon=WORLD_H_TILES>>1;
-  int16_t skysize=WORLD_W_TILES*horizon;
-  memset(grid,0x00,skysize);
-  memset(grid+skysize,0x2e,WORLD_W_TILES);
-  memset(grid+skysize+WORLD_W_TILES,0x2f,sizeof(grid)-WORLD_W_TILES-skysize);
+  int16_t horizon=WORLD_HORIZON;
+  memset(grid,0x00,GRID_SIZE); // sky, and the padding too
+  int16_t y=horizon;
+  for (;y<WORLD_H_TILES;y++) {
+    uint8_t tile=(y==horizon)?0x2e:0x2f;
+    int16_t x=0;
+    for (;x<WORLD_W_TILES;x+=GRID_CHUNK_W) {
+      int16_t c=WORLD_W_TILES-x;
+      if (c>GRID_CHUNK_W) c=GRID_CHUNK_W;
+      memset(grid+GRID_INDEX(x,y),tile,c);
+    }
+  }
   
-  // Truck. Update sprite_guard.c:violation_truck() if you move it. Also timed_tasks.c:execute_task().
-  grid[WORLD_W_TILES*14+11]=0x30;
-  grid[WORLD_W_TILES*15+10]=0x31;
-  grid[WORLD_W_TILES*15+11]=0x32;
-  grid[WORLD_W_TILES*15+12]=0x33;
-  grid[WORLD_W_TILES*15+13]=0x34;
-  grid[WORLD_W_TILES*15+14]=0x35;
+  // Truck. TRUCK_BED_ROW and TRUCK_BED_COL describe it, if you move it. Also timed_tasks.c:execute_task().
+  GRID_TILE(11,horizon-2)=0x30;
+  GRID_TILE(10,horizon-1)=0x31;
+  GRID_TILE(11,horizon-1)=0x32;
+  GRID_TILE(12,horizon-1)=0x33;
+  GRID_TILE(13,horizon-1)=0x34;
+  GRID_TILE(14,horizon-1)=0x35;
   
   // Little hill with statue on top -- statue must start higher than truck.
-  grid[WORLD_W_TILES*16+45]=0x2f;
-  grid[WORLD_W_TILES*16+46]=0x2f;
-  grid[WORLD_W_TILES*16+47]=0x2f;
-  grid[WORLD_W_TILES*15+45]=0x2c;
-  grid[WORLD_W_TILES*15+46]=0x2f;
-  grid[WORLD_W_TILES*15+47]=0x2a;
-  grid[WORLD_W_TILES*14+46]=0x28;
-  grid[WORLD_W_TILES*13+46]=0x12;
+  GRID_TILE(45,horizon)=0x2f;
+  GRID_TILE(46,horizon)=0x2f;
+  GRID_TILE(47,horizon)=0x2f;
+  GRID_TILE(45,horizon-1)=0x2c;
+  GRID_TILE(46,horizon-1)=0x2f;
+  GRID_TILE(47,horizon-1)=0x2a;
+  GRID_TILE(46,horizon-2)=0x28;
+  GRID_TILE(46,horizon-3)=0x12;
   
-  /* XXX TEMP Put the statue higher while testing, it's getting annoying. *
-  grid[WORLD_W_TILES*13+46]=0x2f;
-  grid[WORLD_W_TILES*12+46]=0x2f;
-  grid[WORLD_W_TILES*11+46]=0x2f;
-  grid[WORLD_W_TILES*10+46]=0x12;
-  /**/
+  grid_reindex();
 }
 
 /* Update camera.
@@ -85,8 +428,8 @@ void camera_update(const struct sprite *focus) {
  
 void grid_render(
   struct image *dst,int16_t dstxpx,int16_t dstypx,
-  int16_t srcxmm,int16_t srcymm,
-  int16_t wmm,int16_t hmm
+  coord_t srcxmm,coord_t srcymm,
+  coord_t wmm,coord_t hmm
 ) {
 
   // Source bounds should always be valid, but we'll double-check.
@@ -103,51 +446,126 @@ void grid_render(
   dstxpx-=(srcxmm%TILE_W_MM)/MM_PER_PIXEL;
   dstypx-=(srcymm%TILE_H_MM)/MM_PER_PIXEL;
   
-  const uint8_t *srcrow=grid+rowa*WORLD_W_TILES+cola;
-  int16_t yi=rowz-rowa+1;
-  int16_t colc=colz-cola+1;
-  for (;yi-->0;srcrow+=WORLD_W_TILES,dstypx+=TILE_H_PIXELS) {
-    const uint8_t *srcp=srcrow;
-    int16_t xi=colc;
+  // Each row in runs, one per chunk it crosses.
+  int16_t row=rowa;
+  for (;row<=rowz;row++,dstypx+=TILE_H_PIXELS) {
+    int16_t col=cola;
     int16_t xp=dstxpx;
-    for (;xi-->0;srcp++,xp+=TILE_W_PIXELS) {
-      int16_t srcx=((*srcp)&0x0f)*TILE_W_PIXELS;
-      int16_t srcy=((*srcp)>>4)*TILE_H_PIXELS;
-      image_blit_opaque(dst,xp,dstypx,&bgtiles,srcx,srcy,TILE_W_PIXELS,TILE_H_PIXELS);
+    while (col<=colz) {
+      const uint8_t *srcp=grid+GRID_INDEX(col,row);
+      int16_t runz=col|(GRID_CHUNK_W-1);
+      if (runz>colz) runz=colz;
+      for (;col<=runz;col++,srcp++,xp+=TILE_W_PIXELS) {
+        int16_t srcx=((*srcp)&0x0f)*TILE_W_PIXELS;
+        int16_t srcy=((*srcp)>>4)*TILE_H_PIXELS;
+        image_blit_opaque(dst,xp,dstypx,&bgtiles,srcx,srcy,TILE_W_PIXELS,TILE_H_PIXELS);
+      }
     }
   }
 }
 
+/* Render camera view.
+ */
+ 
+// The world's (x,y,w,h) mm onto (dst) at its origin, tile by tile, in two pieces if it wraps.
+static void grid_render_view(struct image *dst,coord_t x,coord_t y,coord_t w,coord_t h) {
+  if (x+w>WORLD_W_MM) {
+    coord_t leftwmm=WORLD_W_MM-x;
+    int16_t leftwpx=(leftwmm+MM_PER_PIXEL-1)/MM_PER_PIXEL;
+    grid_render(dst,0,0,x,y,leftwmm,h);
+    grid_render(dst,leftwpx,0,0,y,w-leftwmm,h);
+  } else {
+    grid_render(dst,0,0,x,y,w,h);
+  }
+}
+ 
+void grid_render_camera(struct image *dst) {
+  #if WORLD_PIXEL_CACHE
+    grid_render_camera_rect(dst,0,0,dst->w,dst->h);
+  #else
+    grid_render_view(dst,camera.x,camera.y,camera.w,camera.h);
+  #endif
+}
+
+void grid_render_camera_rect(struct image *dst,int16_t x,int16_t y,int16_t w,int16_t h) {
+  if (x<0) { w+=x; x=0; }
+  if (y<0) { h+=y; y=0; }
+  if (x>dst->w-w) w=dst->w-x;
+  if (y>dst->h-h) h=dst->h-y;
+  if ((w<1)||(h<1)) return;
+  #if WORLD_PIXEL_CACHE
+    // Block by block, one copy per row of each, wrapping at the world's right edge.
+    int16_t srcx=camera.x/MM_PER_PIXEL+x;
+    int16_t srcy=camera.y/MM_PER_PIXEL+y;
+    if (srcx>=WORLD_W_PIXELS) srcx-=WORLD_W_PIXELS;
+    if (srcy+h>WORLD_H_PIXELS) h=WORLD_H_PIXELS-srcy;
+    int16_t dy=0;
+    while (dy<h) {
+      uint16_t py=srcy+dy;
+      int16_t suby=py%WORLD_PIXEL_BLOCK_H_PX;
+      int16_t rowc=WORLD_PIXEL_BLOCK_H_PX-suby;
+      if (rowc>h-dy) rowc=h-dy;
+      int16_t dx=0;
+      uint16_t px=srcx;
+      while (dx<w) {
+        int16_t subx=px%WORLD_PIXEL_BLOCK_W_PX;
+        int16_t colc=WORLD_PIXEL_BLOCK_W_PX-subx;
+        if (colc>WORLD_W_PIXELS-px) colc=WORLD_W_PIXELS-px;
+        if (colc>w-dx) colc=w-dx;
+        const struct image *block=grid_pixels_block(px/TILE_W_PIXELS,py/TILE_H_PIXELS);
+        const uint16_t *srcrow=block->v+suby*block->stride+subx;
+        uint16_t *dstrow=dst->v+(y+dy)*dst->stride+x+dx;
+        int16_t i=rowc;
+        for (;i-->0;dstrow+=dst->stride,srcrow+=block->stride) memcpy(dstrow,srcrow,colc<<1);
+        dx+=colc;
+        if ((px+=colc)>=WORLD_W_PIXELS) px=0;
+      }
+      dy+=rowc;
+    }
+  #else
+    // Tile by tile, into a view of just this rect so nothing outside it changes.
+    struct image view={
+      .v=dst->v+y*dst->stride+x,
+      .w=w,
+      .h=h,
+      .stride=dst->stride,
+    };
+    coord_t srcx=camera.x+x*MM_PER_PIXEL;
+    if (srcx>=WORLD_W_MM) srcx-=WORLD_W_MM;
+    grid_render_view(&view,srcx,camera.y+y*MM_PER_PIXEL,w*MM_PER_PIXEL,h*MM_PER_PIXEL);
+  #endif
+}
+
 /* Test grid cells.
  */
  
-uint8_t grid_contains_any_solid(int16_t xmm,int16_t ymm,int16_t wmm,int16_t hmm) {
+uint8_t grid_contains_any_solid(coord_t xmm,coord_t ymm,coord_t wmm,coord_t hmm) {
 
   if (ymm+hmm>WORLD_H_MM) return 1; // tiles below the world are implicitly solid
   if (ymm<0) { hmm+=ymm; ymm=0; }
   if (hmm<1) return 0;
+  if (wmm<1) return 0;
 
   while (xmm<0) xmm+=WORLD_W_MM;
   while (xmm>=WORLD_W_MM) xmm-=WORLD_W_MM;
-  if (xmm+wmm>WORLD_W_MM) {
-    if (grid_contains_any_solid(0,ymm,xmm+wmm-WORLD_W_MM,hmm)) return 1;
-    wmm=WORLD_W_MM-xmm;
-  }
-  if (wmm<1) return 0;
   
+  // Columns, possibly wrapping around the right edge.
+  int16_t cola=xmm/TILE_W_MM;
+  int32_t colc=(xmm+(int32_t)wmm-1)/TILE_W_MM-cola+1;
   int16_t rowa=ymm/TILE_H_MM;
   int16_t rowz=(ymm+hmm-1)/TILE_H_MM;
-  int16_t cola=xmm/TILE_W_MM;
-  int16_t colz=(xmm+wmm-1)/TILE_W_MM;
-  const uint8_t *srcrow=grid+rowa*WORLD_W_TILES+cola;
-  for (;rowa<=rowz;rowa++,srcrow+=WORLD_W_TILES) {
-    const uint8_t *srcp=srcrow;
-    int16_t i=colz-cola+1;
-    for (;i-->0;srcp++) {
-      if (*srcp>=0x10) return 1;
-    }
+  if (colc>=WORLD_W_TILES) {
+    for (;rowa<=rowz;rowa++) if (gridx.rowsolid[rowa]) return 1;
+    return 0;
+  }
+  int16_t leftc=WORLD_W_TILES-cola;
+  if (leftc>colc) leftc=colc;
+  int16_t rightc=colc-leftc;
+  for (;rowa<=rowz;rowa++) {
+    const uint64_t *row=gridx.solidmask[rowa];
+    if (grid_row_any(row,cola,leftc)) return 1;
+    if (rightc&&grid_row_any(row,0,rightc)) return 1;
   }
-  
   return 0;
 }
 
@@ -155,40 +573,25 @@ uint8_t grid_contains_any_solid(int16_t xmm,int16_t ymm,int16_t wmm,int16_t hmm)
  * For now at least, this only applies to dirt.
  */
  
-static inline uint8_t grid_tile_is_dirt(uint8_t tileid) {
-  return ((tileid&0xf0)==0x20);
-}
- 
 static void grid_join_neighbors_1(int16_t x,int16_t y) {
 
   if ((y<0)||(y>=WORLD_H_TILES)) return;
   if (x<0) x+=WORLD_W_TILES;
   else if (x>=WORLD_W_TILES) x-=WORLD_W_TILES;
-  uint8_t *p=grid+y*WORLD_W_TILES+x;
-  if (!grid_tile_is_dirt(*p)) return;
+  if (!grid_tile_is_dirt(GRID_TILE(x,y))) return;
   
   // Which of my neighbors are dirt? Only the cardinal neighbors matter.
   // If it's OOB vertically call it a match.
-  #define DIRT(dx,dy) ({ \
-    uint8_t _result=1; \
-    int16_t qx=x+dx; \
-    if (qx<0) qx=WORLD_W_TILES-1; \
-    else if (qx>=WORLD_W_TILES) qx=0; \
-    int16_t qy=y+dy; \
-    if ((qy>=0)&&(qy<WORLD_H_TILES)) { \
-      _result=grid_tile_is_dirt(grid[qy*WORLD_W_TILES+qx]); \
-    } \
-    _result; \
-  })
+  int16_t lx=x?(x-1):(WORLD_W_TILES-1);
+  int16_t rx=(x<WORLD_W_TILES-1)?(x+1):0;
   uint8_t neighbors=
-    (DIRT( 0,-1)?DIR_N:0)|
-    (DIRT(-1, 0)?DIR_W:0)|
-    (DIRT( 1, 0)?DIR_E:0)|
-    (DIRT( 0, 1)?DIR_S:0)|
+    (((y<=0)||grid_bit(gridx.dirtmask[y-1],x))?DIR_N:0)|
+    (grid_bit(gridx.dirtmask[y],lx)?DIR_W:0)|
+    (grid_bit(gridx.dirtmask[y],rx)?DIR_E:0)|
+    (((y>=WORLD_H_TILES-1)||grid_bit(gridx.dirtmask[y+1],x))?DIR_S:0)|
   0;
-  #undef DIRT
   
-  *p=0x20+neighbors;
+  grid_set(x,y,0x20+neighbors);
 }
  
 static void grid_join_neighbors(int16_t x,int16_t y) {
@@ -209,10 +612,9 @@ uint8_t grid_remove_dirt(int16_t x,int16_t y) {
   if (x<0) return 0;
   if (x>=WORLD_W_TILES) x-=WORLD_W_TILES;
   if (x>=WORLD_W_TILES) return 0;
-  int16_t p=y*WORLD_W_TILES+x;
-  if (!grid_tile_is_dirt(grid[p])) return 0;
-  if ((y>0)&&(grid[p-WORLD_W_TILES]>=0x10)) return 0; // Next row up must be empty.
-  grid[p]=0x00;
+  if (!grid_tile_is_dirt(GRID_TILE(x,y))) return 0;
+  if ((y>0)&&(GRID_TILE(x,y-1)>=0x10)) return 0; // Next row up must be empty.
+  grid_set(x,y,0x00);
   grid_join_neighbors(x,y);
   return 1;
 }
@@ -222,10 +624,9 @@ uint8_t grid_add_dirt(int16_t x,int16_t y) {
   if (x<0) return 0;
   if (x>=WORLD_W_TILES) x-=WORLD_W_TILES;
   if (x>=WORLD_W_TILES) return 0;
-  int16_t p=y*WORLD_W_TILES+x;
-  if (grid[p]!=0x00) return 0; // Can only add dirt on wide-open cells.
-  if ((y<WORLD_H_TILES-1)&&(grid[p+WORLD_W_TILES]<0x10)) return 0; // Next row down must be solid.
-  grid[p]=0x20;
+  if (GRID_TILE(x,y)!=0x00) return 0; // Can only add dirt on wide-open cells.
+  if ((y<WORLD_H_TILES-1)&&(GRID_TILE(x,y+1)<0x10)) return 0; // Next row down must be solid.
+  grid_set(x,y,0x20);
   grid_join_neighbors(x,y);
   return 1;
 }
@@ -239,21 +640,17 @@ uint8_t grid_cell_buried(int16_t x,int16_t y) {
   // y in (1..WORLD_H_TILES-1): It can't be on the top, but we'll pretend everything below the world is dirt.
   if ((x<0)||(y<1)||(x>=WORLD_W_TILES)||(y>=WORLD_H_TILES)) return 0;
   
+  // Three columns centered on (x). All solid above and below, and both sides.
   int16_t lx=x?(x-1):(WORLD_W_TILES-1);
-  int16_t rx=x+1; if (rx>=WORLD_W_TILES) rx=0;
-  
-  #define SOLID(n) ((n)>=0x10)
-  if (!SOLID(grid[(y-1)*WORLD_W_TILES+lx])) return 0;
-  if (!SOLID(grid[(y-1)*WORLD_W_TILES+x])) return 0;
-  if (!SOLID(grid[(y-1)*WORLD_W_TILES+rx])) return 0;
-  if (!SOLID(grid[y*WORLD_W_TILES+lx])) return 0;
-  if (!SOLID(grid[y*WORLD_W_TILES+rx])) return 0;
+  int16_t rx=(x<WORLD_W_TILES-1)?(x+1):0;
+  const uint64_t *row=gridx.solidmask[y-1];
+  if (!grid_bit(row,lx)||!grid_bit(row,x)||!grid_bit(row,rx)) return 0;
+  row=gridx.solidmask[y];
+  if (!grid_bit(row,lx)||!grid_bit(row,rx)) return 0;
   if (y<WORLD_H_TILES-1) {
-    if (!SOLID(grid[(y+1)*WORLD_W_TILES+lx])) return 0;
-    if (!SOLID(grid[(y+1)*WORLD_W_TILES+x])) return 0;
-    if (!SOLID(grid[(y+1)*WORLD_W_TILES+rx])) return 0;
+    row=gridx.solidmask[y+1];
+    if (!grid_bit(row,lx)||!grid_bit(row,x)||!grid_bit(row,rx)) return 0;
   }
-  #undef SOLID
   return 1;
 }
 
@@ -261,6 +658,7 @@ uint8_t grid_cell_buried(int16_t x,int16_t y) {
  */
  
 void thumbnail_draw() {
+  thumbnail.v=thumbnail_storage;
   const uint16_t color_frame=0x0000;
   const uint16_t color_sky  =0xffff;
   const uint16_t color_dirt =0x1084;
@@ -272,87 +670,100 @@ void thumbnail_draw() {
   image_fill_rect(&thumbnail,0,1,1,thumbnail.h-2,color_frame);
   image_fill_rect(&thumbnail,thumbnail.w-1,1,1,thumbnail.h-2,color_frame);
   
-  // For the interior, every 4 cells of the grid correspond to 1 pixel of the thumbnail.
-  // Check it using the constants to be safe, this check should disappear during compilation.
-  if ((THUMBNAIL_W-2==WORLD_W_TILES>>1)&&(THUMBNAIL_H-2==WORLD_H_TILES>>1)) {
-    const uint8_t *srcrow=grid;
-    uint16_t *dstrow=thumbnail.v+thumbnail.stride+1;
-    int16_t yi=THUMBNAIL_H-2;
-    for (;yi-->0;srcrow+=WORLD_W_TILES*2,dstrow+=thumbnail.stride) {
-      const uint8_t *srcp=srcrow;
-      uint16_t *dstp=dstrow;
-      int16_t xi=THUMBNAIL_W-2;
-      #define DESC1(tile) switch ((tile)&0xf0) { \
-        case 0x00: sky=1; break; \
-        case 0x20: dirt=1; break; \
-        default: other=1; break; \
+  // For the interior, each pixel describes a 2x2 block of cells: At the default size, that's every cell.
+  // Bigger worlds spread the blocks out evenly, so the cost stays the same whatever the world's size.
+  uint16_t *dstrow=thumbnail.v+thumbnail.stride+1;
+  int16_t ty=0;
+  for (;ty<THUMBNAIL_H-2;ty++,dstrow+=thumbnail.stride) {
+    int16_t row=(ty*WORLD_H_TILES)/(THUMBNAIL_H-2);
+    uint16_t *dstp=dstrow;
+    int16_t tx=0;
+    #define DESC1(tile) switch ((tile)&0xf0) { \
+      case 0x00: sky=1; break; \
+      case 0x20: dirt=1; break; \
+      default: other=1; break; \
+    }
+    #define DESCRIBE \
+      int16_t col=(tx*WORLD_W_TILES)/(THUMBNAIL_W-2); \
+      uint8_t sky=0,dirt=0,other=0; \
+      DESC1(GRID_TILE(col,row)) \
+      DESC1(GRID_TILE(col+1,row)) \
+      DESC1(GRID_TILE(col,row+1)) \
+      DESC1(GRID_TILE(col+1,row+1))
+    if (ty<((THUMBNAIL_H-2)>>1)) { // upper half, accentuate dirt
+      for (;tx<THUMBNAIL_W-2;tx++,dstp++) {
+        DESCRIBE
+        if (other) *dstp=color_other;
+        else if (dirt) *dstp=color_dirt;
+        else *dstp=color_sky;
       }
-      #define DESCRIBE \
-        uint8_t sky=0,dirt=0,other=0; \
-        DESC1(srcp[0]) \
-        DESC1(srcp[1]) \
-        DESC1(srcp[WORLD_W_TILES]) \
-        DESC1(srcp[WORLD_W_TILES+1])
-      if (yi>=((THUMBNAIL_H-2)>>1)) { // upper half, accentuate dirt
-        for (;xi-->0;srcp+=2,dstp++) {
-          DESCRIBE
-          if (other) *dstp=color_other;
-          else if (dirt) *dstp=color_dirt;
-          else *dstp=color_sky;
-        }
-      } else { // lower half, accentuate sky
-        for (;xi-->0;srcp+=2,dstp++) {
-          DESCRIBE
-          if (other) *dstp=color_other;
-          else if (sky) *dstp=color_sky;
-          else *dstp=color_dirt;
-        }
+    } else { // lower half, accentuate sky
+      for (;tx<THUMBNAIL_W-2;tx++,dstp++) {
+        DESCRIBE
+        if (other) *dstp=color_other;
+        else if (sky) *dstp=color_sky;
+        else *dstp=color_dirt;
       }
-      #undef DESC1
-      #undef DESCRIBE
     }
-  
-  } else { // dammit andy you broke something
-    image_fill_rect(&thumbnail,1,1,thumbnail.w-2,thumbnail.h-2,0xff00);
+    #undef DESC1
+    #undef DESCRIBE
   }
 }
 
 /* Scoring.
+ * Both count rows from one edge, to at most half the world.
  */
  
 uint32_t get_elevation_score() {
-  const uint8_t *p=grid;
-  uint16_t emptyc=0;
-  uint16_t i=WORLD_H_TILES>>1;
-  for (;i-->0;) {
-    // There is no empty tile except zero that could appear alone at ground level, so we only need to look for zeroes.
-    uint8_t empty=1;
-    uint16_t xi=WORLD_W_TILES;
-    for (;xi-->0;p++) {
-      if (*p) { empty=0; break; }
-    }
-    if (!empty) break;
-    emptyc++;
-  }
+  int16_t emptyc=gridx.topocc;
+  if (emptyc>WORLD_H_TILES>>1) emptyc=WORLD_H_TILES>>1;
   return (WORLD_H_TILES>>1)-emptyc;
 }
 
 uint32_t get_depth_score() {
-  // Same idea as elevation score, but count backward from the end.
-  const uint8_t *p=grid+WORLD_W_TILES*WORLD_H_TILES-1;
-  uint16_t fullc=0;
-  uint16_t i=WORLD_H_TILES>>1;
-  for (;i-->0;) {
-    // Full is anything >=0x10
-    uint8_t full=1;
-    uint16_t xi=WORLD_W_TILES;
-    for (;xi-->0;p--) {
-      if (*p<0x10) { full=0; break; }
+  int16_t fullc=WORLD_H_TILES-1-gridx.lowpartial;
+  if (fullc>WORLD_H_TILES>>1) fullc=WORLD_H_TILES>>1;
+  return (WORLD_H_TILES>>1)-fullc;
+}
+
+/* Check world for specific violations.
+ */
+ 
+// Truck must be unloaded if anything is there. 0x33,0x34,0x35.
+// This is in a fixed position. The bed is cells (12,14),(13,14),(14,14)
+uint8_t violation_truck() {
+  return gridx.truckc?1:0;
+}
+
+// The statue (0x12) must be the tallest non-vacant thing, even a tie is a violation.
+// If no statue found, the player must be carrying it. That's a violation too.
+uint8_t violation_statue() {
+  if (gridx.topsolid>=WORLD_H_TILES) return 1; // no statue and also nothing else...
+  if (!gridx.rowstatue[gridx.topsolid]) return 1;
+  if (gridx.rowsolid[gridx.topsolid]!=gridx.rowstatue[gridx.topsolid]) return 1;
+  return 0;
+}
+
+// If a barrel (0x11) exists, it must have dirt (0x20..0x2f) on all 8 sides.
+uint8_t violation_barrel() {
+  if (gridx.barrel_overflow) {
+    int16_t y=0;
+    for (;y<WORLD_H_TILES;y++) {
+      int16_t x=0;
+      for (;x<WORLD_W_TILES;x++) {
+        if (GRID_TILE(x,y)==0x11) {
+          if (!grid_cell_buried(x,y)) return 1;
+        }
+      }
     }
-    if (!full) break;
-    fullc++;
+    return 0;
   }
-  return (WORLD_H_TILES>>1)-fullc;
+  uint8_t i=gridx.barrelc;
+  while (i-->0) {
+    uint32_t p=gridx.barrelv[i];
+    if (!grid_cell_buried(p%WORLD_W_TILES,p/WORLD_W_TILES)) return 1;
+  }
+  return 0;
 }
 
 const char *get_validation_message() {
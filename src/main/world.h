@@ -3,53 +3,213 @@
  *
  * There are three units of measure: Tile, Pixel, Mm.
  * Mm are the preferred measure, finer than a pixel, so we don't have to use floats.
- * You must keep the world's width in mm well under 32767.
- * 32 mm/px * 8 px/tile * 60 tiles/world yields 15360 mm wide.
+ * Mm coordinates are (coord_t), see WORLD_COORD32.
+ * The world's size in tiles is chosen at runtime, see world_set_size().
+ * 32 mm/px * 8 px/tile * 60 tiles/world yields 15360 mm wide, that's the default.
  */
  
 #ifndef WORLD_H
 #define WORLD_H
 
 #include <stdint.h>
+#include "platform.h"
 
 struct image;
 
+/* 16-bit coordinates hold the default world with room to spare, and they're all the Tiny can afford.
+ * Native and web builds use 32, so they can have much bigger worlds. Override with -DWORLD_COORD32=0 or 1.
+ */
+#ifndef WORLD_COORD32
+  #if PO_NATIVE||defined(__wasm__)
+    #define WORLD_COORD32 1
+  #else
+    #define WORLD_COORD32 0
+  #endif
+#endif
+#if WORLD_COORD32
+  typedef int32_t coord_t;
+#else
+  typedef int16_t coord_t;
+#endif
+
 #define MM_PER_PIXEL 32
 #define TILE_W_PIXELS 8
 #define TILE_H_PIXELS 8
 #define TILE_W_MM (TILE_W_PIXELS*MM_PER_PIXEL)
 #define TILE_H_MM (TILE_H_PIXELS*MM_PER_PIXEL)
-#define WORLD_W_TILES 60
-#define WORLD_H_TILES 32 /* Must be even. */
+
+/* World size in tiles, runtime variables.
+ * Storage is static, sized for the LIMITs. With 16-bit coordinates, the world in mm must stay well under 32767,
+ * so there the default is also the limit.
+ * Pixels are int16_t everywhere, so a 32-bit world still can't exceed 4095 tiles either way.
+ */
+#define WORLD_W_TILES_DEFAULT 60
+#define WORLD_H_TILES_DEFAULT 32 /* Must be even. */
+#ifndef WORLD_W_TILES_LIMIT
+  #if WORLD_COORD32
+    #define WORLD_W_TILES_LIMIT 1024
+    #define WORLD_H_TILES_LIMIT 256
+  #else
+    #define WORLD_W_TILES_LIMIT WORLD_W_TILES_DEFAULT
+    #define WORLD_H_TILES_LIMIT WORLD_H_TILES_DEFAULT
+  #endif
+#endif
+extern GAME_LOCAL int16_t world_w_tiles,world_h_tiles;
+#define WORLD_W_TILES world_w_tiles
+#define WORLD_H_TILES world_h_tiles
 #define WORLD_W_PIXELS (WORLD_W_TILES*TILE_W_PIXELS)
 #define WORLD_H_PIXELS (WORLD_H_TILES*TILE_H_PIXELS)
-#define WORLD_W_MM (WORLD_W_PIXELS*MM_PER_PIXEL)
-#define WORLD_H_MM (WORLD_H_PIXELS*MM_PER_PIXEL)
+#define WORLD_W_MM ((coord_t)WORLD_W_PIXELS*MM_PER_PIXEL)
+#define WORLD_H_MM ((coord_t)WORLD_H_PIXELS*MM_PER_PIXEL)
+#define WORLD_HORIZON (WORLD_H_TILES>>1) /* first row of ground in the default map */
 #define CAMERA_W_PIXELS 96 /* Should match the Tiny's framebuffer. Can go smaller if we want. */
 #define CAMERA_H_PIXELS 64
 #define CAMERA_W_MM (CAMERA_W_PIXELS*MM_PER_PIXEL)
 #define CAMERA_H_MM (CAMERA_H_PIXELS*MM_PER_PIXEL)
 
+/* The truck sits on the horizon, and its bed is the three cells starting here.
+ */
+#define TRUCK_BED_ROW (WORLD_HORIZON-2)
+#define TRUCK_BED_COL 12
+
 #define GRAVITY MM_PER_PIXEL /* mm/frame */
 
-#define SPRITE_LIMIT 32
-#define SPRITE_OPAQUE_SIZE 64
+/* Where RAM allows, keep pre-rendered blocks of the grid, WORLD_PIXEL_BLOCK_W*WORLD_PIXEL_BLOCK_H tiles each.
+ * Blocks draw when the camera first wants them, and the least recently used one makes room. 256 kB, and the whole default world fits.
+ * The camera touches at most six blocks, so in a bigger world we only pay a block's redraw as it crosses into one.
+ * The Tiny draws its tiles fresh each frame.
+ */
+#if PO_NATIVE||defined(__wasm__)
+  #define WORLD_PIXEL_CACHE 1
+  #define WORLD_PIXEL_BLOCK_W 16
+  #define WORLD_PIXEL_BLOCK_H 16
+  #define WORLD_PIXEL_CACHE_SLOTS 8
+#else
+  #define WORLD_PIXEL_CACHE 0
+#endif
 
-#define THUMBNAIL_W ((WORLD_W_TILES>>1)+2)
-#define THUMBNAIL_H ((WORLD_H_TILES>>1)+2)
-extern struct image thumbnail;
+/* Change the world's size, in tiles. Takes effect immediately, and the grid's content is garbage until the next game_begin().
+ * So call it only between rounds. Each thread running a game has its own.
+ * Width and height are clamped to the defaults and the LIMITs, and height rounds down to even.
+ * Replays record a non-default size and restore it on playback.
+ */
+void world_set_size(int16_t w,int16_t h);
 
-extern uint8_t grid[WORLD_W_TILES*WORLD_H_TILES];
+/* Stress builds may raise SPRITE_LIMIT, eg -DSPRITE_LIMIT=4096. Snapshots and replay hashes are sized by it.
+ */
+#ifndef SPRITE_LIMIT
+  #define SPRITE_LIMIT 32
+#endif
 
-#define SPRITE_HEADER \
-  uint8_t controller; \
-  int16_t x,y,w,h; /* mm, physical bounds */
+// Thumbnail is the same size whatever the world's, one pixel per 2x2 cells at the default.
+#define THUMBNAIL_W ((WORLD_W_TILES_DEFAULT>>1)+2)
+#define THUMBNAIL_H ((WORLD_H_TILES_DEFAULT>>1)+2)
+extern GAME_LOCAL struct image thumbnail;
 
-extern struct sprite {
-  SPRITE_HEADER
-  uint8_t opaque[SPRITE_OPAQUE_SIZE]; // for controller's use
+/* Tiles are stored in chunks of GRID_CHUNK_W*GRID_CHUNK_H, each contiguous and row-major inside.
+ * Chunks are row-major too, (grid_chunkw) to a row. Chunks hanging off the right or bottom edge are padded.
+ * Always address tiles with GRID_TILE(col,row) or GRID_INDEX(col,row), never by arithmetic on (grid) directly,
+ * except that a run of tiles within one chunk's row is contiguous.
+ * In 32-bit builds a chunk is 4 kB, so a camera's neighborhood touches only a few pages whatever the world's size.
+ * Small builds use 64x32 chunks so the default world is exactly one.
+ */
+#define GRID_CHUNK_W_SHIFT 6
+#if WORLD_COORD32
+  #define GRID_CHUNK_H_SHIFT 6
+#else
+  #define GRID_CHUNK_H_SHIFT 5
+#endif
+#define GRID_CHUNK_W (1<<GRID_CHUNK_W_SHIFT)
+#define GRID_CHUNK_H (1<<GRID_CHUNK_H_SHIFT)
+#define GRID_CHUNK_SHIFT (GRID_CHUNK_W_SHIFT+GRID_CHUNK_H_SHIFT)
+#define GRID_CHUNK_SIZE (1<<GRID_CHUNK_SHIFT)
+#define GRID_CHUNKS_W(w) (((w)+GRID_CHUNK_W-1)>>GRID_CHUNK_W_SHIFT)
+#define GRID_CHUNKS_H(h) (((h)+GRID_CHUNK_H-1)>>GRID_CHUNK_H_SHIFT)
+#define GRID_CHUNK_LIMIT (GRID_CHUNKS_W(WORLD_W_TILES_LIMIT)*GRID_CHUNKS_H(WORLD_H_TILES_LIMIT)) /* at most 64, one bit each */
+#define GRID_SIZE_LIMIT (GRID_CHUNK_LIMIT*GRID_CHUNK_SIZE)
+#define GRID_SIZE ((int32_t)grid_chunkw*grid_chunkh*GRID_CHUNK_SIZE)
+#define GRID_INDEX(col,row) ( \
+  (((int32_t)((row)>>GRID_CHUNK_H_SHIFT)*grid_chunkw+((col)>>GRID_CHUNK_W_SHIFT))<<GRID_CHUNK_SHIFT)| \
+  (((row)&(GRID_CHUNK_H-1))<<GRID_CHUNK_W_SHIFT)| \
+  ((col)&(GRID_CHUNK_W-1)) \
+)
+#define GRID_TILE(col,row) (grid[GRID_INDEX(col,row)])
+extern GAME_LOCAL uint8_t grid[GRID_SIZE_LIMIT]; // only the first GRID_SIZE bytes are in use
+extern GAME_LOCAL int16_t grid_chunkw,grid_chunkh;
+
+/* Sprites are split in two.
+ * (spritev) holds only what everybody reads: controller and bounds, 10 bytes a slot, densely packed.
+ * Each controller's private state lives in its own pool in (spritepools), indexed by the same slot.
+ * So a pass over bounds, or over one controller's state, doesn't drag the rest through the cache.
+ * sprite_new() zeroes the slot in every pool, so only the slot's own controller ever leaves anything there.
+ */
+extern GAME_LOCAL struct sprite {
+  uint8_t controller;
+  coord_t x,y,w,h; // mm, physical bounds
 } spritev[SPRITE_LIMIT];
 
+struct sprite_ivan {
+  int8_t facedir; // -1,1 = left,right
+  int8_t dx; // (-1,0,1) while button held
+  int8_t dy; // ''
+  int8_t dyimpulse; // (-1,0,1), nonzero for one frame at a time
+  uint8_t injump; // 1 while held
+  uint8_t inaux; // 1 momentarily at press
+  uint8_t animclock;
+  uint8_t animframe;
+  uint8_t jumppower;
+  uint8_t carrying; // either the shovel or a block over my head, or nothing
+  uint8_t injury_highlight;
+  uint16_t idleframec;
+  uint8_t fairy_triggered;
+};
+
+struct sprite_guard {
+  int8_t facedir;
+  uint8_t grounded; // 0|1, updated from scratch early in the cycle
+  int8_t motion; // (-1,0,1) which way are we moving (NB not related to facedir)
+  uint8_t jump_power; // counts down; nonzero midjump
+  uint8_t climbing;
+  uint8_t animclock;
+  uint8_t animframe;
+  uint8_t rulesclock;
+  uint8_t violation; // TATTLE_{NONE,STATUE,TRUCK,BARREL}
+  uint8_t reload; // counts down after firing gun
+};
+
+struct sprite_shovel {
+  uint8_t animclock;
+};
+
+struct sprite_bullet {
+  int8_t dx; // -1,1
+};
+
+struct sprite_fairy {
+  uint8_t animclock;
+  uint8_t animframe;
+  uint8_t landed; // stops drifting sideways once level with the hero
+  uint8_t pauseclock;
+  uint8_t escapeclock; // nonzero once the dirt is down, counts up while she flies off
+};
+
+extern GAME_LOCAL struct sprite_pools {
+  struct sprite_ivan ivan[SPRITE_LIMIT];
+  struct sprite_guard guard[SPRITE_LIMIT];
+  struct sprite_shovel shovel[SPRITE_LIMIT];
+  struct sprite_bullet bullet[SPRITE_LIMIT];
+  struct sprite_fairy fairy[SPRITE_LIMIT];
+} spritepools;
+
+// Controller state for (sprite), eg SPRITE_STATE(guard,sprite)->reload.
+#define SPRITE_STATE(pool,sprite) (spritepools.pool+((sprite)-spritev))
+
+/* Before the split, each slot was one record: controller, a pad byte, int16_t x,y,w,h, then 64 bytes of controller state.
+ * Replay hashes are still defined over that layout, see sprite_encode().
+ */
+#define SPRITE_OPAQUE_SIZE 64
+#define SPRITE_RECORD_SIZE (10+SPRITE_OPAQUE_SIZE)
+
 #define SPRITE_CONTROLLER_NONE 0
 #define SPRITE_CONTROLLER_IVAN 1
 #define SPRITE_CONTROLLER_DUMMY 2
@@ -57,9 +217,10 @@ extern struct sprite {
 #define SPRITE_CONTROLLER_SHOVEL 4
 #define SPRITE_CONTROLLER_BULLET 5
 #define SPRITE_CONTROLLER_FAIRY 6
+#define SPRITE_CONTROLLER_COUNT 7
 
-extern struct camera {
-  int16_t x,y,w,h; // Boundaries in mm, watch for exceeding left and right world edges.
+extern GAME_LOCAL struct camera {
+  coord_t x,y,w,h; // Boundaries in mm, watch for exceeding left and right world edges.
 } camera;
 
 void grid_default();
@@ -71,16 +232,60 @@ void grid_default();
  */
 void camera_update(const struct sprite *focus);
 
+/* Render the camera's view of the grid onto (dst), covering it entirely.
+ * Takes care of horizontal wrapping.
+ */
+void grid_render_camera(struct image *dst);
+
+/* Same thing, but only the rectangle (x,y,w,h) of (dst), in pixels.
+ * From the pixel cache if there is one, otherwise tile by tile.
+ */
+void grid_render_camera_rect(struct image *dst,int16_t x,int16_t y,int16_t w,int16_t h);
+
 /* Render one contiguous region of the grid onto (dst).
  * Caller must take care of the horizontal wrapping.
  */
 void grid_render(
   struct image *dst,int16_t dstxpx,int16_t dstypx,
-  int16_t srcxmm,int16_t srcymm,
-  int16_t wmm,int16_t hmm
+  coord_t srcxmm,coord_t srcymm,
+  coord_t wmm,coord_t hmm
 );
 
-uint8_t grid_contains_any_solid(int16_t xmm,int16_t ymm,int16_t wmm,int16_t hmm);
+/* Change one tile of (grid), keeping the indexes current.
+ * Everything that modifies the grid during play must use this.
+ * (x,y) in tiles, must be in range.
+ */
+void grid_set(int16_t x,int16_t y,uint8_t tile);
+
+/* Rebuild indexes after writing (grid) directly.
+ */
+void grid_reindex();
+
+/* Changes whenever the grid does, via grid_set() or grid_reindex().
+ */
+uint32_t grid_revision();
+
+/* Per-column summaries from the indexes, constant time.
+ * (x) in tiles, must be in range.
+ * Top is the first solid row from the top, or WORLD_H_TILES if the column is empty.
+ */
+int16_t grid_column_top(int16_t x);
+uint16_t grid_column_dirt(int16_t x);
+
+/* Every cell a walker starting at (x,y) could get to, as row masks over a window of GRID_REACH_COLC columns.
+ * Bit (1<<i) of (dst[y]) is column (x0+i)%WORLD_W_TILES, and we return (x0).
+ * If the whole world fits in GRID_REACH_W columns, the window is all of it (x0==0) and wraps like the world.
+ * Otherwise it's centered on (x) and its edges are walls, so the cost doesn't grow with the world.
+ * The walker is one tile, moves sideways through air, falls freely, and jumps up to (jump) tiles from solid ground.
+ * It's generous sideways, a jump can carry along any length of air. But it will never rise higher than it could climb.
+ * (dst) must have room for WORLD_H_TILES words.
+ */
+#define GRID_REACH_W 64
+#define GRID_REACH_WRAPS (WORLD_W_TILES<=GRID_REACH_W)
+#define GRID_REACH_COLC (GRID_REACH_WRAPS?WORLD_W_TILES:GRID_REACH_W)
+int16_t grid_reachable(uint64_t *dst,int16_t x,int16_t y,uint8_t jump);
+
+uint8_t grid_contains_any_solid(coord_t xmm,coord_t ymm,coord_t wmm,coord_t hmm);
 
 /* Toggle dirt in one cell.
  * (x,y) in tiles.
@@ -95,12 +300,12 @@ uint8_t grid_cell_buried(int16_t x,int16_t y);
 // Draw the whole thumbnail from scratch.
 void thumbnail_draw();
 
-// Scores are uint32_t, but really they are limited to 0..16
+// Scores are uint32_t, but really they are limited to 0..WORLD_H_TILES/2, 16 at the default size.
 uint32_t get_elevation_score();
 uint32_t get_depth_score();
 const char *get_validation_message(); // null if valid
 
-// sprite_guard.c
+// Constant time, from the indexes.
 uint8_t violation_truck();
 uint8_t violation_statue();
 uint8_t violation_barrel();
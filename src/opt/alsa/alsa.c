@@ -9,7 +9,11 @@
 /* Object definition.
  */
 
-#define ALSA_BUFFER_SIZE 2048
+/* We write one period at a time, and ask for a device buffer of a few periods.
+ * Small, so a producer running just ahead of us doesn't add much latency on top.
+ */
+#define ALSA_PERIOD_SIZE 256
+#define ALSA_BUFFER_SIZE 1024
 
 struct alsa {
   struct alsa_delegate delegate;
@@ -25,9 +29,9 @@ struct alsa {
   int16_t *buf;
 
   pthread_t iothd;
-  pthread_mutex_t iomtx;
   int ioabort;
   int cberror;
+  int xrunc;
 };
 
 /* Delete.
@@ -42,7 +46,6 @@ void alsa_del(struct alsa *alsa) {
     pthread_cancel(alsa->iothd);
     pthread_join(alsa->iothd,0);
   }
-  pthread_mutex_destroy(&alsa->iomtx);
   if (alsa->hwparams) snd_pcm_hw_params_free(alsa->hwparams);
   if (alsa->alsa) snd_pcm_close(alsa->alsa);
   if (alsa->buf) free(alsa->buf);
@@ -63,6 +66,7 @@ int alsa_ref(struct alsa *alsa) {
 }
 
 /* I/O thread.
+ * No lock around the callback: the client shares state with it lock-free, or not at all.
  */
 
 static void *_alsa_iothd(void *dummy) {
@@ -71,21 +75,17 @@ static void *_alsa_iothd(void *dummy) {
   while (1) {
     pthread_testcancel();
 
-    if (pthread_mutex_lock(&alsa->iomtx)) {
-      alsa->cberror=1;
-      return 0;
-    }
     alsa->delegate.cb_pcm_out(alsa->buf,alsa->bufc_samples,alsa);
-    pthread_mutex_unlock(&alsa->iomtx);
     if (alsa->ioabort) return 0;
 
     int16_t *samplev=alsa->buf;
     int samplep=0,samplec=alsa->bufc;
     while (samplep<samplec) {
       pthread_testcancel();
-      int err=snd_pcm_writei(alsa->alsa,samplev+samplep,samplec-samplep);
+      int err=snd_pcm_writei(alsa->alsa,samplev+samplep*alsa->delegate.chanc,samplec-samplep);
       if (alsa->ioabort) return 0;
       if (err<=0) {
+        if (err==-EPIPE) alsa->xrunc++;
         if ((err=snd_pcm_recover(alsa->alsa,err,0))<0) {
           alsa->cberror=1;
           return 0;
@@ -110,6 +110,8 @@ static int alsa_midi_init(struct alsa *alsa) {
  */
  
 static int _alsa_init(struct alsa *alsa) {
+  snd_pcm_uframes_t periodsize=ALSA_PERIOD_SIZE;
+  snd_pcm_uframes_t buffersize=ALSA_BUFFER_SIZE;
   
   if (!alsa->delegate.device||!alsa->delegate.device[0]) {
     alsa->delegate.device="default";
@@ -123,22 +125,19 @@ static int _alsa_init(struct alsa *alsa) {
     (snd_pcm_hw_params_set_format(alsa->alsa,alsa->hwparams,SND_PCM_FORMAT_S16)<0)||
     (snd_pcm_hw_params_set_rate_near(alsa->alsa,alsa->hwparams,&alsa->delegate.rate,0)<0)||
     (snd_pcm_hw_params_set_channels_near(alsa->alsa,alsa->hwparams,&alsa->delegate.chanc)<0)||
-    (snd_pcm_hw_params_set_buffer_size(alsa->alsa,alsa->hwparams,ALSA_BUFFER_SIZE)<0)||
+    (snd_pcm_hw_params_set_period_size_near(alsa->alsa,alsa->hwparams,&periodsize,0)<0)||
+    (snd_pcm_hw_params_set_buffer_size_near(alsa->alsa,alsa->hwparams,&buffersize)<0)||
     (snd_pcm_hw_params(alsa->alsa,alsa->hwparams)<0)
   ) return -1;
   
   if (snd_pcm_nonblock(alsa->alsa,0)<0) return -1;
   if (snd_pcm_prepare(alsa->alsa)<0) return -1;
 
-  alsa->bufc=ALSA_BUFFER_SIZE;
+  alsa->hwbuffersize=buffersize;
+  alsa->bufc=periodsize;
   alsa->bufc_samples=alsa->bufc*alsa->delegate.chanc;
   if (!(alsa->buf=malloc(alsa->bufc_samples*2))) return -1;
 
-  pthread_mutexattr_t mattr;
-  pthread_mutexattr_init(&mattr);
-  pthread_mutexattr_settype(&mattr,PTHREAD_MUTEX_RECURSIVE);
-  if (pthread_mutex_init(&alsa->iomtx,&mattr)) return -1;
-  pthread_mutexattr_destroy(&mattr);
   if (pthread_create(&alsa->iothd,0,_alsa_iothd,alsa)) return -1;
   
   if (alsa->delegate.cb_midi_in) {
@@ -194,19 +193,25 @@ int alsa_get_status(const struct alsa *alsa) {
   return 0;
 }
 
-/* Lock.
- */
- 
-int alsa_lock(struct alsa *alsa) {
+int alsa_get_period(const struct alsa *alsa) {
   if (!alsa) return 0;
-  if (pthread_mutex_lock(&alsa->iomtx)) return -1;
-  return 0;
+  return alsa->bufc;
 }
 
-int alsa_unlock(struct alsa *alsa) {
+int alsa_get_xrunc(const struct alsa *alsa) {
   if (!alsa) return 0;
-  if (pthread_mutex_unlock(&alsa->iomtx)) return -1;
-  return 0;
+  return alsa->xrunc;
+}
+
+/* Device delay.
+ */
+ 
+int alsa_get_delay(struct alsa *alsa) {
+  if (!alsa||!alsa->alsa) return 0;
+  snd_pcm_sframes_t framec=0;
+  if (snd_pcm_delay(alsa->alsa,&framec)<0) return 0;
+  if (framec<0) return 0;
+  return framec;
 }
 
 /* Update.
@@ -29,10 +29,9 @@ struct alsa *alsa_new(
   const struct alsa_delegate *delegate
 );
 
-/* Your callback is guaranteed not running while you hold the lock.
+/* (cb_pcm_out) runs on our I/O thread, one period at a time, and we never take a lock around it.
+ * Anything it shares with your other threads, synchronize lock-free (eg a single-producer ring).
  */
-int alsa_lock(struct alsa *alsa);
-int alsa_unlock(struct alsa *alsa);
 
 /* (rate,chanc,userdata) won't change once set.
  * (rate,chanc) are not necessarily what you asked for.
@@ -41,6 +40,11 @@ int alsa_get_rate(const struct alsa *alsa);
 int alsa_get_chanc(const struct alsa *alsa);
 void *alsa_get_userdata(const struct alsa *alsa);
 int alsa_get_status(const struct alsa *alsa); // => 0,-1
+int alsa_get_period(const struct alsa *alsa); // frames per callback
+int alsa_get_xrunc(const struct alsa *alsa); // device underruns so far
+
+// Frames written but not yet played. Call only from your callback; the I/O thread owns the PCM.
+int alsa_get_delay(struct alsa *alsa);
 
 // No harm either way, but only necessary if you're using MIDI in.
 int alsa_update(struct alsa *alsa);
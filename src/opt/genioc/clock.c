@@ -1,22 +1,24 @@
 #include "clock.h"
 #include <string.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <time.h>
-#include <sys/time.h>
+#include <errno.h>
 
 /* Current time.
+ * Monotonic, so wall-clock adjustments can't stretch or squeeze a frame.
  */
  
 int64_t now_us() {
-  struct timeval tv={0};
-  gettimeofday(&tv,0);
-  return (int64_t)tv.tv_sec*1000000+tv.tv_usec;
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (int64_t)tv.tv_sec*1000000+tv.tv_nsec/1000;
 }
 
 double now_s() {
-  struct timeval tv={0};
-  gettimeofday(&tv,0);
-  return (double)tv.tv_sec+(double)tv.tv_usec/1000000.0;
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+(double)tv.tv_nsec/1000000000.0;
 }
 
 double now_cpu_s() {
@@ -36,6 +38,51 @@ void sleep_s(double s) {
   usleep((int)(s*1000000.0));
 }
 
+void sleep_until_us(int64_t deadline,int spin_us) {
+  int64_t wake=deadline-spin_us;
+  struct timespec tv={
+    .tv_sec=wake/1000000,
+    .tv_nsec=(wake%1000000)*1000,
+  };
+  while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&tv,0)==EINTR) ;
+  if (spin_us>0) while (now_us()<deadline) ;
+}
+
+/* Histogram.
+ */
+ 
+static const int histogram_bucket_limits[HISTOGRAM_BUCKET_COUNT-1]={
+  50,100,250,500,1000,2000,4000,8000,16667,33333,66667,
+};
+ 
+void histogram_add(struct histogram *histogram,int64_t us) {
+  int i=0;
+  while ((i<HISTOGRAM_BUCKET_COUNT-1)&&(us>=histogram_bucket_limits[i])) i++;
+  histogram->countv[i]++;
+  histogram->c++;
+  histogram->sum+=us;
+  if (us>histogram->max) histogram->max=us;
+}
+
+void histogram_log(const struct histogram *histogram,const char *name) {
+  if (!histogram->c) return;
+  fprintf(stderr,
+    "%s: %d samples, mean %d us, max %d us\n",
+    name,histogram->c,(int)(histogram->sum/histogram->c),(int)histogram->max
+  );
+  int i=0,lo=0;
+  for (;i<HISTOGRAM_BUCKET_COUNT;i++) {
+    if (histogram->countv[i]) {
+      if (i<HISTOGRAM_BUCKET_COUNT-1) {
+        fprintf(stderr,"  %6d..%6d us: %7d %5.1f%%\n",lo,histogram_bucket_limits[i]-1,histogram->countv[i],(histogram->countv[i]*100.0)/histogram->c);
+      } else {
+        fprintf(stderr,"  %6d..       us: %7d %5.1f%%\n",lo,histogram->countv[i],(histogram->countv[i]*100.0)/histogram->c);
+      }
+    }
+    if (i<HISTOGRAM_BUCKET_COUNT-1) lo=histogram_bucket_limits[i];
+  }
+}
+
 /* Structured timer.
  */
  
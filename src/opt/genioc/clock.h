@@ -14,6 +14,21 @@ double now_cpu_s();
 void sleep_us(int us);
 void sleep_s(double s);
 
+// Sleep until (deadline), in now_us() terms, with a single absolute-time sleep.
+// If (spin_us>0), wake that much early and busy-wait the rest, for when the scheduler's granularity is too coarse.
+void sleep_until_us(int64_t deadline,int spin_us);
+
+// Counts of durations in microseconds, in fixed buckets roughly doubling from 50 us to 4 frames.
+// Cheap enough to record every frame. Initialize to zero.
+#define HISTOGRAM_BUCKET_COUNT 12
+struct histogram {
+  int countv[HISTOGRAM_BUCKET_COUNT];
+  int c;
+  int64_t sum,max;
+};
+void histogram_add(struct histogram *histogram,int64_t us);
+void histogram_log(const struct histogram *histogram,const char *name); // stderr, nonempty buckets only
+
 #define TIMER_MODE_REAL 0
 #define TIMER_MODE_CPU  1
 
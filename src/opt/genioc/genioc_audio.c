@@ -0,0 +1,147 @@
+/* genioc_audio.c
+ * PCM out via ALSA, fed by a single-producer/single-consumer ring that never locks.
+ * The game thread is the only producer: after each batch of updates, it renders synth blocks
+ * until the ring holds GENIOC_AUDIO_LEAD_MS ahead of the device.
+ * ALSA's I/O thread is the only consumer. If the ring runs dry, the device gets silence and we count an underrun.
+ * Each side owns one index and only reads the other's, so neither ever waits.
+ */
+
+#include "genioc_internal.h"
+
+#if PO_USE_alsa
+#include "opt/alsa/alsa.h"
+
+#define GENIOC_AUDIO_RING_SIZE 8192 /* mono frames, must be a power of two */
+#define GENIOC_AUDIO_LEAD_MS 50 /* three game frames, plenty to cover render jitter */
+
+static struct genioc_audio {
+  struct alsa *alsa;
+  int leadc; // frames we try to keep in the ring
+  int16_t v[GENIOC_AUDIO_RING_SIZE];
+  uint32_t head; // frames produced; game thread writes, I/O thread reads
+  uint32_t tail; // frames consumed; I/O thread writes, game thread reads
+  // Everything below belongs to the I/O thread until alsa_del() joins it.
+  int started; // don't count underruns until we've played something
+  int underrunc;
+  int64_t shortc; // frames of silence filled in for underruns
+  int64_t latencysum;
+  int latencyc,latencymax; // frames
+} audio={0};
+
+/* PCM callback, on ALSA's I/O thread.
+ */
+
+static int genioc_audio_cb(int16_t *dst,int dsta,struct alsa *alsa) {
+  int chanc=alsa_get_chanc(alsa); // whatever the device settled on; the ring is mono either way
+  int framec=dsta/chanc;
+  uint32_t tail=audio.tail;
+  int availc=__atomic_load_n(&audio.head,__ATOMIC_ACQUIRE)-tail;
+  int cpc=(availc<framec)?availc:framec;
+  int i=cpc;
+  if (chanc==1) {
+    for (;i-->0;dst++,tail++) *dst=audio.v[tail&(GENIOC_AUDIO_RING_SIZE-1)];
+  } else {
+    for (;i-->0;tail++) {
+      int16_t sample=audio.v[tail&(GENIOC_AUDIO_RING_SIZE-1)];
+      int c=chanc;
+      for (;c-->0;dst++) *dst=sample;
+    }
+  }
+  __atomic_store_n(&audio.tail,tail,__ATOMIC_RELEASE);
+
+  if (cpc<framec) {
+    memset(dst,0,sizeof(int16_t)*(framec-cpc)*chanc);
+    if (audio.started) {
+      audio.underrunc++;
+      audio.shortc+=framec-cpc;
+    }
+  } else {
+    audio.started=1;
+  }
+
+  /* A sample entering the ring now plays after what's still in the ring,
+   * what the device hasn't played yet, and this period we're about to write.
+   */
+  if (audio.started) {
+    int latency=availc-cpc+alsa_get_delay(alsa)+framec;
+    audio.latencysum+=latency;
+    audio.latencyc++;
+    if (latency>audio.latencymax) audio.latencymax=latency;
+  }
+  return 0;
+}
+
+/* Init.
+ */
+
+int genioc_audio_init(const char *device,int rate,int chanc) {
+  if (rate<1) rate=22050;
+  if (chanc<1) chanc=1;
+  struct alsa_delegate delegate={
+    .rate=rate,
+    .chanc=chanc,
+    .device=device,
+    .cb_pcm_out=genioc_audio_cb,
+  };
+  if (!(audio.alsa=alsa_new(&delegate))) {
+    fprintf(stderr,"Failed to initialize ALSA. Proceeding without audio.\n");
+    return -1;
+  }
+  if (alsa_get_rate(audio.alsa)!=rate) {
+    fprintf(stderr,"ALSA gave us %d Hz, not %d. Music will play off pitch.\n",alsa_get_rate(audio.alsa),rate);
+  }
+  audio.leadc=(alsa_get_rate(audio.alsa)*GENIOC_AUDIO_LEAD_MS)/1000;
+  if (audio.leadc>GENIOC_AUDIO_RING_SIZE) audio.leadc=GENIOC_AUDIO_RING_SIZE;
+  fprintf(stderr,
+    "Using ALSA for audio: %d Hz, %d channels, %d frames per period.\n",
+    alsa_get_rate(audio.alsa),alsa_get_chanc(audio.alsa),alsa_get_period(audio.alsa)
+  );
+  return 0;
+}
+
+/* Render ahead, on the game thread.
+ */
+
+void genioc_audio_update() {
+  if (!audio.alsa) return;
+  uint32_t head=audio.head;
+  int wantc=audio.leadc-(int)(head-__atomic_load_n(&audio.tail,__ATOMIC_ACQUIRE));
+  while (wantc>0) {
+    int p=head&(GENIOC_AUDIO_RING_SIZE-1);
+    int c=GENIOC_AUDIO_RING_SIZE-p;
+    if (c>wantc) c=wantc;
+    audio_next_block(audio.v+p,c);
+    head+=c;
+    wantc-=c;
+  }
+  __atomic_store_n(&audio.head,head,__ATOMIC_RELEASE);
+}
+
+/* Quit, and report.
+ */
+
+void genioc_audio_quit() {
+  if (!audio.alsa) return;
+  int rate=alsa_get_rate(audio.alsa);
+  int xrunc=alsa_get_xrunc(audio.alsa);
+  alsa_del(audio.alsa); // joins the I/O thread, so its stats are safe to read after
+  audio.alsa=0;
+  fprintf(stderr,
+    "Audio: %d ring underruns (%.03f s silence), %d device underruns.\n",
+    audio.underrunc,(double)audio.shortc/rate,xrunc
+  );
+  if (audio.latencyc>0) {
+    fprintf(stderr,
+      "Audio output latency: average %.01f ms, max %.01f ms.\n",
+      (audio.latencysum*1000.0)/((double)audio.latencyc*rate),(audio.latencymax*1000.0)/rate
+    );
+  }
+}
+
+#else
+
+int genioc_audio_init(const char *device,int rate,int chanc) { return -1; }
+void genioc_audio_update() {}
+void genioc_audio_quit() {}
+
+#endif
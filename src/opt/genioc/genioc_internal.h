@@ -42,8 +42,16 @@ extern struct genioc {
     struct po_evdev *evdev;
   #endif
   int terminate;
+  int nodamage;
   uint8_t inputstate;
   volatile int sigc;
 } genioc;
 
+/* Audio out, in genioc_audio.c. Everything is a noop if it fails to init, or there's no ALSA.
+ * Call update from the game thread, after each batch of updates.
+ */
+int genioc_audio_init(const char *device,int rate,int chanc);
+void genioc_audio_update();
+void genioc_audio_quit();
+
 #endif
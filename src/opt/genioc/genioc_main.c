@@ -1,4 +1,6 @@
 #include "genioc_internal.h"
+#include "main/replay.h"
+#include "main/world.h"
 #include <signal.h>
 
 struct genioc genioc={0};
@@ -16,7 +18,14 @@ static void genioc_print_help(const char *exename) {
     "  --glsl-version=INT     DRM only, default 100.\n"
     "  --audio-device=PATH    ALSA only.\n"
     "  --audio-rate=INT       Default 22050.\n"
-    "  --audio-chanc=INT      Default 1. In stereo, we output the same thing L and R.\n"
+    "  --audio-chanc=INT      Default 1. The device may settle on another count. Every channel gets the same thing.\n"
+    "  --record=PATH          Record input to a replay file.\n"
+    "  --replay=PATH          Play back a replay file, and quit at its end.\n"
+    "  --hash-interval=INT    Frames between hashes when recording, default 60.\n"
+    "  --hashes               Log every frame's state hash to stderr.\n"
+    "  --no-damage            Send the whole framebuffer every frame, even if little changed.\n"
+    "  --spin-us=INT          Wake this early from each frame's sleep and busy-wait the rest. Default 0.\n"
+    "  --world=WxH            World size in tiles, eg 1024x256. Default and minimum 60x32. Replays override.\n"
   );
 }
 
@@ -188,6 +197,38 @@ static int genioc_init_drivers(int argc,char **argv) {
   return 0;
 }
 
+/* Init replay recorder or player, per argv.
+ */
+ 
+static int genioc_init_replay(int argc,char **argv) {
+  replay_set_hash_interval(genioc_argv_get_int(argc,argv,"--hash-interval",60));
+  replay_set_hash_log(genioc_argv_get_boolean(argc,argv,"--hashes"));
+  const char *path;
+  if (path=genioc_argv_get_string(argc,argv,"--record",0)) {
+    if (replay_record(path)<0) return -1;
+  }
+  if (path=genioc_argv_get_string(argc,argv,"--replay",0)) {
+    if (replay_play(path)<0) return -1;
+  }
+  return 0;
+}
+
+/* Init world size and storage, per argv.
+ */
+ 
+static int genioc_init_world(int argc,char **argv) {
+  const char *world=genioc_argv_get_string(argc,argv,"--world",0);
+  if (world) {
+    int w=0,h=0;
+    if ((sscanf(world,"%dx%d",&w,&h)!=2)||(w<1)||(h<1)) {
+      fprintf(stderr,"Expected --world=WxH, eg 1024x256\n");
+      return -1;
+    }
+    world_set_size(w,h);
+  }
+  return 0;
+}
+
 /* Init per client (noop).
  */
  
@@ -242,6 +283,24 @@ void platform_send_framebuffer(const void *fb) {
   #endif
 }
 
+/* Receive framebuffer with damage list.
+ * Only X11 can use it; everything else gets the whole frame whenever anything changed.
+ */
+
+void platform_send_framebuffer_damage(const void *fb,const struct damage_rect *rectv,int rectc) {
+  if (genioc.nodamage) {
+    platform_send_framebuffer(fb);
+    return;
+  }
+  #if PO_USE_x11
+    if (genioc.x11) {
+      po_x11_swap_damage(genioc.x11,fb,rectv,rectc);
+      return;
+    }
+  #endif
+  if (rectc>0) platform_send_framebuffer(fb);
+}
+
 /* USB stub.
  */
  
@@ -300,35 +359,83 @@ int main(int argc,char **argv) {
     return 1;
   }
   
+  if (genioc_init_replay(argc,argv)<0) {
+    genioc_quit_drivers();
+    return 1;
+  }
+  genioc.nodamage=genioc_argv_get_boolean(argc,argv,"--no-damage");
+  if (genioc_init_world(argc,argv)<0) {
+    replay_end();
+    genioc_quit_drivers();
+    return 1;
+  }
+  
   setup();
+  genioc_audio_init(
+    genioc_argv_get_string(argc,argv,"--audio-device",0),
+    genioc_argv_get_int(argc,argv,"--audio-rate",22050),
+    genioc_argv_get_int(argc,argv,"--audio-chanc",1)
+  );
   
-  int framec=0;
+  /* Updates run on a fixed 1/60 s schedule of real time, and we render once after each batch of them.
+   * When we fall behind, run up to GENIOC_UPDATE_BUDGET updates back to back before rendering,
+   * and skip the render itself if the next update is already due, up to GENIOC_SKIP_LIMIT in a row.
+   * So slow rendering costs frames on screen, not time in the game.
+   * Only if updates alone can't keep up do we drop the backlog, and then the game does slow down.
+   */
+  #define GENIOC_UPDATE_BUDGET 4
+  #define GENIOC_SKIP_LIMIT 3
+  int updatec=0,renderc=0,skipc=0,dropc=0,skipstreak=0;
+  int spin_us=genioc_argv_get_int(argc,argv,"--spin-us",0);
+  struct histogram starterr={0}; // how late each loop woke up, vs the update it was waiting for
+  struct histogram loopdur={0}; // wake to end of render
   const int64_t frametime=1000000/60;
   int64_t nexttime=now_us();
   int64_t starttime=nexttime;
-  while (!genioc.terminate&&!genioc.sigc) {
+  while (!genioc.terminate&&!genioc.sigc&&!replay_finished()) {
     
+    if (now_us()<nexttime) sleep_until_us(nexttime,spin_us);
     int64_t now=now_us();
-    while (now<nexttime) {
-      int64_t sleeptime=nexttime-now;
-      if (sleeptime>100000) {
-        nexttime=now;
-        break;
-      }
-      if (sleeptime>0) sleep_us(sleeptime);
+    int64_t loopstart=now;
+    histogram_add(&starterr,now-nexttime);
+    
+    int batchc=0;
+    while ((now>=nexttime)&&(batchc<GENIOC_UPDATE_BUDGET)&&!replay_finished()) {
+      loop_update();
+      nexttime+=frametime;
+      updatec++;
+      batchc++;
       now=now_us();
     }
-    nexttime+=frametime;
-    framec++;
+    genioc_audio_update();
+    if (now>=nexttime+frametime*GENIOC_UPDATE_BUDGET) {
+      dropc+=(now-nexttime)/frametime;
+      nexttime=now;
+    }
     
-    loop();
+    if ((now>=nexttime)&&(skipstreak<GENIOC_SKIP_LIMIT)) {
+      skipc++;
+      skipstreak++;
+    } else {
+      loop_render();
+      renderc++;
+      skipstreak=0;
+    }
+    histogram_add(&loopdur,now_us()-loopstart);
   }
   
-  if (framec>0) {
-    double elapsed=(nexttime-starttime)/1000000.0;
-    fprintf(stderr,"%d video frames in %.03fs, average %.03f Hz\n",framec,elapsed,framec/elapsed);
+  if (updatec>0) {
+    double elapsed=(now_us()-starttime)/1000000.0;
+    fprintf(stderr,
+      "%d updates, %d renders in %.03fs: average %.03f Hz update, %.03f Hz render. Skipped %d renders, dropped %d updates.\n",
+      updatec,renderc,elapsed,updatec/elapsed,renderc/elapsed,skipc,dropc
+    );
+    histogram_log(&starterr,"Frame start error");
+    histogram_log(&loopdur,"Loop duration");
   }
   
+  genioc_audio_quit();
+  replay_end();
   genioc_quit_drivers();
   fprintf(stderr,"Normal exit.\n");
   return 0;
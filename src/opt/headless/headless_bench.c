@@ -0,0 +1,344 @@
+#include "headless_internal.h"
+#include "main/data.h"
+#include "main/game.h"
+#include "main/world.h"
+
+/* Blit benchmark.
+ * The fgbits rectangles that sprite_render_ivan() and sprite_render_guard() use, both ways round,
+ * blitted all over a scratch framebuffer with each SIMD level this CPU supports.
+ * Then once more with fgbits' opaque spans instead, which skip the per-pixel tests altogether,
+ * and once with the compiled sprites (src/data/embed/fgbits.sprites), which skip the source image entirely.
+ * Every variant must produce the same picture as scalar.
+ */
+
+struct headless_bench_rect {
+  int16_t x,y,w,h;
+  void (*spr)(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+  uint8_t frame;
+};
+
+static const struct headless_bench_rect headless_bench_rectv[]={
+  // Ivan
+  {0,61,11,11,spr_ivan_dead,0},{11,61,11,11,spr_ivan_dead,1},
+  {22,0,9,5,spr_torso,0},{31,0,9,5,spr_torso,1},{40,0,9,5,spr_torso,2},
+  {0,9,7,3,spr_legs,0},{7,9,7,3,spr_legs,1},{14,9,7,3,spr_legs,2},
+  {0,0,5,5,spr_ivan_head,0},{5,0,5,5,spr_ivan_head,1},
+  {0,17,14,3,spr_ivan_shovel,0},{17,0,5,5,spr_ivan_dirt,0},{5,20,8,8,spr_ivan_statue,0},{30,28,3,5,spr_ivan_arm,0},
+  // Guard
+  {10,0,7,5,spr_guard_head,0},
+  {28,5,5,8,spr_guard_climb,0},{33,5,5,8,spr_guard_climb,1},
+  {43,5,8,5,spr_guard_violation,0},
+};
+#define HEADLESS_BENCH_RECTC (sizeof(headless_bench_rectv)/sizeof(headless_bench_rectv[0]))
+
+#define HEADLESS_BENCH_PASSES 2000
+
+static uint32_t headless_bench_blit_1(struct image *dst,int compiled) {
+  uint32_t blitc=0;
+  int16_t dsty=-4;
+  for (;dsty<64;dsty+=5) {
+    int16_t dstx=-6;
+    for (;dstx<96;dstx+=7) {
+      const struct headless_bench_rect *rect=headless_bench_rectv+((dstx+dsty)&0xff)%HEADLESS_BENCH_RECTC;
+      if (compiled) rect->spr(dst,dstx,dsty,rect->frame,dstx&1);
+      else if (dstx&1) image_blit_colorkey_flop(dst,dstx,dsty,&fgbits,rect->x,rect->y,rect->w,rect->h);
+      else image_blit_colorkey(dst,dstx,dsty,&fgbits,rect->x,rect->y,rect->w,rect->h);
+      blitc++;
+    }
+  }
+  return blitc;
+}
+
+static uint32_t headless_bench_hash(const struct image *image) {
+  uint32_t h=0x811c9dc5;
+  const uint8_t *src=(uint8_t*)image->v;
+  int i=image->w*image->h*2;
+  for (;i-->0;src++) {
+    h^=*src;
+    h*=0x01000193;
+  }
+  return h;
+}
+
+static void headless_bench_blit_variant(struct image *dst,const char *name,int compiled,uint32_t *expect,int *status) {
+  uint16_t *storage=dst->v;
+
+  // Check the picture first. Start from a pattern, so the colorkey has something to preserve.
+  int i=96*64; while (i-->0) storage[i]=i*0x9e37;
+  headless_bench_blit_1(dst,compiled);
+  uint32_t hash=headless_bench_hash(dst);
+  if (!*expect) *expect=hash;
+  else if (hash!=*expect) *status=1;
+
+  double starttime=headless_now();
+  uint32_t blitc=0;
+  int passp=HEADLESS_BENCH_PASSES;
+  while (passp-->0) blitc+=headless_bench_blit_1(dst,compiled);
+  double elapsed=headless_now()-starttime;
+
+  fprintf(stderr,
+    "blit %-6s: %d blits in %.03fs, %.1f ns/blit%s\n",
+    name,blitc,elapsed,(elapsed*1000000000.0)/blitc,
+    (hash==*expect)?"":", WRONG PICTURE"
+  );
+}
+
+static int headless_bench_blit() {
+  uint16_t storage[96*64];
+  struct image dst={.v=storage,.w=96,.h=64,.stride=96};
+  int restore=image_simd_get();
+  int restore_spans=image_spans_set(0);
+  uint32_t expect=0;
+  int status=0;
+  int level=IMAGE_SIMD_NONE;
+  for (;level<=IMAGE_SIMD_NEON;level++) {
+    if (image_simd_set(level)<0) continue;
+    headless_bench_blit_variant(&dst,image_simd_name(level),0,&expect,&status);
+  }
+  if (fgbits.spans) {
+    image_simd_set(IMAGE_SIMD_NONE);
+    image_spans_set(1);
+    headless_bench_blit_variant(&dst,"spans",0,&expect,&status);
+    image_spans_set(0);
+  }
+  headless_bench_blit_variant(&dst,"sprite",1,&expect,&status);
+  image_simd_set(restore);
+  image_spans_set(restore_spans);
+  return status;
+}
+
+/* Sprite stress.
+ * A real round with as many extra guards and bullets as SPRITE_LIMIT allows, scattered over the surface.
+ * Reports update time per sprite at a few population sizes.
+ * The world doesn't grow with them, so each sprite's neighborhood gets more crowded, and per-sprite cost rises with that crowd.
+ * Then bare overlap queries, index against a walk over every slot. The walk pays for every sprite, the index only for nearby ones.
+ * The default limit is small. For the real thing, build with eg -DSPRITE_LIMIT=4096.
+ */
+ 
+#define HEADLESS_BENCH_SPRITE_FRAMES 120
+#define HEADLESS_BENCH_SPRITE_QUERIES 20000
+
+static void headless_bench_sprites_populate(int count) {
+  game_begin(1);
+  int i=0;
+  for (;i<count;i++) {
+    struct sprite *sprite=sprite_new((i&1)?SPRITE_CONTROLLER_BULLET:SPRITE_CONTROLLER_GUARD);
+    if (!sprite) break;
+    sprite->x=(game_rand()%WORLD_W_TILES)*TILE_W_MM;
+    if (i&1) {
+      sprite->w=2*MM_PER_PIXEL;
+      sprite->h=2*MM_PER_PIXEL;
+      sprite->y=(WORLD_H_TILES>>1)*TILE_H_MM-(6+game_rand()%8)*MM_PER_PIXEL;
+      SPRITE_STATE(bullet,sprite)->dx=(game_rand()&1)?1:-1;
+    } else {
+      sprite->w=5*MM_PER_PIXEL;
+      sprite->h=11*MM_PER_PIXEL;
+      sprite->y=(WORLD_H_TILES>>1)*TILE_H_MM-sprite->h;
+    }
+  }
+}
+
+static int headless_bench_sprites_count() {
+  int c=0;
+  struct sprite *sprite;
+  for (sprite=sprite_next(0);sprite;sprite=sprite_next(sprite)) c++;
+  return c;
+}
+
+static uint16_t headless_bench_sprites_walk(coord_t x,coord_t y) {
+  uint16_t c=0;
+  const struct sprite *sprite=spritev;
+  int i=SPRITE_LIMIT;
+  for (;i-->0;sprite++) {
+    if (!sprite->controller) continue;
+    if ((x<sprite->x)||(y<sprite->y)||(x>=sprite->x+sprite->w)||(y>=sprite->y+sprite->h)) continue;
+    c++;
+  }
+  return c;
+}
+
+/* Slot reuse far out in a wide world.
+ * Rebuild links a sprite's slot at its column, then the slot is freed and reused at the same column before the next query.
+ * Columns past 127 must survive the round trip through the index's bookkeeping, or the slot links to itself and the query never ends.
+ */
+
+static int headless_bench_sprites_wide() {
+  int16_t restorew=WORLD_W_TILES,restoreh=WORLD_H_TILES;
+  world_set_size(WORLD_W_TILES_LIMIT,restoreh);
+  game_begin(1);
+  coord_t x=(WORLD_W_TILES-1)*TILE_W_MM+TILE_W_MM/2;
+  coord_t y=(WORLD_H_TILES>>1)*TILE_H_MM-8*MM_PER_PIXEL;
+  int status=0;
+  struct sprite *sprite=sprite_new(SPRITE_CONTROLLER_BULLET);
+  if (sprite) {
+    sprite->x=x;
+    sprite->y=y;
+    sprite->w=2*MM_PER_PIXEL;
+    sprite->h=2*MM_PER_PIXEL;
+    sprite_index_rebuild();
+    sprite_del(sprite);
+    struct sprite *again=sprite_new(SPRITE_CONTROLLER_BULLET);
+    if (again) {
+      again->x=x;
+      again->y=y;
+      again->w=2*MM_PER_PIXEL;
+      again->h=2*MM_PER_PIXEL;
+    }
+    struct sprite *hitv[16];
+    uint16_t indexc=sprite_find(hitv,16,x,y,1,1);
+    uint16_t walkc=headless_bench_sprites_walk(x,y);
+    fprintf(stderr,
+      "sprites wide: column %d, slot %s, index %d, walk %d%s\n",
+      WORLD_W_TILES-1,(again==sprite)?"reused":"not reused",indexc,walkc,
+      ((indexc==walkc)&&walkc)?"":", MISMATCH"
+    );
+    if ((indexc!=walkc)||!walkc) status=1;
+  }
+  game_end();
+  world_set_size(restorew,restoreh);
+  return status;
+}
+
+static int headless_bench_sprites() {
+  if (headless_bench_sprites_wide()) return 1;
+  int extra=SPRITE_LIMIT/8;
+  if (extra<1) extra=1;
+  for (;;extra<<=1) {
+    if (extra>SPRITE_LIMIT) extra=SPRITE_LIMIT;
+  
+    // Update.
+    headless_bench_sprites_populate(extra);
+    int spritec=headless_bench_sprites_count();
+    double starttime=headless_now();
+    int sumc=0,i=HEADLESS_BENCH_SPRITE_FRAMES;
+    while (i-->0) {
+      game_input(0,0);
+      game_update();
+      sumc+=headless_bench_sprites_count();
+    }
+    double elapsed=headless_now()-starttime;
+    fprintf(stderr,
+      "sprites %5d: update %8.1f us/frame, %6.1f ns/sprite\n",
+      spritec,(elapsed*1000000.0)/HEADLESS_BENCH_SPRITE_FRAMES,(elapsed*1000000000.0)/(sumc?sumc:1)
+    );
+    
+    // Queries. Both must agree on every answer.
+    headless_bench_sprites_populate(extra);
+    sprite_index_rebuild();
+    struct sprite *hitv[16];
+    uint32_t seed=1,indexsum=0,walksum=0;
+    starttime=headless_now();
+    for (i=HEADLESS_BENCH_SPRITE_QUERIES;i-->0;) {
+      seed=seed*1103515245+12345;
+      indexsum+=sprite_find(hitv,16,(seed>>8)%WORLD_W_MM,(WORLD_H_TILES>>1)*TILE_H_MM-(seed>>24)%(12*MM_PER_PIXEL),1,1);
+    }
+    double indextime=headless_now()-starttime;
+    seed=1;
+    starttime=headless_now();
+    for (i=HEADLESS_BENCH_SPRITE_QUERIES;i-->0;) {
+      seed=seed*1103515245+12345;
+      walksum+=headless_bench_sprites_walk((seed>>8)%WORLD_W_MM,(WORLD_H_TILES>>1)*TILE_H_MM-(seed>>24)%(12*MM_PER_PIXEL));
+    }
+    double walktime=headless_now()-starttime;
+    fprintf(stderr,
+      "sprites %5d: query index %6.1f ns, walk %8.1f ns%s\n",
+      headless_bench_sprites_count(),
+      (indextime*1000000000.0)/HEADLESS_BENCH_SPRITE_QUERIES,
+      (walktime*1000000000.0)/HEADLESS_BENCH_SPRITE_QUERIES,
+      (indexsum==walksum)?"":", MISMATCH"
+    );
+    if (indexsum!=walksum) {
+      game_end();
+      return 1;
+    }
+    
+    if (extra>=SPRITE_LIMIT) break;
+  }
+  game_end();
+  return 0;
+}
+
+/* Sprite layout.
+ * The real batch update, game_update_sprites(), over a populated round of guards and bullets,
+ * against one walk in slot order that switches on each sprite's controller, as game_update() did before the split.
+ * Both call the same per-sprite updates on the same split storage, so any difference is the walk:
+ * Batches stream each controller's headers and pool in order, the switch walk hops between pools.
+ * The per-sprite work, collisions above all, tends to swamp that.
+ * A few hundred sprites fit in L1 either way, so "warm" passes run back to back and barely differ.
+ * Between real frames, the world and framebuffer push them out; "cold" passes sweep a scratch buffer first to model that.
+ * Counts stop at SPRITE_LIMIT. For the real thing, build with eg -DSPRITE_LIMIT=4096.
+ */
+
+#define HEADLESS_BENCH_LAYOUT_PASSES 200
+#define HEADLESS_BENCH_LAYOUT_SWEEP (4<<20)
+
+static void headless_bench_layout_dispatch() {
+  struct sprite *sprite;
+  for (sprite=sprite_next(0);sprite;sprite=sprite_next(sprite)) {
+    switch (sprite->controller) {
+      case SPRITE_CONTROLLER_IVAN: sprite_update_ivan(sprite); break;
+      case SPRITE_CONTROLLER_GUARD: sprite_update_guard(sprite); break;
+      case SPRITE_CONTROLLER_BULLET: sprite_update_bullet(sprite); break;
+      case SPRITE_CONTROLLER_FAIRY: sprite_update_fairy(sprite); break;
+    }
+  }
+}
+
+// => ns per sprite updated. Each variant starts from the same fresh round.
+static double headless_bench_layout_time(int count,uint8_t *sweep,void (*pass)()) {
+  headless_bench_sprites_populate(count);
+  double elapsed=0.0;
+  int spritec=0;
+  int passp=HEADLESS_BENCH_LAYOUT_PASSES;
+  while (passp-->0) {
+    if (sweep) {
+      uint8_t *v=sweep;
+      int i=HEADLESS_BENCH_LAYOUT_SWEEP;
+      for (;i>0;i-=64,v+=64) (*v)++;
+    }
+    sprite_index_rebuild();
+    spritec+=headless_bench_sprites_count();
+    double starttime=headless_now();
+    pass();
+    elapsed+=headless_now()-starttime;
+  }
+  game_end();
+  return (elapsed*1000000000.0)/(spritec?spritec:1);
+}
+
+static int headless_bench_layout() {
+  uint8_t *sweep=calloc(1,HEADLESS_BENCH_LAYOUT_SWEEP);
+  if (!sweep) return 1;
+  const int countv[]={128,384,1024};
+  int i=0;
+  for (;i<sizeof(countv)/sizeof(countv[0]);i++) {
+    int count=countv[i];
+    if (count>=SPRITE_LIMIT) count=SPRITE_LIMIT;
+    headless_bench_sprites_populate(count);
+    int spritec=headless_bench_sprites_count();
+    game_end();
+    int cold=0;
+    for (;cold<2;cold++) {
+      double batch=headless_bench_layout_time(count,cold?sweep:0,game_update_sprites);
+      double dispatch=headless_bench_layout_time(count,cold?sweep:0,headless_bench_layout_dispatch);
+      fprintf(stderr,
+        "layout %5d %s: batch %7.2f ns/sprite, switch %7.2f ns/sprite\n",
+        spritec,cold?"cold":"warm",batch,dispatch
+      );
+    }
+    if (count>=SPRITE_LIMIT) break;
+  }
+  free(sweep);
+  return 0;
+}
+
+/* Benchmark dispatch.
+ */
+
+int headless_bench(const char *name) {
+  if (!strcmp(name,"blit")) return headless_bench_blit();
+  if (!strcmp(name,"sprites")) return headless_bench_sprites();
+  if (!strcmp(name,"layout")) return headless_bench_layout();
+  fprintf(stderr,"Unknown benchmark '%s'. Try: blit sprites layout\n",name);
+  return 1;
+}
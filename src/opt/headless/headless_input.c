@@ -0,0 +1,200 @@
+#include "headless_internal.h"
+#include "main/game.h"
+#include "main/world.h"
+
+/* Private PRNG, independent of the game's.
+ */
+
+static uint32_t headless_random() {
+  uint32_t x=headless_runner.prng;
+  x^=x<<13;
+  x^=x>>17;
+  x^=x<<5;
+  return headless_runner.prng=x;
+}
+
+/* Add a step to the script.
+ */
+
+static int headless_input_add_step(uint8_t input,int framec) {
+  if (headless.stepc>=headless.stepa) {
+    int na=headless.stepa+32;
+    void *nv=realloc(headless.stepv,sizeof(struct headless_step)*na);
+    if (!nv) return -1;
+    headless.stepv=nv;
+    headless.stepa=na;
+  }
+  struct headless_step *step=headless.stepv+headless.stepc++;
+  step->input=input;
+  step->framec=framec;
+  return 0;
+}
+
+/* Load script.
+ * One step per line: FRAMEC BUTTONS
+ * BUTTONS is any combination of "LRUDAB", or "-" for none.
+ * '#' begins a line comment.
+ * The script repeats until the round ends.
+ */
+
+int headless_input_load_script(const char *path) {
+  FILE *f=fopen(path,"r");
+  if (!f) {
+    fprintf(stderr,"%s: Failed to open script.\n",path);
+    return -1;
+  }
+  char line[256];
+  int lineno=0;
+  while (fgets(line,sizeof(line),f)) {
+    lineno++;
+    char *src=line;
+    while ((*src==' ')||(*src=='\t')) src++;
+    if (!*src||(*src=='#')||(*src=='\n')||(*src=='\r')) continue;
+    int framec=0;
+    while ((*src>='0')&&(*src<='9')) {
+      framec*=10;
+      framec+=(*src++)-'0';
+      if (framec>1000000) break;
+    }
+    while ((*src==' ')||(*src=='\t')) src++;
+    uint8_t input=0;
+    for (;*src&&(*src!='#')&&(*src!='\n')&&(*src!='\r')&&(*src!=' ');src++) switch (*src) {
+      case 'L': input|=BUTTON_LEFT; break;
+      case 'R': input|=BUTTON_RIGHT; break;
+      case 'U': input|=BUTTON_UP; break;
+      case 'D': input|=BUTTON_DOWN; break;
+      case 'A': input|=BUTTON_A; break;
+      case 'B': input|=BUTTON_B; break;
+      case '-': break;
+      default: {
+          fprintf(stderr,"%s:%d: Unexpected character '%c' in buttons.\n",path,lineno,*src);
+          fclose(f);
+          return -1;
+        }
+    }
+    if (framec<1) {
+      fprintf(stderr,"%s:%d: Expected frame count >0.\n",path,lineno);
+      fclose(f);
+      return -1;
+    }
+    if (headless_input_add_step(input,framec)<0) {
+      fclose(f);
+      return -1;
+    }
+  }
+  fclose(f);
+  if (!headless.stepc) {
+    fprintf(stderr,"%s: Script is empty.\n",path);
+    return -1;
+  }
+  headless.input_mode=HEADLESS_INPUT_SCRIPT;
+  return 0;
+}
+
+/* Reset at the start of each round.
+ */
+
+void headless_input_reset(uint32_t seed) {
+  headless_runner.stepp=0;
+  headless_runner.stepframe=0;
+  headless_runner.prng=seed?seed:0x12345678;
+  headless_runner.input=0;
+}
+
+/* Random input, with just enough policy to survive a round and score.
+ * Guards only shoot over a violation, and the truck only gets loaded while it's off camera.
+ * So first fetch the shovel, then stay right of the truck, close enough that the camera keeps it in view,
+ * and never pile dirt higher than the statue. A delivery can still land in the first couple seconds, and then the round scores zero.
+ * Inside that strip, hold some plausible combination for a random interval,
+ * weighted toward walking and digging. Never UP once we have the shovel, that would drop it.
+ */
+
+#define HEADLESS_HOME_COLA (TRUCK_BED_COL+3) /* truck_available() wants the camera at least 15 tiles in, ie hero at 21 */
+#define HEADLESS_HOME_COLZ (TRUCK_BED_COL+7)
+
+// Walk the short way around from column (from) toward (to), hopping now and then to get over bumps and out of holes.
+static uint8_t headless_input_toward(int16_t from,int16_t to) {
+  int16_t d=to-from;
+  if (d>WORLD_W_TILES>>1) d-=WORLD_W_TILES;
+  else if (d<-(WORLD_W_TILES>>1)) d+=WORLD_W_TILES;
+  uint8_t input=(d<0)?BUTTON_LEFT:(d>0)?BUTTON_RIGHT:0;
+  if (headless_runner.playframec&16) input|=BUTTON_A;
+  return input;
+}
+
+static uint8_t headless_input_random() {
+  const struct sprite *hero=game_get_hero();
+  if (!hero) return 0;
+  coord_t midx=hero->x+(hero->w>>1);
+  int16_t col=(midx/TILE_W_MM)%WORLD_W_TILES;
+  
+  // Shovel lying around? Go get it, and tap UP once it's under us.
+  const struct sprite *shovel=sprite_next_of(SPRITE_CONTROLLER_SHOVEL,0);
+  if (shovel) {
+    headless_runner.stepframe=0;
+    if ((midx>=shovel->x)&&(midx<shovel->x+shovel->w)) {
+      headless_runner.input=(headless_runner.input==BUTTON_UP)?0:BUTTON_UP;
+    } else {
+      headless_runner.input=headless_input_toward(col,(shovel->x+(shovel->w>>1))/TILE_W_MM);
+    }
+    return headless_runner.input;
+  }
+  
+  // Wandered off? Head home.
+  if ((col<HEADLESS_HOME_COLA)||(col>HEADLESS_HOME_COLZ)) {
+    headless_runner.stepframe=0;
+    return headless_runner.input=headless_input_toward(col,(HEADLESS_HOME_COLA+HEADLESS_HOME_COLZ)>>1);
+  }
+  
+  // Don't let the held input carry us out of the strip.
+  if (headless_runner.stepframe-->0) {
+    if (col<=HEADLESS_HOME_COLA) headless_runner.input&=~BUTTON_LEFT;
+    if (col>=HEADLESS_HOME_COLZ) headless_runner.input&=~BUTTON_RIGHT;
+    return headless_runner.input;
+  }
+  static const uint8_t choices[]={
+    0,
+    BUTTON_LEFT,
+    BUTTON_RIGHT,
+    BUTTON_LEFT,
+    BUTTON_RIGHT,
+    BUTTON_LEFT|BUTTON_A,
+    BUTTON_RIGHT|BUTTON_A,
+    BUTTON_A,
+    BUTTON_B,
+    BUTTON_B,
+    BUTTON_DOWN,
+  };
+  uint32_t r=headless_random();
+  uint8_t input=choices[r%sizeof(choices)];
+  // B digs or deposits. Standing on a pile, a deposit could reach the statue's height, so only from ground level or below.
+  if ((input&BUTTON_B)&&(hero->y+hero->h<WORLD_HORIZON*TILE_H_MM)) input=0;
+  headless_runner.input=input;
+  headless_runner.stepframe=4+(r>>8)%60;
+  return input;
+}
+
+/* Scripted input.
+ */
+
+static uint8_t headless_input_script() {
+  const struct headless_step *step=headless.stepv+headless_runner.stepp;
+  if (headless_runner.stepframe>=step->framec) {
+    headless_runner.stepframe=0;
+    if (++(headless_runner.stepp)>=headless.stepc) headless_runner.stepp=0;
+    step=headless.stepv+headless_runner.stepp;
+  }
+  headless_runner.stepframe++;
+  return step->input;
+}
+
+/* Next input state.
+ */
+
+uint8_t headless_input_next() {
+  switch (headless.input_mode) {
+    case HEADLESS_INPUT_RANDOM: return headless_input_random();
+    case HEADLESS_INPUT_SCRIPT: return headless_input_script();
+  }
+  return 0;
+}
@@ -0,0 +1,94 @@
+/* headless_internal.h
+ * Null platform for measuring the game core.
+ * No video, no audio, no real input: We run loop() as fast as the CPU allows and feed it scripted input.
+ * Time, as far as the game can tell, advances exactly 1/60 s per frame.
+ */
+
+#ifndef HEADLESS_INTERNAL_H
+#define HEADLESS_INTERNAL_H
+
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "main/platform.h"
+
+#define HEADLESS_INPUT_RANDOM 0
+#define HEADLESS_INPUT_IDLE   1
+#define HEADLESS_INPUT_SCRIPT 2
+
+// One step of a script: Hold (input) for (framec) frames.
+struct headless_step {
+  uint8_t input;
+  int framec;
+};
+
+// Results from a worker thread, merged at the end.
+struct headless_stats {
+  int roundc;
+  uint32_t framec; // frames during play
+  double playtime; // s, wall time during play
+  double minfps,maxfps;
+  uint32_t scoresum,scoremin,scoremax;
+  // Only with --rewind:
+  uint32_t pushc,popc,rewindfailc;
+  double pushtime,poptime; // s
+  int rewindbytes; // peak
+  // Damage, every frame including the menu:
+  uint32_t presentc;
+  uint64_t damagepx;
+  uint32_t damagefailc; // only with --check-damage
+};
+
+// Read-only once workers start, except (roundnext).
+extern struct headless {
+  int roundc; // how many rounds to play
+  uint32_t seed; // round N uses (seed+N), for the game and for input
+  int verbose;
+  int threadc;
+  int replaying;
+  int rewindc;
+  int fbhashes;
+  int checkdamage;
+  int worldw,worldh; // tiles, zero for default
+
+  int input_mode;
+  struct headless_step *stepv;
+  int stepc,stepa;
+
+  int roundnext; // atomic; next round to claim
+} headless;
+
+// Per thread.
+extern GAME_LOCAL struct headless_runner {
+  int stepp; // current step
+  int stepframe; // frames elapsed in current step
+  uint32_t prng;
+  uint8_t input;
+
+  uint32_t framec; // total frames on this thread
+  uint32_t playframec; // frames since the current round began
+  uint32_t timebase; // millis() at the start of the current round, ie the seed
+  uint32_t fbc; // platform_send_framebuffer() count
+  uint64_t damagepx; // total pixels reported damaged
+  uint32_t damagefailc; // frames where the damage list missed something
+  uint16_t shadow[96*64]; // what a damage-aware driver would be showing, with --check-damage
+} headless_runner;
+
+/* headless_input.c
+ */
+int headless_input_load_script(const char *path);
+void headless_input_reset(uint32_t seed); // beginning of each round
+uint8_t headless_input_next(); // once per frame during play
+
+/* headless_bench.c
+ * Run a named microbenchmark, report to stderr, return process status.
+ */
+int headless_bench(const char *name);
+
+/* Current monotonic time in seconds, for our own measurements.
+ */
+double headless_now();
+
+#endif
@@ -0,0 +1,380 @@
+#include "headless_internal.h"
+#include "main/game.h"
+#include "main/menu.h"
+#include "main/replay.h"
+#include "main/snapshot.h"
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+struct headless headless={0};
+GAME_LOCAL struct headless_runner headless_runner={0};
+
+/* argv
+ */
+
+static void headless_print_help(const char *exename) {
+  fprintf(stderr,"Usage: %s [OPTIONS]\n",exename);
+  fprintf(stderr,
+    "Runs the game with no video, audio, or real input, as fast as possible.\n"
+    "OPTIONS:\n"
+    "  --rounds=INT           Play so many rounds, default 1.\n"
+    "  --seed=INT             Base for game and input randomness, default 1.\n"
+    "  --script=PATH          Input script, one 'FRAMEC BUTTONS' per line, eg '30 RA'. Repeats.\n"
+    "  --idle                 No input during play.\n"
+    "                         If neither --script nor --idle, we generate random input.\n"
+    "  --verbose              Log each round.\n"
+    "  --rewind=INT           Push every frame of play into a rewind ring of this size, and verify it at the end of each round.\n"
+    "  --threads=INT          Run so many games concurrently, default 1. 0 for one per CPU.\n"
+    "  --record=PATH          Record input to a replay file.\n"
+    "  --replay=PATH          Play back a replay file instead of generating input. Ignores --rounds.\n"
+    "  --fb-hashes            Log a hash of every framebuffer to stderr.\n"
+    "                         --record, --replay, --hashes, and --fb-hashes require --threads=1.\n"
+    "  --hash-interval=INT    Frames between hashes when recording, default 60.\n"
+    "  --hashes               Log every frame's state hash to stderr.\n"
+    "  --bench=NAME           Run a microbenchmark instead of playing: blit sprites layout\n"
+    "  --check-damage         Apply each frame's damage list to a copy of the framebuffer, and count frames where they differ.\n"
+    "  --world=WxH            World size in tiles, eg 1024x256. Default and minimum 60x32. Replays override.\n"
+  );
+}
+
+static int headless_argv_get_boolean(int argc,char **argv,const char *k) {
+  int p=1; for (;p<argc;p++) {
+    if (!strcmp(argv[p],k)) return 1;
+  }
+  return 0;
+}
+
+static int headless_argv_get_int(int argc,char **argv,const char *k,int fallback) {
+  int kc=0; while (k[kc]) kc++;
+  int p=1; for (;p<argc;p++) {
+    if (memcmp(argv[p],k,kc)) continue;
+    if (argv[p][kc]!='=') continue;
+    int v=0;
+    const char *src=argv[p]+kc+1;
+    for (;*src;src++) {
+      if ((*src<'0')||(*src>'9')) return fallback;
+      v*=10;
+      v+=(*src)-'0';
+    }
+    return v;
+  }
+  return fallback;
+}
+
+static const char *headless_argv_get_string(int argc,char **argv,const char *k,const char *fallback) {
+  int kc=0; while (k[kc]) kc++;
+  int p=1; for (;p<argc;p++) {
+    if (memcmp(argv[p],k,kc)) continue;
+    if (argv[p][kc]!='=') continue;
+    return argv[p]+kc+1;
+  }
+  return fallback;
+}
+
+/* Platform API.
+ */
+
+uint8_t platform_init() {
+  return 1;
+}
+
+uint8_t platform_update() {
+  headless_runner.framec++;
+  // Outside of play, mash A to get through the menu.
+  if (!gameclock) return (headless_runner.framec&1)?BUTTON_A:0;
+  headless_runner.playframec++;
+  return headless_input_next();
+}
+
+void platform_send_framebuffer(const void *fb) {
+  headless_runner.fbc++;
+  if (headless.fbhashes) {
+    // FNV-1a of the 96x64 framebuffer, to prove that rendering changes don't change the picture.
+    uint32_t h=0x811c9dc5;
+    const uint8_t *src=fb;
+    int i=96*64*2;
+    for (;i-->0;src++) {
+      h^=*src;
+      h*=0x01000193;
+    }
+    fprintf(stderr,"FB %d %08x\n",headless_runner.framec,h);
+  }
+}
+
+void platform_send_framebuffer_damage(const void *fb,const struct damage_rect *rectv,int rectc) {
+  for (;rectc-->0;rectv++) {
+    headless_runner.damagepx+=rectv->w*rectv->h;
+    if (headless.checkdamage) {
+      const uint16_t *src=(const uint16_t*)fb+rectv->y*96+rectv->x;
+      uint16_t *dst=headless_runner.shadow+rectv->y*96+rectv->x;
+      int yi=rectv->h;
+      for (;yi-->0;src+=96,dst+=96) memcpy(dst,src,rectv->w<<1);
+    }
+  }
+  if (headless.checkdamage&&memcmp(headless_runner.shadow,fb,sizeof(headless_runner.shadow))) {
+    headless_runner.damagefailc++;
+    memcpy(headless_runner.shadow,fb,sizeof(headless_runner.shadow));
+  }
+  platform_send_framebuffer(fb);
+}
+
+void usb_send(const void *v,int c) {
+}
+
+int usb_read(void *dst,int dsta) {
+  return -1;
+}
+
+int usb_read_byte() {
+  return -1;
+}
+
+/* Clock. Game sees simulated time, we measure real time.
+ * Game time stands still in the menu, so each round's seed depends only on its index, not on which thread played it or when.
+ */
+
+uint32_t millis() {
+  return headless_runner.timebase+(uint32_t)(((uint64_t)headless_runner.playframec*1000)/60);
+}
+
+uint32_t micros() {
+  return (uint32_t)(((uint64_t)headless_runner.framec*1000000)/60);
+}
+
+double headless_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+(double)tv.tv_nsec/1000000000.0;
+}
+
+/* Claim the next round, or <0 if they're all spoken for.
+ */
+
+static int headless_claim_round() {
+  if (headless.replaying) return 0; // replay decides how many rounds; we'll stop when it's finished
+  int roundp=__atomic_fetch_add(&headless.roundnext,1,__ATOMIC_RELAXED);
+  if (roundp>=headless.roundc) return -1;
+  return roundp;
+}
+
+/* Rewind the whole ring, verifying each state against the hashes we recorded going forward.
+ * Then put things back the way they were.
+ */
+
+static void headless_verify_rewind(struct headless_stats *stats,const uint32_t *hashv,uint32_t hashc) {
+  struct game_snapshot endstate;
+  game_snapshot(&endstate);
+  int peak=rewind_bytes();
+  if (peak>stats->rewindbytes) stats->rewindbytes=peak;
+  double starttime=headless_now();
+  uint32_t hashp=hashc;
+  while (rewind_count()>0) {
+    if (rewind_pop()<0) break;
+    hashp--;
+    if (replay_hash()!=hashv[hashp%headless.rewindc]) stats->rewindfailc++;
+    stats->popc++;
+  }
+  stats->poptime+=headless_now()-starttime;
+  game_restore(&endstate);
+}
+
+/* Worker: Play rounds until there are none left.
+ * Runs on the main thread if there's just one.
+ */
+
+static void *headless_worker(void *arg) {
+  struct headless_stats *stats=arg;
+  stats->scoremin=UINT32_MAX;
+  uint32_t *hashv=0,hashc=0;
+  if (headless.rewindc) {
+    if (rewind_init(headless.rewindc,0)<0) return 0;
+    if (!(hashv=calloc(headless.rewindc,sizeof(uint32_t)))) return 0;
+  }
+  if (headless.worldw) world_set_size(headless.worldw,headless.worldh);
+  setup();
+  int roundp=headless_claim_round();
+  if (roundp<0) return 0;
+  headless_runner.timebase=headless.seed+roundp;
+  int inround=0;
+  double roundstarttime=0.0;
+  while (!headless.replaying||!replay_finished()) {
+    loop();
+    if (inround&&hashv&&gameclock) {
+      double starttime=headless_now();
+      rewind_push();
+      stats->pushtime+=headless_now()-starttime;
+      stats->pushc++;
+      hashv[hashc++%headless.rewindc]=replay_hash();
+    }
+    if (inround) {
+      if (!gameclock) {
+        if (hashv) headless_verify_rewind(stats,hashv,hashc);
+        double elapsed=headless_now()-roundstarttime;
+        uint32_t framec=headless_runner.playframec;
+        double fps=(elapsed>0.0)?(framec/elapsed):0.0;
+        uint32_t score=menu_get_last_score();
+        if (headless.verbose) {
+          fprintf(stderr,
+            "round %d: %d frames in %.03fs, %.0f fps, score %d\n",
+            roundp,framec,elapsed,fps,score
+          );
+        }
+        if (!stats->roundc||(fps<stats->minfps)) stats->minfps=fps;
+        if (!stats->roundc||(fps>stats->maxfps)) stats->maxfps=fps;
+        stats->scoresum+=score;
+        if (score<stats->scoremin) stats->scoremin=score;
+        if (score>stats->scoremax) stats->scoremax=score;
+        stats->framec+=framec;
+        stats->playtime+=elapsed;
+        stats->roundc++;
+        inround=0;
+        if ((roundp=headless_claim_round())<0) break;
+        headless_runner.timebase=headless.seed+roundp;
+        headless_runner.playframec=0;
+      }
+    } else if (gameclock) {
+      inround=1;
+      headless_input_reset(headless.seed+roundp);
+      if (hashv) {
+        rewind_clear();
+        hashc=0;
+      }
+      roundstarttime=headless_now();
+    }
+  }
+  if (hashv) {
+    free(hashv);
+    rewind_quit();
+  }
+  stats->presentc=headless_runner.fbc;
+  stats->damagepx=headless_runner.damagepx;
+  stats->damagefailc=headless_runner.damagefailc;
+  return 0;
+}
+
+/* Main.
+ */
+
+int main(int argc,char **argv) {
+  if (headless_argv_get_boolean(argc,argv,"--help")) {
+    headless_print_help(argv[0]);
+    return 0;
+  }
+  const char *bench=headless_argv_get_string(argc,argv,"--bench",0);
+  if (bench) return headless_bench(bench);
+  headless.roundc=headless_argv_get_int(argc,argv,"--rounds",1);
+  headless.seed=headless_argv_get_int(argc,argv,"--seed",1);
+  headless.verbose=headless_argv_get_boolean(argc,argv,"--verbose");
+  headless.threadc=headless_argv_get_int(argc,argv,"--threads",1);
+  if (headless.threadc<1) {
+    long cpuc=sysconf(_SC_NPROCESSORS_ONLN);
+    headless.threadc=(cpuc>0)?cpuc:1;
+  }
+  headless.rewindc=headless_argv_get_int(argc,argv,"--rewind",0);
+  if (headless_argv_get_boolean(argc,argv,"--idle")) headless.input_mode=HEADLESS_INPUT_IDLE;
+  const char *script=headless_argv_get_string(argc,argv,"--script",0);
+  if (script&&(headless_input_load_script(script)<0)) return 1;
+
+  // Replay state lives with the main thread's game, so it only works single-threaded.
+  const char *recordpath=headless_argv_get_string(argc,argv,"--record",0);
+  const char *replaypath=headless_argv_get_string(argc,argv,"--replay",0);
+  int hashes=headless_argv_get_boolean(argc,argv,"--hashes");
+  headless.fbhashes=headless_argv_get_boolean(argc,argv,"--fb-hashes");
+  headless.checkdamage=headless_argv_get_boolean(argc,argv,"--check-damage");
+  const char *world=headless_argv_get_string(argc,argv,"--world",0);
+  if (world&&((sscanf(world,"%dx%d",&headless.worldw,&headless.worldh)!=2)||(headless.worldw<1)||(headless.worldh<1))) {
+    fprintf(stderr,"%s: Expected --world=WxH, eg 1024x256\n",argv[0]);
+    return 1;
+  }
+  if ((headless.threadc>1)&&(recordpath||replaypath||hashes||headless.fbhashes)) {
+    fprintf(stderr,"%s: --record, --replay, --hashes, and --fb-hashes require --threads=1\n",argv[0]);
+    return 1;
+  }
+  replay_set_hash_interval(headless_argv_get_int(argc,argv,"--hash-interval",60));
+  replay_set_hash_log(hashes);
+  if (recordpath&&(replay_record(recordpath)<0)) return 1;
+  if (replaypath) {
+    if (replay_play(replaypath)<0) return 1;
+    headless.replaying=1;
+  }
+
+  // Don't let our robot overwrite the real high score.
+  setenv("IVAND_HIGHSCORE","/dev/null",0);
+
+  struct headless_stats *statsv=calloc(headless.threadc,sizeof(struct headless_stats));
+  pthread_t *threadv=calloc(headless.threadc,sizeof(pthread_t));
+  if (!statsv||!threadv) return 1;
+  double starttime=headless_now();
+  if (headless.threadc==1) {
+    headless_worker(statsv);
+  } else {
+    int i=0; for (;i<headless.threadc;i++) {
+      if (pthread_create(threadv+i,0,headless_worker,statsv+i)) {
+        fprintf(stderr,"%s: Failed to create thread %d/%d\n",argv[0],i,headless.threadc);
+        return 1;
+      }
+    }
+    for (i=0;i<headless.threadc;i++) pthread_join(threadv[i],0);
+  }
+  double elapsed=headless_now()-starttime;
+  replay_end();
+
+  struct headless_stats total={.scoremin=UINT32_MAX};
+  const struct headless_stats *stats=statsv;
+  int i=headless.threadc; for (;i-->0;stats++) {
+    if (!stats->roundc) continue;
+    if (!total.roundc||(stats->minfps<total.minfps)) total.minfps=stats->minfps;
+    if (!total.roundc||(stats->maxfps>total.maxfps)) total.maxfps=stats->maxfps;
+    total.roundc+=stats->roundc;
+    total.framec+=stats->framec;
+    total.playtime+=stats->playtime;
+    total.scoresum+=stats->scoresum;
+    if (stats->scoremin<total.scoremin) total.scoremin=stats->scoremin;
+    if (stats->scoremax>total.scoremax) total.scoremax=stats->scoremax;
+    total.pushc+=stats->pushc;
+    total.popc+=stats->popc;
+    total.rewindfailc+=stats->rewindfailc;
+    total.pushtime+=stats->pushtime;
+    total.poptime+=stats->poptime;
+    if (stats->rewindbytes>total.rewindbytes) total.rewindbytes=stats->rewindbytes;
+    total.presentc+=stats->presentc;
+    total.damagepx+=stats->damagepx;
+    total.damagefailc+=stats->damagefailc;
+  }
+
+  fprintf(stderr,
+    "%d rounds, %d play frames, %d threads: per thread average %.0f fps (min %.0f, max %.0f)\n",
+    total.roundc,total.framec,headless.threadc,
+    (total.playtime>0.0)?(total.framec/total.playtime):0.0,total.minfps,total.maxfps
+  );
+  if (elapsed>0.0) {
+    fprintf(stderr,
+      "%.03fs wall time: aggregate %.0f fps, %.1f rounds/s\n",
+      elapsed,total.framec/elapsed,total.roundc/elapsed
+    );
+  }
+  if (total.roundc>0) {
+    fprintf(stderr,"score: min %d, max %d, average %d\n",total.scoremin,total.scoremax,total.scoresum/total.roundc);
+  }
+  if (total.pushc) {
+    fprintf(stderr,
+      "rewind: push %.03f us, pop %.03f us, peak %d bytes for %d frames, %d mismatches\n",
+      (total.pushtime*1000000.0)/total.pushc,
+      total.popc?((total.poptime*1000000.0)/total.popc):0.0,
+      total.rewindbytes,headless.rewindc,total.rewindfailc
+    );
+  }
+  if (total.presentc) {
+    fprintf(stderr,
+      "damage: average %.1f%% of framebuffer per frame",
+      (total.damagepx*100.0)/((double)total.presentc*96*64)
+    );
+    if (headless.checkdamage) fprintf(stderr,", %d frames missed something",total.damagefailc);
+    fprintf(stderr,"\n");
+  }
+  free(statsv);
+  free(threadv);
+  if (replay_divergence()>=0) return 1;
+  return 0;
+}
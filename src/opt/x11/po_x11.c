@@ -39,6 +39,7 @@ struct po_x11 {
   XImage *image;
   int dstx,dsty;
   int dstdirty;
+  int exposed; // window contents lost; resend the whole image, but it's still current
   int rshift,gshift,bshift;
   int scale;
   
@@ -91,7 +92,7 @@ static int po_x11_init(struct po_x11 *x11) {
   XSetWindowAttributes wattr={
     .background_pixel=0,
     .event_mask=
-      StructureNotifyMask|
+      StructureNotifyMask|ExposureMask|
       KeyPressMask|KeyReleaseMask|
       FocusChangeMask|
     0,
@@ -243,20 +244,16 @@ static inline void po_rgb_from_pixel(uint8_t *rgb,uint16_t src) {
   rgb[2]=(src&0xf8); rgb[2]|=rgb[2]>>5;
 }
 
-int po_x11_swap(struct po_x11 *x11,const void *fb) {
-  if (x11->dstdirty) {
-    if (po_x11_recalculate_output_bounds(x11)<0) return -1;
-    x11->dstdirty=0;
-    XClearWindow(x11->dpy,x11->win);
-  }
-  
-  const po_pixel_t *src=fb;
-  uint32_t *dst=(void*)x11->image->data;
-  int cpc=x11->image->width*4;
-  int yi=x11->fbh;
-  for (;yi-->0;) {
-    uint32_t *dststart=dst;
-    int xi=x11->fbw;
+// Convert one rect of (fb) into (image), scaling up.
+static void po_x11_convert(struct po_x11 *x11,const po_pixel_t *fb,int x,int y,int w,int h) {
+  const po_pixel_t *srcrow=fb+y*x11->fbw+x;
+  uint32_t *dstrow=(uint32_t*)x11->image->data+(y*x11->image->width+x)*x11->scale;
+  int cpc=w*x11->scale*4;
+  int yi=h;
+  for (;yi-->0;srcrow+=x11->fbw) {
+    const po_pixel_t *src=srcrow;
+    uint32_t *dst=dstrow;
+    int xi=w;
     for (;xi-->0;src++) {
       uint8_t rgb[3];
       po_rgb_from_pixel(rgb,*src);
@@ -264,12 +261,51 @@ int po_x11_swap(struct po_x11 *x11,const void *fb) {
       int ri=x11->scale;
       for (;ri-->0;dst++) *dst=pixel;
     }
+    uint32_t *dststart=dstrow;
+    dstrow+=x11->image->width;
     int ri=x11->scale-1;
-    for (;ri-->0;dst+=x11->image->width) memcpy(dst,dststart,cpc);
+    for (;ri-->0;dstrow+=x11->image->width) memcpy(dstrow,dststart,cpc);
+  }
+}
+
+int po_x11_swap(struct po_x11 *x11,const void *fb) {
+  if (x11->dstdirty) {
+    if (po_x11_recalculate_output_bounds(x11)<0) return -1;
+    x11->dstdirty=0;
+    XClearWindow(x11->dpy,x11->win);
   }
   
+  po_x11_convert(x11,fb,0,0,x11->fbw,x11->fbh);
   XPutImage(x11->dpy,x11->win,x11->gc,x11->image,0,0,x11->dstx,x11->dsty,x11->image->width,x11->image->height);
   
+  x11->exposed=0;
+  x11->screensaver_inhibited=0;
+  return 0;
+}
+
+int po_x11_swap_damage(struct po_x11 *x11,const void *fb,const struct damage_rect *rectv,int rectc) {
+  if (x11->dstdirty||!x11->image) return po_x11_swap(x11,fb);
+  
+  for (;rectc-->0;rectv++) {
+    int x=rectv->x,y=rectv->y,w=rectv->w,h=rectv->h;
+    if (x<0) { w+=x; x=0; }
+    if (y<0) { h+=y; y=0; }
+    if (x>x11->fbw-w) w=x11->fbw-x;
+    if (y>x11->fbh-h) h=x11->fbh-y;
+    if ((w<1)||(h<1)) continue;
+    po_x11_convert(x11,fb,x,y,w,h);
+    if (!x11->exposed) {
+      int s=x11->scale;
+      XPutImage(x11->dpy,x11->win,x11->gc,x11->image,x*s,y*s,x11->dstx+x*s,x11->dsty+y*s,w*s,h*s);
+    }
+  }
+  
+  // After an expose, (image) is still good. Send all of it.
+  if (x11->exposed) {
+    XPutImage(x11->dpy,x11->win,x11->gc,x11->image,0,0,x11->dstx,x11->dsty,x11->image->width,x11->image->height);
+    x11->exposed=0;
+  }
+  
   x11->screensaver_inhibited=0;
   return 0;
 }
@@ -373,6 +409,10 @@ static int po_x11_receive_event(struct po_x11 *x11,XEvent *evt) {
         }
       } break;
     
+    case Expose: {
+        x11->exposed=1;
+      } break;
+    
     case ConfigureNotify: {
         int nw=evt->xconfigure.width,nh=evt->xconfigure.height;
         if ((nw!=x11->winw)||(nh!=x11->winh)) {
@@ -18,6 +18,12 @@ struct po_x11 *po_x11_new(
 
 void *po_x11_get_userdata(const struct po_x11 *x11);
 int po_x11_swap(struct po_x11 *x11,const void *fb);
+
+/* Convert and send only the listed rects of (fb), in framebuffer pixels.
+ * Falls back to a full swap when the window changed.
+ */
+struct damage_rect;
+int po_x11_swap_damage(struct po_x11 *x11,const void *fb,const struct damage_rect *rectv,int rectc);
 int po_x11_set_fullscreen(struct po_x11 *x11,int state);
 void po_x11_inhibit_screensaver(struct po_x11 *x11);
 int po_x11_update(struct po_x11 *x11);
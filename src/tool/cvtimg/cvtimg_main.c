@@ -111,6 +111,61 @@ static int cvtimg_generate_tsv(struct tool *tool,struct png_image *image) {
   return 0;
 }
 
+/* Generate opaque-span tables for an image with transparency.
+ * ROWS has (h+1) entries, the index in RUNS of each row's first run, and the end.
+ * RUNS is (x,w) byte pairs, left to right. Widths up to 255, so rows can't be longer than that.
+ * Returns >0 if emitted, 0 if not applicable, <0 for errors.
+ */
+ 
+static int cvtimg_generate_spans(
+  struct tool *tool,const uint16_t *src,int w,int h,
+  const char *namestem,int namestemc
+) {
+  if ((w<1)||(w>255)||(h<1)) return 0;
+  uint16_t *rowv=malloc(sizeof(uint16_t)*(h+1));
+  int runa=1024,runc=0;
+  uint8_t *runv=malloc(runa*2);
+  if (!rowv||!runv) return -1;
+  int y=0; for (;y<h;y++) {
+    rowv[y]=runc;
+    int x=0; while (x<w) {
+      if (!src[y*w+x]) { x++; continue; }
+      int x0=x;
+      while ((x<w)&&src[y*w+x]) x++;
+      if (runc>=runa) {
+        runa<<=1;
+        void *nv=realloc(runv,runa*2);
+        if (!nv) return -1;
+        runv=nv;
+      }
+      runv[runc*2]=x0;
+      runv[runc*2+1]=x-x0;
+      runc++;
+    }
+  }
+  rowv[h]=runc;
+  if (runc>0xffff) { // indices would overflow; it won't happen at our sizes
+    free(rowv);
+    free(runv);
+    return 0;
+  }
+  
+  char name[256];
+  int namec=snprintf(name,sizeof(name),"%.*s_SPANROWS",namestemc,namestem);
+  if ((namec<1)||(namec>=sizeof(name))) return -1;
+  if (tool_generate_c_array(tool,"uint16_t",-1,name,namec,rowv,(h+1)*2)<0) return -1;
+  namec=snprintf(name,sizeof(name),"%.*s_SPANRUNS",namestemc,namestem);
+  if ((namec<1)||(namec>=sizeof(name))) return -1;
+  if (tool_generate_c_array(tool,"uint8_t",-1,name,namec,runv,runc?(runc*2):1)<0) return -1;
+  if (encode_fmt(&tool->dst,"const struct image_spans %.*s_SPANS={\n",namestemc,namestem)<0) return -1;
+  if (encode_fmt(&tool->dst,"  .rowv=%.*s_SPANROWS,\n",namestemc,namestem)<0) return -1;
+  if (encode_fmt(&tool->dst,"  .runv=%.*s_SPANRUNS,\n",namestemc,namestem)<0) return -1;
+  if (encode_fmt(&tool->dst,"};\n")<0) return -1;
+  free(rowv);
+  free(runv);
+  return 1;
+}
+
 /* Generate C from (image) into (tool->dst).
  */
  
@@ -136,6 +191,12 @@ static int cvtimg_generate_c(struct tool *tool,struct png_image *image) {
   int storagenamec=snprintf(storagename,sizeof(storagename),"%.*s_STORAGE",namestemc,namestem);
   if ((storagenamec<1)||(storagenamec>=sizeof(storagename))) return -1;
   if (tool_generate_c_array(tool,"uint16_t",-1,storagename,storagenamec,src,image->w*image->h*2)<0) return 1;
+  
+  // Images with alpha get drawn colorkeyed, so describe where the opaque pixels are.
+  int spans=0;
+  if (image->colortype==6) {
+    if ((spans=cvtimg_generate_spans(tool,src,image->w,image->h,namestem,namestemc))<0) return -1;
+  }
   free(src);
   
   if (encode_fmt(&tool->dst,"const struct image %.*s={\n",namestemc,namestem)<0) return -1;
@@ -143,6 +204,9 @@ static int cvtimg_generate_c(struct tool *tool,struct png_image *image) {
   if (encode_fmt(&tool->dst,"  .w=%d,\n",image->w)<0) return -1;
   if (encode_fmt(&tool->dst,"  .h=%d,\n",image->h)<0) return -1;
   if (encode_fmt(&tool->dst,"  .stride=%d,\n",image->w)<0) return -1;
+  if (spans) {
+    if (encode_fmt(&tool->dst,"  .spans=&%.*s_SPANS,\n",namestemc,namestem)<0) return -1;
+  }
   if (encode_fmt(&tool->dst,"};\n")<0) return -1;
   
   return 0;
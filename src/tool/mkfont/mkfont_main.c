@@ -72,6 +72,33 @@ static int mkfont(uint32_t *dst/*96*/,const struct png_image *src,struct tool *t
   return 0;
 }
 
+/* Unpack each glyph into 8 row masks, 0x80 is the leftmost column.
+ * Rows are relative to the top of the 8x8 cell, ie the glyph's (y) is already applied.
+ * Decodes exactly the way image_blit_glyph() does, so the two can't disagree.
+ */
+ 
+static int mkfont_rows(uint8_t *dst/*96*8*/,const uint32_t *src/*96*/,struct tool *tool) {
+  int codepoint=0x20;
+  for (;codepoint<0x80;codepoint++,src++,dst+=8) {
+    uint32_t glyph=*src;
+    int y=glyph>>30;
+    int w=(glyph>>27)&7;
+    if (!w) continue;
+    uint32_t mask=0x04000000;
+    int yi=0; for (;mask&&(yi<8);yi++) {
+      int xi=0; for (;mask&&(xi<w);xi++,mask>>=1) {
+        if (!(glyph&mask)) continue;
+        if (y+yi>=8) {
+          fprintf(stderr,"%s: Codepoint 0x%02x extends below its cell\n",tool->srcpath,codepoint);
+          return -1;
+        }
+        dst[y+yi]|=0x80>>xi;
+      }
+    }
+  }
+  return 0;
+}
+
 /* Main.
  */
 
@@ -105,6 +132,11 @@ int main(int argc,char **argv) {
   
   if (tool_generate_c_preamble(&tool)<0) return 1;
   if (tool_generate_c_array(&tool,"uint32_t",8,0,0,bin,sizeof(bin))<0) return 1;
+  
+  // And the same glyphs unpacked to row masks, for text.c.
+  uint8_t rows[96*8]={0};
+  if (mkfont_rows(rows,bin,&tool)<0) return 1;
+  if (tool_generate_c_array(&tool,"uint8_t",7,"font_rows",9,rows,sizeof(rows))<0) return 1;
   if (tool_write_output(&tool)<0) return 1;
   return 0;
 }
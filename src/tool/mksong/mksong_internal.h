@@ -15,7 +15,13 @@
 #define MKSONG_FRAMES_PER_TICK 256
 #define MIDI_READ_RATE (96*MKSONG_FRAMES_PER_TICK)
 
-// Same as SYNTH_VOICE_LIMIT. We'll fail during conversion if the song tries to hold more voices than this.
+/* Checkpoints for synth_seek(), in the additional header. See synth.h for the format.
+ * Every second or so. Seeking costs up to one interval of events, and the table costs 24 bytes per interval.
+ */
+#define MKSONG_SEEK_INTERVAL 96
+#define MKSONG_SEEK_ENTRY_SIZE 24 /* SYNTH_SEEK_ENTRY_SIZE, with MKSONG_HOLD_LIMIT held notes */
+
+// Same as SYNTH_MUSIC_VOICE_LIMIT on the smallest build. We'll fail during conversion if the song tries to hold more voices than this.
 #define MKSONG_HOLD_LIMIT 8
 
 struct mksong {
@@ -24,6 +30,8 @@ struct mksong {
   struct encoder song;
   struct encoder fakesheet;
   struct encoder bin;
+  struct encoder seek; // checkpoints, without the table's header
+  int seekc;
   int time; // frames
   int parttime; // time%MKSONG_FRAMES_PER_TICK; accumulates excess to smooth out timing.
   int timeticks; // ticks actually emitted (probably redundant)
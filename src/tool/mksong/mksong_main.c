@@ -9,11 +9,38 @@
 
 #include "mksong_internal.h"
 
+/* Append one seek checkpoint, at the current position.
+ */
+ 
+static int mksong_seek_append(struct mksong *mksong) {
+  if (encode_intle(&mksong->seek,mksong->timeticks,4)<0) return -1;
+  if (encode_intle(&mksong->seek,mksong->song.c,2)<0) return -1;
+  int holdcp=mksong->seek.c;
+  if (encode_intle(&mksong->seek,0,2)<0) return -1; // count, reserved
+  int holdc=0;
+  const struct mksong_hold *hold=mksong->holdv;
+  int i=MKSONG_HOLD_LIMIT;
+  for (;i-->0;hold++) {
+    if (!hold->noteid||hold->input) continue;
+    if (encode_intle(&mksong->seek,hold->waveid,1)<0) return -1;
+    if (encode_intle(&mksong->seek,hold->noteid,1)<0) return -1;
+    holdc++;
+  }
+  if (encode_null(&mksong->seek,(MKSONG_HOLD_LIMIT-holdc)*2)<0) return -1;
+  ((uint8_t*)mksong->seek.v)[holdcp]=holdc;
+  mksong->seekc++;
+  return 0;
+}
+
 /* Append a single song event.
  */
  
 static int mksong_song_append_delay(struct mksong *mksong,uint8_t tickc) {
   //fprintf(stderr,"emit delay %d\n",tickc);
+  // Checkpoints fall at the last point at or before each multiple of the interval, which is this one if the delay crosses it.
+  while (mksong->seekc*MKSONG_SEEK_INTERVAL<mksong->timeticks+(tickc&0x7f)) {
+    if (mksong_seek_append(mksong)<0) return -1;
+  }
   if (encode_intle(&mksong->song,tickc&0x7f,1)<0) return -1;
   mksong->timeticks+=(tickc&0x7f);
   return 0;
@@ -249,22 +276,53 @@ static int mksong_finish(struct mksong *mksong) {
     return -1;
   }
   
+  // Seek table goes in the additional header.
+  // Measure the song as it ended up, and drop checkpoints past the end.
+  int songticks=0,p=0;
+  while (p<mksong->song.c) {
+    uint8_t lead=((uint8_t*)mksong->song.v)[p++];
+    if (!(lead&0x80)) songticks+=lead;
+    else if ((lead&0xf8)==0x80) p+=2;
+    else p+=1;
+  }
+  while (mksong->seekc>1) {
+    const uint8_t *last=(uint8_t*)mksong->seek.v+(mksong->seekc-1)*MKSONG_SEEK_ENTRY_SIZE;
+    int tick=last[0]|(last[1]<<8)|(last[2]<<16)|(last[3]<<24);
+    int offset=last[4]|(last[5]<<8);
+    if ((tick<songticks)&&(offset<=mksong->song.c)) break;
+    mksong->seekc--;
+  }
+  struct encoder addl={0};
+  if (mksong->seekc) {
+    if (
+      (encode_intle(&addl,MKSONG_SEEK_INTERVAL,2)<0)||
+      (encode_intle(&addl,mksong->seekc,2)<0)||
+      (encode_intle(&addl,songticks,4)<0)||
+      (encode_raw(&addl,mksong->seek.v,mksong->seekc*MKSONG_SEEK_ENTRY_SIZE)<0)
+    ) {
+      encoder_cleanup(&addl);
+      return -1;
+    }
+  }
+  
   // Emit header.
   int ticksperbeat=((int64_t)mksong->reader->usperqnote*(int64_t)22050)/(int64_t)1000000;
   if ((ticksperbeat<1)||(ticksperbeat>0xffff)) {
     fprintf(stderr,"%s: Unexpressible tempo. us/qnote=%d\n",TOOL->srcpath,mksong->reader->usperqnote);
+    encoder_cleanup(&addl);
     return -1;
   }
   uint16_t header[]={
     ticksperbeat,
-    0, // addl header len
+    addl.c, // a multiple of 4, so fakesheet stays aligned
     mksong->song.c,
     mksong->fakesheet.c,
   };
   if (encode_raw(&mksong->bin,header,sizeof(header))<0) return -1;
   
   // Emit chunks.
-  // zero-length additional header -- done
+  if (encode_raw(&mksong->bin,addl.v,addl.c)<0) return -1;
+  encoder_cleanup(&addl);
   if (encode_raw(&mksong->bin,mksong->song.v,mksong->song.c)<0) return -1;
   if (encode_raw(&mksong->bin,mksong->fakesheet.v,mksong->fakesheet.c)<0) return -1;
 
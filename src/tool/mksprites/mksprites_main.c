@@ -0,0 +1,359 @@
+#include "tool/common/tool_utils.h"
+#include "tool/common/png.h"
+#include "tool/common/fs.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* mksprites
+ * Input is a manifest naming rectangles of a sprite sheet, eg "src/data/embed/fgbits.sprites".
+ * The sheet is the PNG of the same name, eg "src/data/embed/fgbits.png".
+ * Output is C, one function per name:
+ *   void spr_NAME(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop);
+ * Each frame becomes straight-line stores of its opaque pixels, one function forward and one flopped.
+ * When the frame doesn't fit entirely in (dst), we fall back to image_blit_colorkey().
+ *
+ * Manifest, line-oriented, '#' begins a comment:
+ *   NAME X Y W H [COUNT DX] [noflop]
+ * COUNT frames, each DX pixels right of the last. Repeating a NAME appends frames.
+ * "noflop" skips the flopped variants for that line's frames; flopped calls then use image_blit_colorkey_flop().
+ */
+
+#define MKSPRITES_NAME_LIMIT 32
+
+struct mksprites_frame {
+  char name[MKSPRITES_NAME_LIMIT];
+  int namec;
+  int x,y,w,h;
+  int flop;
+};
+
+static struct mksprites {
+  struct mksprites_frame *framev;
+  int framec,framea;
+  uint16_t *pixels;
+  int imgw,imgh;
+  char stem[64]; // image's C name, eg "fgbits"
+  int stemc;
+} mksprites={0};
+
+/* Pixels, same conversion as cvtimg.
+ */
+
+static uint16_t mksprites_rgb565nz(uint8_t r,uint8_t g,uint8_t b) {
+  uint16_t rgb=((r<<5)&0x1f00)|(g>>5)|((g<<11)&0xe000)|(b&0x00f8);
+  if (!rgb) return 0x2000;
+  return rgb;
+}
+
+static int mksprites_load_image(const char *manifestpath) {
+  int pathc=0; while (manifestpath[pathc]) pathc++;
+  int dotp=pathc,slashp=-1;
+  int i=pathc; while (i-->0) {
+    if (manifestpath[i]=='/') { slashp=i; break; }
+    if ((manifestpath[i]=='.')&&(dotp==pathc)) dotp=i;
+  }
+  char path[1024];
+  int pathlen=snprintf(path,sizeof(path),"%.*s.png",dotp,manifestpath);
+  if ((pathlen<1)||(pathlen>=sizeof(path))) return -1;
+  mksprites.stemc=dotp-slashp-1;
+  if ((mksprites.stemc<1)||(mksprites.stemc>=sizeof(mksprites.stem))) return -1;
+  memcpy(mksprites.stem,manifestpath+slashp+1,mksprites.stemc);
+
+  void *src=0;
+  int srcc=file_read(&src,path);
+  if (srcc<0) {
+    fprintf(stderr,"%s: Failed to read file\n",path);
+    return -1;
+  }
+  struct png_image *image=png_decode(src,srcc);
+  free(src);
+  if (!image) {
+    fprintf(stderr,"%s: Failed to decode as PNG\n",path);
+    return -1;
+  }
+  if ((image->colortype!=6)||(image->depth!=8)) {
+    fprintf(stderr,"%s: Must be 8-bit RGBA (have depth=%d colortype=%d)\n",path,image->depth,image->colortype);
+    return -1;
+  }
+  mksprites.imgw=image->w;
+  mksprites.imgh=image->h;
+  if (!(mksprites.pixels=malloc(image->w*image->h*2))) return -1;
+  const uint8_t *p=image->pixels;
+  uint16_t *dst=mksprites.pixels;
+  for (i=image->w*image->h;i-->0;dst++,p+=4) {
+    if (p[3]) *dst=mksprites_rgb565nz(p[0],p[1],p[2]);
+    else *dst=0;
+  }
+  png_image_del(image);
+  return 0;
+}
+
+/* Manifest.
+ */
+
+static int mksprites_is_identifier(const char *src,int srcc) {
+  if ((srcc<1)||((src[0]>='0')&&(src[0]<='9'))) return 0;
+  for (;srcc-->0;src++) {
+    if ((*src>='a')&&(*src<='z')) continue;
+    if ((*src>='A')&&(*src<='Z')) continue;
+    if ((*src>='0')&&(*src<='9')) continue;
+    if (*src=='_') continue;
+    return 0;
+  }
+  return 1;
+}
+
+static int mksprites_add_frame(const char *name,int namec,int x,int y,int w,int h,int flop) {
+  if ((w<1)||(h<1)||(x<0)||(y<0)||(x>mksprites.imgw-w)||(y>mksprites.imgh-h)) return -1;
+  if (mksprites.framec>=mksprites.framea) {
+    int na=mksprites.framea+64;
+    void *nv=realloc(mksprites.framev,sizeof(struct mksprites_frame)*na);
+    if (!nv) return -1;
+    mksprites.framev=nv;
+    mksprites.framea=na;
+  }
+  struct mksprites_frame *frame=mksprites.framev+mksprites.framec++;
+  memcpy(frame->name,name,namec);
+  frame->namec=namec;
+  frame->x=x;
+  frame->y=y;
+  frame->w=w;
+  frame->h=h;
+  frame->flop=flop;
+  return 0;
+}
+
+static int mksprites_read_line(const char *src,int srcc,const char *path,int lineno) {
+  const char *tokenv[8];
+  int tokencv[8];
+  int tokenc=0,srcp=0;
+  while (srcp<srcc) {
+    if ((unsigned char)src[srcp]<=0x20) { srcp++; continue; }
+    if (tokenc>=8) {
+      fprintf(stderr,"%s:%d: Too many tokens\n",path,lineno);
+      return -1;
+    }
+    tokenv[tokenc]=src+srcp;
+    tokencv[tokenc]=0;
+    while ((srcp<srcc)&&((unsigned char)src[srcp]>0x20)) { srcp++; tokencv[tokenc]++; }
+    tokenc++;
+  }
+  if (!tokenc) return 0;
+
+  int flop=1;
+  if ((tokencv[tokenc-1]==6)&&!memcmp(tokenv[tokenc-1],"noflop",6)) {
+    flop=0;
+    tokenc--;
+  }
+  if ((tokenc!=5)&&(tokenc!=7)) {
+    fprintf(stderr,"%s:%d: Expected 'NAME X Y W H [COUNT DX] [noflop]'\n",path,lineno);
+    return -1;
+  }
+  if ((tokencv[0]>=MKSPRITES_NAME_LIMIT)||!mksprites_is_identifier(tokenv[0],tokencv[0])) {
+    fprintf(stderr,"%s:%d: Invalid name '%.*s'\n",path,lineno,tokencv[0],tokenv[0]);
+    return -1;
+  }
+  int v[7]={0,0,0,0,0,1,0};
+  int i=1; for (;i<tokenc;i++) {
+    const char *t=tokenv[i];
+    int tc=tokencv[i];
+    v[i]=0;
+    for (;tc-->0;t++) {
+      if ((*t<'0')||(*t>'9')) {
+        fprintf(stderr,"%s:%d: Expected integer, found '%.*s'\n",path,lineno,tokencv[i],tokenv[i]);
+        return -1;
+      }
+      v[i]=v[i]*10+(*t)-'0';
+    }
+  }
+  int x=v[1];
+  for (i=v[5];i-->0;x+=v[6]) {
+    if (mksprites_add_frame(tokenv[0],tokencv[0],x,v[2],v[3],v[4],flop)<0) {
+      fprintf(stderr,"%s:%d: Frame (%d,%d,%d,%d) outside %dx%d image\n",path,lineno,x,v[2],v[3],v[4],mksprites.imgw,mksprites.imgh);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int mksprites_read_manifest(const char *src,int srcc,const char *path) {
+  int srcp=0,lineno=0;
+  while (srcp<srcc) {
+    lineno++;
+    const char *line=src+srcp;
+    int linec=0;
+    while ((srcp<srcc)&&(src[srcp]!=0x0a)) { srcp++; linec++; }
+    if (srcp<srcc) srcp++;
+    int i=0; for (;i<linec;i++) if (line[i]=='#') { linec=i; break; }
+    if (mksprites_read_line(line,linec,path,lineno)<0) return -1;
+  }
+  if (!mksprites.framec) {
+    fprintf(stderr,"%s: No sprites\n",path);
+    return -1;
+  }
+  return 0;
+}
+
+/* Generate one frame's function.
+ */
+
+static int mksprites_generate_frame(struct tool *tool,const struct mksprites_frame *frame,int framep,int flop) {
+  if (encode_fmt(&tool->dst,
+    "static void spr_%.*s_%d%s(struct image *dst,int16_t dstx,int16_t dsty) {\n",
+    frame->namec,frame->name,framep,flop?"_flop":""
+  )<0) return -1;
+  if (encode_fmt(&tool->dst,
+    "  if ((dstx<0)||(dsty<0)||(dstx>dst->w-%d)||(dsty>dst->h-%d)) {\n"
+    "    image_blit_colorkey%s(dst,dstx,dsty,&%.*s,%d,%d,%d,%d);\n"
+    "    return;\n"
+    "  }\n"
+    "  DAMAGE_NOTE(dst,dstx,dsty,%d,%d)\n"
+    "  uint16_t *p=dst->v+dsty*dst->stride+dstx;\n",
+    frame->w,frame->h,
+    flop?"_flop":"",mksprites.stemc,mksprites.stem,frame->x,frame->y,frame->w,frame->h,
+    frame->w,frame->h
+  )<0) return -1;
+  // Skip empty rows by folding them into the next advance.
+  int pendingrows=0;
+  int y=0; for (;y<frame->h;y++) {
+    const uint16_t *row=mksprites.pixels+(frame->y+y)*mksprites.imgw+frame->x;
+    int any=0,x=0;
+    for (;x<frame->w;x++) if (row[x]) { any=1; break; }
+    if (!any) {
+      pendingrows++;
+      continue;
+    }
+    if (pendingrows==1) {
+      if (encode_raw(&tool->dst,"  p+=dst->stride;\n",-1)<0) return -1;
+    } else if (pendingrows>1) {
+      if (encode_fmt(&tool->dst,"  p+=dst->stride*%d;\n",pendingrows)<0) return -1;
+    }
+    if (encode_raw(&tool->dst," ",1)<0) return -1;
+    for (x=0;x<frame->w;x++) {
+      uint16_t pixel=row[x];
+      if (!pixel) continue;
+      int dstx=flop?(frame->w-1-x):x;
+      if (encode_fmt(&tool->dst," p[%d]=0x%04x;",dstx,pixel)<0) return -1;
+    }
+    if (encode_raw(&tool->dst,"\n",1)<0) return -1;
+    pendingrows=1;
+  }
+  if (encode_raw(&tool->dst,"}\n",-1)<0) return -1;
+  return 0;
+}
+
+/* Generate the public function for one name, with its frames at (framev[p..p+c-1]).
+ */
+
+static int mksprites_generate_name(struct tool *tool,int p,int c) {
+  const struct mksprites_frame *frame=mksprites.framev+p;
+  int i;
+  for (i=0;i<c;i++) {
+    if (mksprites_generate_frame(tool,frame+i,i,0)<0) return -1;
+    if (frame[i].flop&&(mksprites_generate_frame(tool,frame+i,i,1)<0)) return -1;
+  }
+  if (encode_fmt(&tool->dst,"static void (*const spr_%.*s_v[])(struct image*,int16_t,int16_t)={\n",frame->namec,frame->name)<0) return -1;
+  for (i=0;i<c;i++) {
+    if (encode_fmt(&tool->dst,"  spr_%.*s_%d,\n",frame->namec,frame->name,i)<0) return -1;
+  }
+  if (encode_raw(&tool->dst,"};\n",-1)<0) return -1;
+  if (encode_fmt(&tool->dst,"static void (*const spr_%.*s_flop_v[])(struct image*,int16_t,int16_t)={\n",frame->namec,frame->name)<0) return -1;
+  for (i=0;i<c;i++) {
+    if (frame[i].flop) {
+      if (encode_fmt(&tool->dst,"  spr_%.*s_%d_flop,\n",frame->namec,frame->name,i)<0) return -1;
+    } else {
+      if (encode_raw(&tool->dst,"  0,\n",-1)<0) return -1;
+    }
+  }
+  if (encode_raw(&tool->dst,"};\n",-1)<0) return -1;
+
+  // Frames without a flopped variant need their rects for the fallback.
+  int anynoflop=0;
+  for (i=0;i<c;i++) if (!frame[i].flop) anynoflop=1;
+  if (anynoflop) {
+    if (encode_fmt(&tool->dst,"static const uint8_t spr_%.*s_rectv[]={\n",frame->namec,frame->name)<0) return -1;
+    for (i=0;i<c;i++) {
+      if (encode_fmt(&tool->dst,"  %d,%d,%d,%d,\n",frame[i].x,frame[i].y,frame[i].w,frame[i].h)<0) return -1;
+    }
+    if (encode_raw(&tool->dst,"};\n",-1)<0) return -1;
+  }
+
+  if (encode_fmt(&tool->dst,
+    "void spr_%.*s(struct image *dst,int16_t dstx,int16_t dsty,uint8_t frame,uint8_t flop) {\n"
+    "  if (frame>=%d) return;\n",
+    frame->namec,frame->name,c
+  )<0) return -1;
+  if (anynoflop) {
+    if (encode_fmt(&tool->dst,
+      "  if (flop) {\n"
+      "    if (spr_%.*s_flop_v[frame]) spr_%.*s_flop_v[frame](dst,dstx,dsty);\n"
+      "    else {\n"
+      "      const uint8_t *r=spr_%.*s_rectv+(frame<<2);\n"
+      "      image_blit_colorkey_flop(dst,dstx,dsty,&%.*s,r[0],r[1],r[2],r[3]);\n"
+      "    }\n"
+      "  } else spr_%.*s_v[frame](dst,dstx,dsty);\n",
+      frame->namec,frame->name,frame->namec,frame->name,frame->namec,frame->name,
+      mksprites.stemc,mksprites.stem,frame->namec,frame->name
+    )<0) return -1;
+  } else {
+    if (encode_fmt(&tool->dst,
+      "  (flop?spr_%.*s_flop_v:spr_%.*s_v)[frame](dst,dstx,dsty);\n",
+      frame->namec,frame->name,frame->namec,frame->name
+    )<0) return -1;
+  }
+  if (encode_raw(&tool->dst,"}\n",-1)<0) return -1;
+  return 0;
+}
+
+/* Generate C.
+ */
+
+static int mksprites_generate(struct tool *tool) {
+  if (encode_raw(&tool->dst,
+    "#include <stdint.h>\n"
+    "#include \"platform.h\"\n"
+    "#include \"data.h\"\n"
+    "#include \"damage.h\"\n",
+  -1)<0) return -1;
+  // Group frames by name, in order of first appearance. Names are few; quadratic is fine.
+  uint8_t *done=calloc(1,mksprites.framec);
+  if (!done) return -1;
+  int i=0; for (;i<mksprites.framec;i++) {
+    if (done[i]) continue;
+    const struct mksprites_frame *a=mksprites.framev+i;
+    // Move all frames of this name adjacent, preserving order.
+    int c=0,j=i;
+    for (;j<mksprites.framec;j++) {
+      struct mksprites_frame *b=mksprites.framev+j;
+      if ((b->namec!=a->namec)||memcmp(b->name,a->name,a->namec)) continue;
+      struct mksprites_frame tmp=*b;
+      memmove(mksprites.framev+i+c+1,mksprites.framev+i+c,sizeof(struct mksprites_frame)*(j-i-c));
+      memmove(done+i+c+1,done+i+c,j-i-c);
+      mksprites.framev[i+c]=tmp;
+      done[i+c]=1;
+      c++;
+    }
+    if (mksprites_generate_name(tool,i,c)<0) return -1;
+  }
+  free(done);
+  return 0;
+}
+
+/* Main.
+ */
+
+int main(int argc,char **argv) {
+  struct tool tool={0};
+  if (tool_startup(&tool,argc,argv,0)<0) return 1;
+  if (tool.terminate) return 0;
+  if (tool_read_input(&tool)<0) return 1;
+  if (mksprites_load_image(tool.srcpath)<0) return 1;
+  if (mksprites_read_manifest(tool.src,tool.srcc,tool.srcpath)<0) return 1;
+  if (mksprites_generate(&tool)<0) {
+    fprintf(stderr,"%s: Failed to generate C\n",tool.srcpath);
+    return 1;
+  }
+  if (tool_write_output(&tool)<0) return 1;
+  return 0;
+}
@@ -0,0 +1,406 @@
+/* rendersong_main.c
+ * Play songs from mksong through the real synthesizer and embedded waves, as fast as the CPU allows.
+ * Writes a WAV file, so you can hear a song without the game or a device.
+ * Also reports throughput, so it doubles as our benchmark for synth changes.
+ */
+
+#include "tool/common/fs.h"
+#include "tool/common/decoder.h"
+#include "main/synth.h"
+#include "main/data.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define RENDERSONG_RATE 22050
+#define RENDERSONG_BLOCK_SIZE 1024
+#define RENDERSONG_TAIL_LIMIT (RENDERSONG_RATE*10) /* after the last event, give notes this long to ring out */
+#define RENDERSONG_THREAD_LIMIT 64
+
+/* One song, as read from disk.
+ * Each job renders into its own synth and PCM, so jobs can run concurrently on the same song.
+ */
+
+struct rendersong_song {
+  const char *path;
+  uint8_t *bin; // as written by mksong
+  int binc;
+  const uint8_t *song; // the event stream within (bin)
+  int songc;
+  int tickc; // length of one pass
+  int framec; // length of one pass, excluding release tail
+  int startframec; // frames of the pass skipped by --start
+};
+
+struct rendersong_job {
+  struct rendersong_song *song;
+  int16_t *pcm; // only when we're keeping the output
+  int pcmc;
+  int64_t framec;
+  double cpu_s;
+};
+
+static struct rendersong {
+  const char *exename;
+  const char *dstpath;
+  int threadc;
+  int repeatc;
+  int starttick;
+  struct rendersong_song *songv;
+  int songc,songa;
+  struct rendersong_job *jobv;
+  int jobc;
+  int jobp; // next job to claim, shared by workers
+} rendersong={0};
+
+/* Clocks.
+ */
+
+static double rendersong_now_s() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+static double rendersong_now_thread_cpu_s() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID,&tv);
+  return tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+/* Read the byte array out of mksong's C output.
+ * Anything without a '{' we take as the raw binary, in case you have one.
+ */
+
+static int rendersong_decode_c(uint8_t **dst,const char *src,int srcc) {
+  int srcp=0;
+  while ((srcp<srcc)&&(src[srcp]!='{')) srcp++;
+  if (srcp>=srcc) {
+    if (!(*dst=malloc(srcc?srcc:1))) return -1;
+    memcpy(*dst,src,srcc);
+    return srcc;
+  }
+  srcp++;
+  uint8_t *v=malloc(srcc); // can't be more bytes than characters
+  if (!v) return -1;
+  int c=0;
+  while (srcp<srcc) {
+    char ch=src[srcp];
+    if (ch=='}') break;
+    if ((ch>='0')&&(ch<='9')) {
+      char *end=0;
+      long n=strtol(src+srcp,&end,0);
+      if ((n<0)||(n>0xff)) {
+        free(v);
+        return -1;
+      }
+      v[c++]=n;
+      srcp=end-src;
+    } else {
+      srcp++;
+    }
+  }
+  *dst=v;
+  return c;
+}
+
+/* Load song and find its length.
+ * Header is four u16 LE: ticks per beat, additional header length, song length, fakesheet length.
+ * One pass is the sum of the delays, plus one frame per delay and one at the end where the synth reads events.
+ */
+
+static int rendersong_load(struct rendersong_song *song) {
+  char *src=0;
+  int srcc=file_read(&src,song->path);
+  if (srcc<0) {
+    fprintf(stderr,"%s: Failed to read file.\n",song->path);
+    return -1;
+  }
+  song->binc=rendersong_decode_c(&song->bin,src,srcc);
+  free(src);
+  if (song->binc<8) {
+    fprintf(stderr,"%s: Not a song from mksong.\n",song->path);
+    return -1;
+  }
+  int addlc=song->bin[2]|(song->bin[3]<<8);
+  song->songc=song->bin[4]|(song->bin[5]<<8);
+  if (8+addlc>song->binc-song->songc) {
+    fprintf(stderr,"%s: Song length %d overruns file (%d).\n",song->path,song->songc,song->binc);
+    return -1;
+  }
+  song->song=song->bin+8+addlc;
+
+  int tickc=0,delayc=0,p=0;
+  while (p<song->songc) {
+    uint8_t lead=song->song[p++];
+    if (!(lead&0x80)) {
+      tickc+=lead;
+      delayc++;
+    } else switch (lead&0xf8) {
+      case 0x80: p+=2; break;
+      case 0xe0: case 0xc0: p+=1; break;
+      default: p=song->songc; break; // unknown; the synth will stop here too
+    }
+  }
+  song->tickc=tickc;
+  song->framec=tickc*SYNTH_FRAMES_PER_TICK+delayc+1;
+  return 0;
+}
+
+/* How many frames into the pass does (tick) fall?
+ * Counted the same way as (framec), so (framec-startframec) is what's left after synth_seek().
+ */
+
+static int rendersong_frames_at_tick(const struct rendersong_song *song,int tick) {
+  if (song->tickc) tick%=song->tickc;
+  int framec=1,now=0,p=0;
+  while (p<song->songc) {
+    uint8_t lead=song->song[p++];
+    if (!(lead&0x80)) {
+      if (now+lead>tick) return framec+(tick-now)*SYNTH_FRAMES_PER_TICK;
+      framec+=lead*SYNTH_FRAMES_PER_TICK+1;
+      now+=lead;
+    } else if ((lead&0xf8)==0x80) p+=2;
+    else p+=1;
+  }
+  return framec;
+}
+
+/* Render one job.
+ */
+
+static int rendersong_any_voice_live(const struct synth *synth) {
+  int i=SYNTH_VOICE_LIMIT;
+  while (i-->0) if (synth->voicev[i].ttl) return 1;
+  return 0;
+}
+
+static void rendersong_run_job(struct rendersong_job *job,int keep) {
+  double starttime=rendersong_now_thread_cpu_s();
+  struct synth *synth=calloc(1,sizeof(struct synth));
+  if (!synth) return;
+  synth->wavev[0]=wave0;
+  synth->wavev[1]=wave1;
+  synth->wavev[2]=wave2;
+  synth->wavev[3]=wave3;
+  synth->wavev[4]=wave4;
+  synth->wavev[5]=wave5;
+  synth->wavev[6]=wave6;
+  synth->wavev[7]=wave7;
+  if (synth_play_song(synth,job->song->bin,job->song->binc)<0) {
+    free(synth);
+    return;
+  }
+  if (rendersong.starttick) synth_seek(synth,rendersong.starttick);
+  int64_t passc=job->song->framec-job->song->startframec;
+
+  int pcma=0;
+  int16_t scratch[RENDERSONG_BLOCK_SIZE];
+  int64_t framec=passc+RENDERSONG_TAIL_LIMIT;
+  int tail=0;
+  while (job->framec<framec) {
+    int c=RENDERSONG_BLOCK_SIZE;
+    if (!tail) {
+      // Stop exactly at the end of the pass, and let what's playing ring out.
+      if (job->framec>=passc) {
+        synth->song=0;
+        synth_release_all(synth);
+        tail=1;
+      } else if (job->framec+c>passc) {
+        c=passc-job->framec;
+      }
+    }
+    if (tail&&!rendersong_any_voice_live(synth)) break;
+    int16_t *dst=scratch;
+    if (keep) {
+      if (job->pcmc>pcma-c) {
+        int na=pcma?(pcma<<1):(RENDERSONG_RATE*8);
+        void *nv=realloc(job->pcm,sizeof(int16_t)*na);
+        if (!nv) break;
+        job->pcm=nv;
+        pcma=na;
+      }
+      dst=job->pcm+job->pcmc;
+      job->pcmc+=c;
+    }
+    synth_render_block(synth,dst,c);
+    job->framec+=c;
+  }
+  free(synth);
+  job->cpu_s=rendersong_now_thread_cpu_s()-starttime;
+}
+
+/* Worker thread: Claim jobs until there are none left.
+ * Only the first job keeps its output; the rest are just for timing.
+ */
+
+static void *rendersong_worker(void *dummy) {
+  for (;;) {
+    int p=__atomic_fetch_add(&rendersong.jobp,1,__ATOMIC_RELAXED);
+    if (p>=rendersong.jobc) return 0;
+    rendersong_run_job(rendersong.jobv+p,!p&&rendersong.dstpath);
+  }
+}
+
+/* Write WAV file.
+ */
+
+static int rendersong_write_wav(const char *path,const int16_t *v,int c) {
+  struct encoder dst={0};
+  if (
+    (encode_raw(&dst,"RIFF",4)<0)||
+    (encode_intle(&dst,36+c*2,4)<0)||
+    (encode_raw(&dst,"WAVEfmt ",8)<0)||
+    (encode_intle(&dst,16,4)<0)||
+    (encode_intle(&dst,1,2)<0)|| // PCM
+    (encode_intle(&dst,1,2)<0)|| // mono
+    (encode_intle(&dst,RENDERSONG_RATE,4)<0)||
+    (encode_intle(&dst,RENDERSONG_RATE*2,4)<0)|| // bytes/sec
+    (encode_intle(&dst,2,2)<0)|| // bytes/frame
+    (encode_intle(&dst,16,2)<0)|| // bits/sample
+    (encode_raw(&dst,"data",4)<0)||
+    (encode_intle(&dst,c*2,4)<0)
+  ) {
+    encoder_cleanup(&dst);
+    return -1;
+  }
+  for (;c-->0;v++) {
+    if (encode_intle(&dst,*v,2)<0) {
+      encoder_cleanup(&dst);
+      return -1;
+    }
+  }
+  int err=file_write(path,dst.v,dst.c);
+  encoder_cleanup(&dst);
+  return err;
+}
+
+/* argv.
+ */
+
+static void rendersong_print_help() {
+  fprintf(stderr,"Usage: %s [-oOUTPUT.wav] [--threads=INT] [--repeat=INT] [--start=TICK] SONG...\n",rendersong.exename);
+  fprintf(stderr,
+    "SONG is the C file from mksong (or its raw binary).\n"
+    "With --start, each render seeks to TICK (96/s) first and plays to the end of the pass.\n"
+    "Every SONG renders (repeat) times, spread across (threads), default 1 and 1.\n"
+    "The first SONG's first render goes to OUTPUT, if provided.\n"
+  );
+}
+
+static int rendersong_argv(int argc,char **argv) {
+  rendersong.exename=(argc>=1)?argv[0]:"rendersong";
+  rendersong.threadc=1;
+  rendersong.repeatc=1;
+  int argp=1;
+  for (;argp<argc;argp++) {
+    const char *arg=argv[argp];
+    if (!strcmp(arg,"--help")) {
+      rendersong_print_help();
+      return 0;
+    }
+    if (!memcmp(arg,"-o",2)) {
+      rendersong.dstpath=arg+2;
+      continue;
+    }
+    if (!memcmp(arg,"--threads=",10)) {
+      if ((rendersong.threadc=atoi(arg+10))<1) rendersong.threadc=1;
+      else if (rendersong.threadc>RENDERSONG_THREAD_LIMIT) rendersong.threadc=RENDERSONG_THREAD_LIMIT;
+      continue;
+    }
+    if (!memcmp(arg,"--start=",8)) {
+      if ((rendersong.starttick=atoi(arg+8))<0) rendersong.starttick=0;
+      continue;
+    }
+    if (!memcmp(arg,"--repeat=",9)) {
+      if ((rendersong.repeatc=atoi(arg+9))<1) rendersong.repeatc=1;
+      continue;
+    }
+    if (arg[0]=='-') {
+      fprintf(stderr,"%s: Unexpected option '%s'\n",rendersong.exename,arg);
+      return -1;
+    }
+    if (rendersong.songc>=rendersong.songa) {
+      int na=rendersong.songa+8;
+      void *nv=realloc(rendersong.songv,sizeof(struct rendersong_song)*na);
+      if (!nv) return -1;
+      rendersong.songv=nv;
+      rendersong.songa=na;
+    }
+    struct rendersong_song *song=rendersong.songv+rendersong.songc++;
+    memset(song,0,sizeof(struct rendersong_song));
+    song->path=arg;
+  }
+  if (!rendersong.songc) {
+    rendersong_print_help();
+    return -1;
+  }
+  return 1;
+}
+
+/* Main.
+ */
+
+int main(int argc,char **argv) {
+  int err=rendersong_argv(argc,argv);
+  if (err<=0) return err?1:0;
+
+  int i=0;
+  for (;i<rendersong.songc;i++) {
+    struct rendersong_song *song=rendersong.songv+i;
+    if (rendersong_load(song)<0) return 1;
+    if (rendersong.starttick) song->startframec=rendersong_frames_at_tick(song,rendersong.starttick);
+  }
+
+  rendersong.jobc=rendersong.songc*rendersong.repeatc;
+  if (!(rendersong.jobv=calloc(rendersong.jobc,sizeof(struct rendersong_job)))) return 1;
+  for (i=0;i<rendersong.jobc;i++) rendersong.jobv[i].song=rendersong.songv+(i%rendersong.songc);
+
+  double starttime=rendersong_now_s();
+  if (rendersong.threadc<=1) {
+    rendersong_worker(0);
+  } else {
+    pthread_t threadv[RENDERSONG_THREAD_LIMIT];
+    int threadc=0;
+    for (;threadc<rendersong.threadc;threadc++) {
+      if (pthread_create(threadv+threadc,0,rendersong_worker,0)) {
+        fprintf(stderr,"%s: Failed to create thread. Proceeding with %d.\n",rendersong.exename,threadc);
+        break;
+      }
+    }
+    if (!threadc) rendersong_worker(0);
+    while (threadc-->0) pthread_join(threadv[threadc],0);
+  }
+  double elapsed=rendersong_now_s()-starttime;
+
+  int64_t framec=0;
+  double cpu_s=0.0;
+  const struct rendersong_job *job=rendersong.jobv;
+  for (i=rendersong.jobc;i-->0;job++) {
+    framec+=job->framec;
+    cpu_s+=job->cpu_s;
+  }
+  if (elapsed<=0.0) elapsed=1e-9;
+  if (cpu_s<=0.0) cpu_s=1e-9;
+  double audio_s=(double)framec/RENDERSONG_RATE;
+  fprintf(stderr,
+    "%d renders on %d threads: %lld samples (%.03f s audio) in %.03f s wall, %.03f s CPU.\n",
+    rendersong.jobc,rendersong.threadc,(long long)framec,audio_s,elapsed,cpu_s
+  );
+  fprintf(stderr,
+    "%.0f samples/s, %.01fx real time; per thread %.0f samples/s, %.01fx real time.\n",
+    framec/elapsed,audio_s/elapsed,framec/cpu_s,audio_s/cpu_s
+  );
+
+  if (rendersong.dstpath) {
+    job=rendersong.jobv;
+    if (rendersong_write_wav(rendersong.dstpath,job->pcm,job->pcmc)<0) {
+      fprintf(stderr,"%s: Failed to write WAV.\n",rendersong.dstpath);
+      return 1;
+    }
+    fprintf(stderr,"%s: Wrote %.03f s from %s.\n",rendersong.dstpath,(double)job->pcmc/RENDERSONG_RATE,job->song->path);
+  }
+  return 0;
+}